@@ -1,3 +1,4 @@
 set -xe
 
-clang -o watch-exec src/main.c -lpthread -Wall -Wextra -Wpedantic -Wno-unused-function -Werror -g
\ No newline at end of file
+clang -o watch-exec src/main.c -lpthread -Wall -Wextra -Wpedantic -Wno-unused-function -Werror -g
+clang -shared -fPIC -o watch-exec-trace.so src/trace_preload.c -ldl -Wall -Wextra -Wpedantic -Werror -g
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "header.h"
+
+#ifndef BENCH_SPAWN_BALLAST_MB
+#   define BENCH_SPAWN_BALLAST_MB 256 // Memory touched by the parent to see how spawn latency scales with the parent's size
+#endif
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+internal void bench_spawn(AIL_DA(str) *argv, u32 runs)
+{
+    AIL_UNUSED(argv);
+    AIL_UNUSED(runs);
+    log_err("Benchmarking the spawn latency is not supported on Windows yet");
+}
+
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+typedef enum BenchSpawnMethod {
+    BENCH_POSIX_SPAWN,
+    BENCH_FORK_EXEC,
+    BENCH_ZYGOTE, // Only measured with --zygote
+} BenchSpawnMethod;
+
+internal void bench_spawn_once(char *exe, char **args, BenchSpawnMethod method, u64 *spawn_ns, u64 *total_ns)
+{
+    u64 start = timer_now_ns();
+    pid_t pid;
+    if (method == BENCH_ZYGOTE) {
+        // @Note: Opening the null device is part of every other method as well
+        int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        SubProcSpawn spawn = { .exe = exe, .argv = args, .env = environ, .in_path = "/dev/null", .fds = { -1, -1, fd }, .n_fds = 3 };
+        if (zygote_spawn(&spawn, &pid)) pid = -1;
+        close(fd);
+        u64 spawned = timer_now_ns();
+        int wstatus;
+        ZygoteMsg msg;
+        while (pid > 0 && zygote_enabled && !zygote_waitpid(pid, &wstatus)) zygote_receive(&msg, true);
+        *spawn_ns += spawned - start;
+        *total_ns += timer_now_ns() - start;
+        return;
+    }
+    if (method == BENCH_FORK_EXEC) {
+        pid = fork();
+        if (pid == 0) {
+            int fd = open("/dev/null", O_WRONLY);
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            execv(exe, args);
+            _exit(127);
+        }
+    } else {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+        if (posix_spawn(&pid, exe, &actions, NULL, args, environ)) pid = -1;
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    u64 spawned = timer_now_ns();
+    if (pid > 0) waitpid(pid, NULL, 0);
+    *spawn_ns += spawned - start;
+    *total_ns += timer_now_ns() - start;
+}
+
+internal void bench_spawn_report(char *exe, char **args, u32 runs, const char *desc)
+{
+    const char *names[] = { "posix_spawn", "fork+exec", "zygote" };
+    for (u32 i = 0; i < (zygote_enabled ? BENCH_ZYGOTE + 1 : BENCH_ZYGOTE); i++) {
+        u64 spawn_ns = 0, total_ns = 0;
+        for (u32 j = 0; j < runs; j++) bench_spawn_once(exe, args, i, &spawn_ns, &total_ns);
+        printf("  %-12s %-22s %9.1fus to spawn, %9.1fus until exit\n", names[i], desc, (f64)spawn_ns/runs/1e3, (f64)total_ns/runs/1e3);
+    }
+}
+
+// Measures the mean latency of starting the command, comparing posix_spawn with fork+exec and the zygote if it's used
+internal void bench_spawn(AIL_DA(str) *argv, u32 runs)
+{
+    char *exe = subproc_resolve(argv->data[0]);
+    if (!exe) {
+        log_err("Could not find '%s' in PATH", argv->data[0]);
+        return;
+    }
+    ail_da_push(argv, NULL);
+    argv->len--;
+    printf("Spawning '%s' %u times:\n", exe, runs);
+    bench_spawn_report(exe, argv->data, runs, "(small parent)");
+
+    u64 ballast_len = (u64)BENCH_SPAWN_BALLAST_MB << 20;
+    char *ballast = AIL_CALL_ALLOC(ail_default_allocator, ballast_len);
+    if (!ballast) return;
+    memset(ballast, 1, ballast_len); // Touch every page so that it is actually mapped
+    char desc[32];
+    snprintf(desc, sizeof(desc), "(+%d MiB in parent)", BENCH_SPAWN_BALLAST_MB);
+    bench_spawn_report(exe, argv->data, runs, desc);
+    AIL_CALL_FREE(ail_default_allocator, ballast);
+}
+
+#endif
+
+#ifndef BENCH_FILTER_CHUNK
+#   define BENCH_FILTER_CHUNK (64 << 10) // Amount of output handed to the filter at once, similar to what a pipe delivers
+#endif
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <io.h>
+#   define bench_dup(fd)       _dup(fd)
+#   define bench_dup2(fd, fd2) _dup2(fd, fd2)
+#   define bench_close(fd)     _close(fd)
+#   define BENCH_NULL_FD       _open("NUL", _O_WRONLY)
+#else
+#   define bench_dup(fd)       dup(fd)
+#   define bench_dup2(fd, fd2) dup2(fd, fd2)
+#   define bench_close(fd)     close(fd)
+#   define BENCH_NULL_FD       open("/dev/null", O_WRONLY)
+#endif
+
+// Measures the throughput of the escape sequence filter on n MiB of compiler-like output, that is written to the null device
+internal void bench_filter(u32 mib)
+{
+    u64 len = (u64)mib << 20;
+    char *data = AIL_CALL_ALLOC(ail_default_allocator, len);
+    if (!data) return;
+    const char *line = "src/main.c:42:13: warning: unused variable 'x' [-Wunused-variable]\n";
+    const char *seqs[] = { "\x1b[1m", "\x1b[0m", "\x1b[2J", "\x1b[H", "\x1b[31m" };
+    for (u64 i = 0, n = 0; i < len; n++) {
+        // An escape sequence every few lines, about as often as in colored compiler output
+        const char *s = (n % 4 == 0) ? seqs[(n/4) % AIL_ARRLEN(seqs)] : line;
+        u64 l = AIL_MIN(strlen(s), len - i);
+        memcpy(data + i, s, l);
+        i += l;
+    }
+
+    fflush(stdout);
+    int out = bench_dup(1);
+    int null_fd = BENCH_NULL_FD;
+    const char *names[] = { "simd", "scalar" };
+    f64 secs[AIL_ARRLEN(names)];
+    for (u32 k = 0; k < AIL_ARRLEN(names); k++) {
+        filter_force_scalar = k == 1;
+        bench_dup2(null_fd, 1);
+        AnsiFilter filter = {0};
+        u64 start = timer_now_ns();
+        for (u64 i = 0; i < len; i += BENCH_FILTER_CHUNK) filter_write(&filter, data + i, AIL_MIN(BENCH_FILTER_CHUNK, len - i));
+        filter_finish(&filter);
+        secs[k] = (f64)(timer_now_ns() - start)/1e9;
+        bench_dup2(out, 1);
+    }
+    filter_force_scalar = false;
+    bench_close(null_fd);
+    bench_close(out);
+    printf("Filtering %u MiB of output in chunks of %d KiB:\n", mib, BENCH_FILTER_CHUNK >> 10);
+    for (u32 k = 0; k < AIL_ARRLEN(names); k++) {
+        printf("  %-8s %8.2f GB/s\n", names[k], (f64)len/secs[k]/1e9);
+    }
+    AIL_CALL_FREE(ail_default_allocator, data);
+}
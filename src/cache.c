@@ -0,0 +1,555 @@
+#include "header.h"
+
+// Commands given with --cache are skipped if they already succeeded for exactly the same content of their group's files,
+// i.e. after reverting a change or switching back to a branch. Their output is stored and printed again instead
+// The key of a job is the hash of the working directory, its command line and the paths and contents of all files matching its group
+// The state of a group is computed by walking its directories once and is then only updated for the files that the watcher reported
+// Only the `CACHE_MAX_OUTPUTS` most recently used outputs are kept in the cache directory. Their amount and total size are
+// counted once and then kept up to date by storing and pruning, so that the directory is only scanned when a limit is exceeded
+// @Note: Only the output is replayed, so caching is meant for commands that don't produce files (linters, type checkers, tests, ...)
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <windows.h>
+#else
+#   include <dirent.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   include <utime.h>
+#endif
+#include <time.h>
+
+#ifndef CACHE_RACY_SECS
+#   define CACHE_RACY_SECS 2 // Files modified this recently are always hashed again, since the modification time only has a resolution of seconds
+#endif
+#ifndef CACHE_MAX_OUTPUTS
+#   define CACHE_MAX_OUTPUTS 1024 // Amount of stored outputs, above which the least recently used ones are deleted
+#endif
+#ifndef CACHE_MAX_SIZE
+#   define CACHE_MAX_SIZE (256ull*1024*1024) // Total size of the stored outputs in bytes, above which the least recently used ones are deleted
+#endif
+#ifndef CACHE_MAX_CHANGES
+#   define CACHE_MAX_CHANGES 4096 // Amount of reported changes, above which the states of the groups are computed from scratch instead
+#endif
+
+// Content hash of a file, which is only computed again if the file's size or modification time changed
+typedef struct CacheFile {
+    u64 path_hash; // 0 for empty slots
+    u64 mtime;
+    u64 size;
+    u64 hash;
+    u64 groups;    // Bitmask of the groups whose state currently includes the file
+    b32 is_dir;    // Directories are only remembered to notice when they are removed or renamed
+} CacheFile;
+
+// Path of a file in a watched directory that changed since the states of the groups were last updated
+typedef struct CacheChange {
+    u32   dir;
+    char *rel;
+} CacheChange;
+AIL_DA_INIT(CacheChange);
+
+typedef enum CacheKind {
+    CACHE_MISSING,
+    CACHE_FILE,
+    CACHE_DIR,
+    CACHE_OTHER, // Anything that isn't walked, like symbolic links to directories
+} CacheKind;
+
+global char       cache_dir[1024];
+global StrList   *cache_watched;   // Watched directories, that the groups refer to
+global RuleList  *cache_rules;
+global u64        cache_dirs;      // Bitmask of the watched directories of groups with cached commands
+global CacheFile *cache_files;     // Open addressing hash map by the hash of the file's path
+global u32        cache_files_cap;
+global u32        cache_files_len;
+global u64        cache_states[BUFFER_LEN];
+global u64        cache_known;     // Bitmask of the groups whose entry in `cache_states` is up to date, apart from `cache_changes`
+global AIL_DA(CacheChange) cache_changes; // Guarded by `changes_mutex`, since the watcher thread adds to it
+global b32        cache_overflow;  // Guarded by `changes_mutex`, set when changes were dropped, since too many of them piled up
+global b32        cache_outputs_known; // Whether the following two were counted already, which happens when first storing an output
+global u32        cache_outputs_len;
+global u64        cache_outputs_size;
+
+#define CACHE_SEED 0xcbf29ce484222325ull
+
+// Sets up the directory that the output of successful jobs is stored in, which is `dir` or the user's cache directory
+internal void cache_init(const char *dir, StrList *watched, RuleList *rules)
+{
+    cache_watched = watched;
+    cache_rules   = rules;
+    cache_changes = ail_da_new_t(CacheChange);
+    for (u32 i = 0; i < rules->len; i++) {
+        for (u32 j = 0; j < rules->data[i].cmds.len; j++) {
+            if (rules->data[i].cmds.data[j].cached) cache_dirs |= rules->data[i].dirs;
+        }
+    }
+    if (dir) snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+    else {
+#if defined(_WIN32) || defined(__WIN32__)
+        char *base = getenv("LOCALAPPDATA");
+        if (base) snprintf(cache_dir, sizeof(cache_dir), "%s\\watch-exec-cache", base);
+#else
+        char *base = getenv("XDG_CACHE_HOME");
+        if (base && base[0]) snprintf(cache_dir, sizeof(cache_dir), "%s/watch-exec-cache", base);
+        else if ((base = getenv("HOME"))) snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/watch-exec-cache", base);
+#endif
+    }
+    if (!cache_dir[0]) {
+        log_warn("Could not determine a directory for caching the results of commands");
+        return;
+    }
+#if defined(_WIN32) || defined(__WIN32__)
+    if (!CreateDirectoryA(cache_dir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) log_warn("Could not create cache directory '%s'", cache_dir);
+#else
+    if (mkdir(cache_dir, 0755) < 0 && errno != EEXIST) log_warn("Could not create cache directory '%s': %s", cache_dir, strerror(errno));
+#endif
+}
+
+// Called from the watcher thread for every change in the watched directory `dir`, including the ones that matched no group
+internal void cache_note(u32 dir, const char *filepath, const char *oldfilepath)
+{
+    if (!(cache_dirs & (1ull << dir))) return;
+    const char *paths[2] = { filepath, oldfilepath };
+    changes_mutex_lock(&changes_mutex);
+    for (u32 i = 0; i < AIL_ARRLEN(paths) && paths[i] && !cache_overflow; i++) {
+        if (cache_changes.len == CACHE_MAX_CHANGES) {
+            for (u32 j = 0; j < cache_changes.len; j++) AIL_CALL_FREE(ail_default_allocator, cache_changes.data[j].rel);
+            cache_changes.len = 0;
+            cache_overflow    = true;
+            break;
+        }
+        u64 len = strlen(paths[i]);
+        while (len && (paths[i][len - 1] == '/' || paths[i][len - 1] == '\\')) len--;
+        char *rel = AIL_CALL_ALLOC(ail_default_allocator, len + 1);
+        memcpy(rel, paths[i], len);
+        rel[len] = 0;
+        ail_da_push(&cache_changes, ((CacheChange){ .dir = dir, .rel = rel }));
+    }
+    changes_mutex_unlock(&changes_mutex);
+}
+
+// Returns the slot of the path in the hash map, which is added if `create` is set and NULL otherwise
+internal CacheFile *cache_file_slot(u64 path_hash, b32 create)
+{
+    if (!path_hash) path_hash = 1;
+    if (create && 2*(cache_files_len + 1) > cache_files_cap) {
+        u32 old_cap = cache_files_cap;
+        CacheFile *old = cache_files;
+        cache_files_cap = old_cap ? 2*old_cap : 1024;
+        cache_files     = AIL_CALL_ALLOC(ail_default_allocator, sizeof(CacheFile)*cache_files_cap);
+        memset(cache_files, 0, sizeof(CacheFile)*cache_files_cap);
+        cache_files_len = 0;
+        for (u32 i = 0; i < old_cap; i++) {
+            if (old[i].path_hash) *cache_file_slot(old[i].path_hash, true) = old[i];
+        }
+        if (old) AIL_CALL_FREE(ail_default_allocator, old);
+    }
+    if (!cache_files_cap) return NULL;
+    u32 mask = cache_files_cap - 1;
+    for (u32 i = (u32)path_hash & mask;; i = (i + 1) & mask) {
+        if (cache_files[i].path_hash == path_hash) return &cache_files[i];
+        if (!cache_files[i].path_hash) {
+            if (!create) return NULL;
+            cache_files[i].path_hash = path_hash;
+            cache_files_len++;
+            return &cache_files[i];
+        }
+    }
+}
+
+internal u64 cache_path_hash(u32 dir, const char *rel)
+{
+    return history_hash(history_hash(CACHE_SEED, (char *)&dir, sizeof(dir)), rel, strlen(rel));
+}
+
+internal u64 cache_hash_content(const char *path)
+{
+    u64 hash = CACHE_SEED;
+    FILE *f = fopen(path, "rb");
+    if (!f) return hash;
+    char buf[64*1024];
+    u64 n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) hash = history_hash(hash, buf, n);
+    fclose(f);
+    return hash;
+}
+
+// The share of the file in the state of a group
+// @Note: The files are visited in no particular order, so the hashes of all files are summed up after mixing them
+internal u64 cache_mix(CacheFile *file)
+{
+    u64 h = file->path_hash ^ file->hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Adds the file to the state of the group, that the key of its jobs is derived from
+internal void cache_add_file(u32 group, u32 dir, const char *path, const char *rel, u64 mtime, u64 size)
+{
+    CacheFile *file = cache_file_slot(cache_path_hash(dir, rel), true);
+    b32 racy = mtime + CACHE_RACY_SECS >= (u64)time(NULL);
+    if (racy || file->mtime != mtime || file->size != size || !file->hash) {
+        u64 old = cache_mix(file);
+        file->hash  = cache_hash_content(path);
+        file->mtime = racy ? 0 : mtime;
+        file->size  = size;
+        // The change is only reported later, but the other groups that include the file have to stay consistent until then
+        for (u32 i = 0; i < cache_rules->len; i++) {
+            if (file->groups & (1ull << i)) cache_states[i] += cache_mix(file) - old;
+        }
+    }
+    file->is_dir  = false;
+    file->groups |= 1ull << group;
+    cache_states[group] += cache_mix(file);
+}
+
+internal void cache_add_dir(u32 dir, const char *rel)
+{
+    char name[1024];
+    snprintf(name, sizeof(name), "%s", rel);
+    u64 len = strlen(name);
+    if (len && name[len - 1] == '/') name[len - 1] = 0;
+    cache_file_slot(cache_path_hash(dir, name), true)->is_dir = true;
+}
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+internal u64 cache_filetime(FILETIME t)
+{
+    return (((u64)t.dwHighDateTime << 32) | t.dwLowDateTime)/10000000ull - 11644473600ull;
+}
+
+internal void cache_walk(u32 group, u32 dir, const char *root, const char *rel)
+{
+    Rule *rule = &cache_rules->data[group];
+    char pattern[2048];
+    snprintf(pattern, sizeof(pattern), "%s/%s*", root, rel);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        if (!strcmp(data.cFileName, ".") || !strcmp(data.cFileName, "..")) continue;
+        char sub[1024], path[2048];
+        snprintf(sub,  sizeof(sub),  "%s%s", rel, data.cFileName);
+        snprintf(path, sizeof(path), "%s/%s", root, sub);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) continue;
+            strncat(sub, "/", sizeof(sub) - strlen(sub) - 1);
+            cache_add_dir(dir, sub);
+            cache_walk(group, dir, root, sub);
+        } else if (rule_matches(rule, sub)) {
+            u64 size = ((u64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+            cache_add_file(group, dir, path, sub, cache_filetime(data.ftLastWriteTime), size);
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+}
+
+internal CacheKind cache_stat(const char *path, u64 *mtime, u64 *size)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) return CACHE_MISSING;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) return (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? CACHE_OTHER : CACHE_DIR;
+    *mtime = cache_filetime(data.ftLastWriteTime);
+    *size  = ((u64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    return CACHE_FILE;
+}
+
+// Marks the stored output as recently used, so that it is pruned last
+internal void cache_touch(const char *path)
+{
+    HANDLE h = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (h == INVALID_HANDLE_VALUE) return;
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(h, NULL, NULL, &now);
+    CloseHandle(h);
+}
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+// Visits all files in the watched directory `root` below the relative path `rel`, which is empty or ends with a slash
+// @Note: Symbolic links to directories aren't followed, to not loop forever
+internal void cache_walk(u32 group, u32 dir, const char *root, const char *rel)
+{
+    Rule *rule = &cache_rules->data[group];
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    DIR *d = opendir(path);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        char sub[1024];
+        snprintf(sub,  sizeof(sub),  "%s%s", rel, entry->d_name);
+        snprintf(path, sizeof(path), "%s/%s", root, sub);
+        struct stat st;
+        if (lstat(path, &st) < 0) continue;
+        if (S_ISLNK(st.st_mode) && (stat(path, &st) < 0 || S_ISDIR(st.st_mode))) continue;
+        if (S_ISDIR(st.st_mode)) {
+            strncat(sub, "/", sizeof(sub) - strlen(sub) - 1);
+            cache_add_dir(dir, sub);
+            cache_walk(group, dir, root, sub);
+        } else if (S_ISREG(st.st_mode) && rule_matches(rule, sub)) {
+            cache_add_file(group, dir, path, sub, (u64)st.st_mtime, (u64)st.st_size);
+        }
+    }
+    closedir(d);
+}
+
+internal CacheKind cache_stat(const char *path, u64 *mtime, u64 *size)
+{
+    struct stat st;
+    if (lstat(path, &st) < 0) return CACHE_MISSING;
+    if (S_ISLNK(st.st_mode) && (stat(path, &st) < 0 || S_ISDIR(st.st_mode))) return CACHE_OTHER;
+    if (S_ISDIR(st.st_mode)) return CACHE_DIR;
+    if (!S_ISREG(st.st_mode)) return CACHE_OTHER;
+    *mtime = (u64)st.st_mtime;
+    *size  = (u64)st.st_size;
+    return CACHE_FILE;
+}
+
+// Marks the stored output as recently used, so that it is pruned last
+internal void cache_touch(const char *path)
+{
+    utime(path, NULL);
+}
+
+#endif
+
+// Updates the known states of the groups with the current content of a changed path
+internal void cache_update(u32 dir, const char *rel)
+{
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/%s", cache_watched->data[dir], rel);
+    u64 mtime = 0, size = 0;
+    CacheKind  kind = cache_stat(path, &mtime, &size);
+    CacheFile *file = cache_file_slot(cache_path_hash(dir, rel), false);
+    if ((kind == CACHE_DIR) != (file && file->is_dir)) {
+        // @Note: Directories that appear or disappear only report a single change, so the files below them have to be walked again
+        if (file) file->is_dir = false;
+        cache_known = 0;
+        return;
+    }
+    if (kind == CACHE_DIR) return;
+    if (kind == CACHE_MISSING && strchr(rel, '/')) {
+        // @Note: The watcher keeps reporting the old paths of files in renamed directories, which can't be looked up anymore
+        char parent[2048];
+        snprintf(parent, sizeof(parent), "%s", path);
+        *strrchr(parent, '/') = 0;
+        if (cache_stat(parent, &mtime, &size) != CACHE_DIR) {
+            cache_known = 0;
+            return;
+        }
+    }
+    if (file) {
+        for (u32 i = 0; i < cache_rules->len; i++) {
+            if (file->groups & cache_known & (1ull << i)) cache_states[i] -= cache_mix(file);
+        }
+        file->groups = 0;
+    }
+    if (kind != CACHE_FILE) return;
+    for (u32 i = 0; i < cache_rules->len; i++) {
+        Rule *rule = &cache_rules->data[i];
+        if ((cache_known & (1ull << i)) && (rule->dirs & (1ull << dir)) && rule_matches(rule, rel)) cache_add_file(i, dir, path, rel, mtime, size);
+    }
+}
+
+// Returns the hash of the paths and contents of all files, that match the group
+internal u64 cache_group_state(u32 group)
+{
+    changes_mutex_lock(&changes_mutex);
+    AIL_DA(CacheChange) changes = cache_changes;
+    b32 overflow   = cache_overflow;
+    cache_changes  = ail_da_new_t(CacheChange);
+    cache_overflow = false;
+    changes_mutex_unlock(&changes_mutex);
+    if (overflow) cache_known = 0;
+    for (u32 i = 0; i < changes.len; i++) {
+        if (cache_known) cache_update(changes.data[i].dir, changes.data[i].rel);
+        AIL_CALL_FREE(ail_default_allocator, changes.data[i].rel);
+    }
+    ail_da_free(&changes);
+
+    u64 bit = 1ull << group;
+    if (!(cache_known & bit)) {
+        for (u32 i = 0; i < cache_files_cap; i++) cache_files[i].groups &= ~bit;
+        cache_states[group] = 0;
+        for (u32 i = 0; i < cache_watched->len; i++) {
+            if (cache_rules->data[group].dirs & (1ull << i)) cache_walk(group, i, cache_watched->data[i], "");
+        }
+        cache_known |= bit;
+    }
+    return cache_states[group];
+}
+
+
+internal u64 cache_key(u64 state, const char *arg_str)
+{
+    u64 key = history_key(arg_str);
+    key = history_hash(key, (char *)&state, sizeof(state));
+    return key ? key : 1; // 0 means that a job isn't cached
+}
+
+internal void cache_path(char *buf, u32 buf_len, u64 key)
+{
+    snprintf(buf, buf_len, "%s/%016llx.out", cache_dir, (unsigned long long)key);
+}
+
+// Returns whether the job succeeded before with the same key, so that its output would be replayed
+internal b32 cache_has(u64 key)
+{
+    if (!key || !cache_dir[0]) return false;
+    char path[1100];
+    cache_path(path, sizeof(path), key);
+    FILE *f = fopen(path, "rb");
+    if (f) fclose(f);
+    return f != NULL;
+}
+
+// Prints the stored output of the job if it succeeded before with the same key
+internal b32 cache_replay(u64 key, const char *arg_str)
+{
+    if (!cache_dir[0]) return false;
+    char path[1100];
+    cache_path(path, sizeof(path), key);
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    AIL_DA(char) out = ail_da_new_t(char);
+    char buf[4096];
+    u64 n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) ail_da_pushn(&out, buf, n);
+    fclose(f);
+    cache_touch(path);
+    log_info("Skipping '%s', since it succeeded for the same files before:", arg_str);
+    runlog_printf("### '%s' was skipped, since it succeeded for the same files before\n", arg_str);
+    if (out.len) {
+        TermState state = term_current_state;
+        runlog_write(out.data, out.len);
+        subproc_print_output(ail_sv_from_parts(out.data, out.len), arg_str);
+        term_set_state(state);
+    }
+    ail_da_free(&out);
+    return true;
+}
+
+// A stored output, as found while pruning the cache directory
+typedef struct CacheOutput {
+    char name[64];
+    u64  mtime;
+    u64  size;
+} CacheOutput;
+AIL_DA_INIT(CacheOutput);
+
+internal int cache_cmp_outputs(const void *a, const void *b)
+{
+    u64 ma = ((const CacheOutput *)a)->mtime, mb = ((const CacheOutput *)b)->mtime;
+    return (ma < mb) - (ma > mb);
+}
+
+// Counts the stored outputs and, if there are more than `CACHE_MAX_OUTPUTS` of them or more than `CACHE_MAX_SIZE` bytes,
+// deletes the least recently used ones until three quarters of both limits remain, so that many stores fit before the next scan
+// @Note: Replaying an output updates its modification time, so sorting them by it sorts them by their last use
+internal void cache_prune(void)
+{
+    AIL_DA(CacheOutput) outs = ail_da_new_t(CacheOutput);
+#if defined(_WIN32) || defined(__WIN32__)
+    char pattern[1100];
+    snprintf(pattern, sizeof(pattern), "%s\\*.out", cache_dir);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            CacheOutput out = { .mtime = cache_filetime(data.ftLastWriteTime), .size = ((u64)data.nFileSizeHigh << 32) | data.nFileSizeLow };
+            snprintf(out.name, sizeof(out.name), "%s", data.cFileName);
+            ail_da_push(&outs, out);
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+#else
+    DIR *dir = opendir(cache_dir);
+    if (dir) {
+        struct dirent *entry;
+        char path[1100];
+        while ((entry = readdir(dir))) {
+            u64 len = strlen(entry->d_name);
+            if (len < 4 || len >= sizeof(((CacheOutput *)0)->name) || strcmp(entry->d_name + len - 4, ".out")) continue;
+            snprintf(path, sizeof(path), "%s/%.63s", cache_dir, entry->d_name);
+            struct stat st;
+            if (stat(path, &st) < 0) continue;
+            CacheOutput out = { .mtime = (u64)st.st_mtime, .size = (u64)st.st_size };
+            memcpy(out.name, entry->d_name, len + 1);
+            ail_da_push(&outs, out);
+        }
+        closedir(dir);
+    }
+#endif
+    u64 total = 0;
+    for (u32 i = 0; i < outs.len; i++) total += outs.data[i].size;
+    b32 over     = outs.len > CACHE_MAX_OUTPUTS || total > CACHE_MAX_SIZE;
+    u32 max_len  = over ? CACHE_MAX_OUTPUTS/4*3 : outs.len;
+    u64 max_size = over ? CACHE_MAX_SIZE/4*3    : total;
+    if (over) qsort(outs.data, outs.len, sizeof(CacheOutput), cache_cmp_outputs);
+    cache_outputs_known = true;
+    cache_outputs_len   = 0;
+    cache_outputs_size  = 0;
+    total = 0;
+    char path[1100];
+    for (u32 i = 0; i < outs.len; i++) {
+        total += outs.data[i].size;
+        if (i >= max_len || total > max_size) {
+            snprintf(path, sizeof(path), "%s/%s", cache_dir, outs.data[i].name);
+            remove(path);
+        } else {
+            cache_outputs_len++;
+            cache_outputs_size += outs.data[i].size;
+        }
+    }
+    ail_da_free(&outs);
+}
+
+internal void cache_store(u64 key, const char *data, u64 len)
+{
+    if (!cache_dir[0]) return;
+    char path[1100], tmp_path[1200];
+    cache_path(path, sizeof(path), key);
+    u64 old_mtime, old_size;
+    b32 existed = cache_stat(path, &old_mtime, &old_size) == CACHE_FILE;
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, changes_getpid());
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        log_warn("Could not store the output of a command in the cache: %s", strerror(errno));
+        return;
+    }
+    b32 ok = fwrite(data, 1, len, f) == len;
+    ok &= fclose(f) == 0;
+    if (ok) {
+        remove(path); // Windows doesn't allow renaming onto existing files
+        ok = rename(tmp_path, path) == 0;
+    }
+    if (!ok) {
+        remove(tmp_path);
+        cache_outputs_known = false; // The previous output might be gone already, so the outputs are counted again next time
+        return;
+    }
+    if (!cache_outputs_known) {
+        cache_prune();
+        return;
+    }
+    if (existed) {
+        cache_outputs_len--;
+        cache_outputs_size -= old_size;
+    }
+    cache_outputs_len++;
+    cache_outputs_size += len;
+    if (cache_outputs_len > CACHE_MAX_OUTPUTS || cache_outputs_size > CACHE_MAX_SIZE) cache_prune();
+}
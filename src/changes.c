@@ -0,0 +1,510 @@
+#include "header.h"
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <windows.h>
+#   include <process.h>
+    typedef CRITICAL_SECTION ChangesMutex;
+#   define changes_mutex_init(m)   InitializeCriticalSection(m)
+#   define changes_mutex_lock(m)   EnterCriticalSection(m)
+#   define changes_mutex_unlock(m) LeaveCriticalSection(m)
+#   define changes_getpid()        _getpid()
+#else
+#   include <dirent.h>
+#   include <pthread.h>
+#   include <unistd.h>
+#   include <fcntl.h>
+#   if defined(__linux__)
+#       include <sys/eventfd.h>
+#   endif
+    typedef pthread_mutex_t ChangesMutex;
+#   define changes_mutex_init(m)   pthread_mutex_init(m, NULL)
+#   define changes_mutex_lock(m)   pthread_mutex_lock(m)
+#   define changes_mutex_unlock(m) pthread_mutex_unlock(m)
+#   define changes_getpid()        getpid()
+    extern char **environ;
+#endif
+
+#ifndef CHANGES_ENV_MAX
+#   define CHANGES_ENV_MAX (32*1024) // Lists of changed files that are longer than this are only provided via the manifest
+#endif
+
+#ifndef CHANGES_PATH_LEN
+#   define CHANGES_PATH_LEN 4096
+#endif
+
+#define CHANGES_FILES_PLACEHOLDER "{files}"
+
+typedef struct Change {
+    dmon_action action;
+    u64   rules;    // Bitmask of the groups whose patterns matched the change
+    u32   seq;      // Position in the order in which the changes were reported
+    u64   ms;       // Time at which the change was reported
+    char *path;     // Full path of the changed file
+    char *old_path; // Full previous path of a renamed file, NULL otherwise
+} Change;
+AIL_DA_INIT(Change);
+
+// All changes that were collected while waiting for the file system to settle down
+typedef struct Batch {
+    AIL_DA(Change) changes;
+    u64 rules; // Bitmask of all groups that need to run
+} Batch;
+
+global ChangesMutex changes_mutex;
+global Batch        changes_pending;
+global u64          changes_last_ms;   // Time of the last reported change
+global u32          changes_seq;
+global char         changes_tmp_base[1024]; // Private directory for the temporary files, that only the user can access
+global TermHandle   changes_wake_read;  // Signaled whenever new changes are pending
+global TermHandle   changes_wake_write;
+global char        *changes_roots[BUFFER_LEN];         // Resolved watched directories
+global u32          changes_roots_len;
+global char         changes_last_dir[CHANGES_PATH_LEN]; // Last directory that changes_resolve resolved
+global char        *changes_last_res;                   // NULL if it couldn't be resolved
+
+
+// Sets up the pending changes and creates the private temp directory
+internal b32 changes_init(void)
+{
+    changes_mutex_init(&changes_mutex);
+    changes_pending.changes = ail_da_new_t(Change);
+#if defined(_WIN32) || defined(__WIN32__)
+    changes_wake_read = changes_wake_write = CreateEventA(NULL, TRUE, FALSE, NULL);
+    AIL_ASSERT(changes_wake_read);
+    char tmp_dir[MAX_PATH + 1];
+    if (!GetTempPathA(sizeof(tmp_dir), tmp_dir)) strcpy(tmp_dir, ".\\");
+    snprintf(changes_tmp_base, sizeof(changes_tmp_base), "%swatch-exec-%d", tmp_dir, changes_getpid());
+    // @Note: The temp directory is private to the user on Windows already
+    if (!CreateDirectoryA(changes_tmp_base, NULL)) {
+        log_err("Could not create temp directory '%s'", changes_tmp_base);
+        changes_tmp_base[0] = 0;
+        return false;
+    }
+#elif defined(__linux__)
+    changes_wake_read = changes_wake_write = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    AIL_ASSERT(changes_wake_read >= 0);
+#else
+    int wake[2];
+    AIL_ASSERT(!pipe(wake));
+    for (u32 i = 0; i < AIL_ARRLEN(wake); i++) {
+        fcntl(wake[i], F_SETFL, O_NONBLOCK);
+        fcntl(wake[i], F_SETFD, FD_CLOEXEC);
+    }
+    changes_wake_read  = wake[0];
+    changes_wake_write = wake[1];
+#endif
+#if !defined(_WIN32) && !defined(__WIN32__)
+    char *tmp_dir = getenv("TMPDIR");
+    if (!tmp_dir || !tmp_dir[0]) tmp_dir = "/tmp";
+    // @Note: The files inside are created at fixed names, so other users must not be able to place symbolic links there
+    snprintf(changes_tmp_base, sizeof(changes_tmp_base), "%s/watch-exec-XXXXXX", tmp_dir);
+    if (!mkdtemp(changes_tmp_base)) {
+        log_err("Could not create temp directory in '%s': %s", tmp_dir, strerror(errno));
+        changes_tmp_base[0] = 0;
+        return false;
+    }
+#endif
+    return true;
+}
+
+internal void changes_tmp_path(char *buf, u32 buf_len, u32 rule, const char *ext)
+{
+    snprintf(buf, buf_len, "%s/%u.%s", changes_tmp_base, rule, ext);
+}
+
+// Creates the file in the temp directory, replacing the one that a previous run created
+internal FILE *changes_create_tmp(const char *path)
+{
+    remove(path);
+#if defined(_WIN32) || defined(__WIN32__)
+    return fopen(path, "wb");
+#else
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    return fd < 0 ? NULL : fdopen(fd, "wb");
+#endif
+}
+
+// Removes the temp directory with everything that was created inside of it
+internal void changes_deinit(void)
+{
+    if (!changes_tmp_base[0]) return;
+    char path[1100];
+#if defined(_WIN32) || defined(__WIN32__)
+    snprintf(path, sizeof(path), "%s\\*", changes_tmp_base);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(path, &data);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+            snprintf(path, sizeof(path), "%s\\%s", changes_tmp_base, data.cFileName);
+            DeleteFileA(path);
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+    RemoveDirectoryA(changes_tmp_base);
+#else
+    DIR *dir = opendir(changes_tmp_base);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+            snprintf(path, sizeof(path), "%s/%.63s", changes_tmp_base, entry->d_name);
+            unlink(path);
+        }
+        closedir(dir);
+    }
+    rmdir(changes_tmp_base);
+#endif
+    changes_tmp_base[0] = 0;
+}
+
+// Returns the absolute path with all symbolic links resolved, which needs to be freed, or NULL if the path doesn't exist
+internal char *changes_realpath(const char *path)
+{
+#if defined(_WIN32) || defined(__WIN32__)
+    // @Note: Symbolic links aren't resolved on Windows
+    char *res = _fullpath(NULL, path, 0);
+    if (!res || GetFileAttributesA(res) == INVALID_FILE_ATTRIBUTES) {
+        free(res);
+        return NULL;
+    }
+    for (char *c = res; *c; c++) {
+        if (*c == '\\') *c = '/';
+    }
+    return res;
+#else
+    return realpath(path, NULL);
+#endif
+}
+
+internal void changes_resolve_init(StrList *watched)
+{
+    for (u32 i = 0; i < watched->len; i++) {
+        char *root = changes_realpath(watched->data[i]);
+        if (root) changes_roots[changes_roots_len++] = root;
+    }
+}
+
+// Forgets the remembered directory, which needs to happen whenever directories might have been moved in the meantime
+internal void changes_resolve_reset(void)
+{
+    changes_last_dir[0] = 0;
+}
+
+// Resolves the directories of a path, which may be relative to the working directory, but not the path itself,
+// since the watcher reports changes of symbolic links and not of their targets
+// This allows comparing the paths reported by the watcher, that are relative to the watched directories as given,
+// with paths from other sources. Returns false if the path isn't inside of any watched directory or couldn't be resolved
+internal b32 changes_resolve(const char *path, char *buf, u32 buf_len)
+{
+    char dir[CHANGES_PATH_LEN];
+    const char *slash = strrchr(path, '/');
+    const char *base  = slash ? slash + 1 : path;
+    u64         d_len = slash ? (u64)(slash - path) : 0;
+    if (d_len >= sizeof(dir)) return false;
+    if (!base[0] || !strcmp(base, ".") || !strcmp(base, "..")) {
+        char *res = changes_realpath(path);
+        if (!res) return false;
+        snprintf(buf, buf_len, "%s", res);
+        free(res);
+    } else {
+        memcpy(dir, path, d_len);
+        dir[d_len] = 0;
+        if (!d_len) strcpy(dir, slash ? "/" : ".");
+        // @Note: Consecutive paths are mostly in the same directory, so the last directory is remembered
+        if (strcmp(dir, changes_last_dir)) {
+            strcpy(changes_last_dir, dir);
+            free(changes_last_res);
+            changes_last_res = changes_realpath(dir);
+        }
+        if (!changes_last_res) return false;
+        u64 len = strlen(changes_last_res);
+        snprintf(buf, buf_len, "%s%s%s", changes_last_res, changes_last_res[len - 1] == '/' ? "" : "/", base);
+    }
+    for (u32 i = 0; i < changes_roots_len; i++) {
+        u64 len = strlen(changes_roots[i]);
+        if (!strncmp(buf, changes_roots[i], len) && (!buf[len] || buf[len] == '/' || changes_roots[i][len - 1] == '/')) return true;
+    }
+    return false;
+}
+
+internal const char *changes_action_str(dmon_action action)
+{
+    switch (action) {
+        case DMON_ACTION_CREATE: return "create";
+        case DMON_ACTION_DELETE: return "delete";
+        case DMON_ACTION_MODIFY: return "modify";
+        case DMON_ACTION_MOVE:   return "rename";
+    }
+    AIL_UNREACHABLE();
+    return "";
+}
+
+internal char *changes_concat_path(const char *root_dir, const char *filepath)
+{
+    u64 root_len = strlen(root_dir), file_len = strlen(filepath);
+    char *res = AIL_CALL_ALLOC(ail_default_allocator, root_len + file_len + 1);
+    memcpy(res, root_dir, root_len);
+    memcpy(res + root_len, filepath, file_len + 1);
+    return res;
+}
+
+// Checks whether the path of a file relative to its watched directory matches the patterns of the group
+internal b32 rule_matches(Rule *rule, const char *filepath)
+{
+    AIL_SV fpath_sv = ail_sv_from_cstr((char*)filepath);
+    if (!rule->regexs.len) return true;
+    for (u32 i = 0; i < rule->regexs.len; i++) {
+        if (ail_pm_matches_sv(rule->regexs.data[i], fpath_sv)) return true;
+    }
+    return false;
+}
+
+internal void changes_free(Change *change)
+{
+    AIL_CALL_FREE(ail_default_allocator, change->path);
+    if (change->old_path) AIL_CALL_FREE(ail_default_allocator, change->old_path);
+}
+
+internal void batch_free(Batch *batch)
+{
+    for (u32 i = 0; i < batch->changes.len; i++) changes_free(&batch->changes.data[i]);
+    ail_da_free(&batch->changes);
+    batch->rules = 0;
+}
+
+// Called from the watcher thread for every change that matched at least one group
+internal void changes_push(dmon_action action, const char *root_dir, const char *filepath, const char *oldfilepath, u64 rules)
+{
+    Change change = {
+        .action   = action,
+        .rules    = rules,
+        .path     = changes_concat_path(root_dir, filepath),
+        .old_path = oldfilepath ? changes_concat_path(root_dir, oldfilepath) : NULL,
+    };
+    changes_mutex_lock(&changes_mutex);
+    change.seq = changes_seq++;
+    change.ms  = timer_now_ms();
+    ail_da_push(&changes_pending.changes, change);
+    changes_pending.rules |= rules;
+    changes_last_ms = change.ms;
+#if defined(_WIN32) || defined(__WIN32__)
+    SetEvent(changes_wake_write);
+#elif defined(__linux__)
+    u64 one = 1;
+    if (write(changes_wake_write, &one, sizeof(one)) < 0) {} // An overflowing counter is already signaled
+#else
+    char c = 0;
+    if (write(changes_wake_write, &c, 1) < 0) {} // A full pipe is already signaled
+#endif
+    changes_mutex_unlock(&changes_mutex);
+}
+
+// Returns the time in milliseconds until the pending changes have settled down or -1 if no changes are pending
+internal i32 changes_wait_time(u32 debounce_ms)
+{
+    i32 res = -1;
+    changes_mutex_lock(&changes_mutex);
+#if defined(_WIN32) || defined(__WIN32__)
+    ResetEvent(changes_wake_read);
+#else
+    char buf[64];
+    while (read(changes_wake_read, buf, sizeof(buf)) > 0) {}
+#endif
+    if (changes_pending.rules) {
+        u64 elapsed = timer_now_ms() - changes_last_ms;
+        res = elapsed >= debounce_ms ? 0 : (i32)(debounce_ms - elapsed);
+    }
+    changes_mutex_unlock(&changes_mutex);
+    return res;
+}
+
+internal int changes_cmp(const void *a, const void *b)
+{
+    const Change *x = a, *y = b;
+    int res = strcmp(x->path, y->path);
+    if (!res) res = x->seq < y->seq ? -1 : x->seq > y->seq;
+    return res;
+}
+
+// Merges all changes to the same file into a single change, which describes the difference to the state before the batch
+internal void changes_merge(Batch *batch)
+{
+    AIL_DA(Change) *changes = &batch->changes;
+    qsort(changes->data, changes->len, sizeof(Change), changes_cmp);
+    u32 n = 0;
+    batch->rules = 0;
+    for (u32 i = 0; i < changes->len; ) {
+        u32 j = i + 1;
+        while (j < changes->len && !strcmp(changes->data[i].path, changes->data[j].path)) j++;
+        Change first = changes->data[i];
+        Change last  = changes->data[j - 1];
+        Change res   = last;
+        for (u32 k = i; k < j - 1; k++) res.rules |= changes->data[k].rules;
+        b32 drop = false;
+        if (first.action == DMON_ACTION_CREATE) {
+            if (last.action == DMON_ACTION_DELETE) drop = true;
+            else res.action = DMON_ACTION_CREATE;
+        } else if (first.action == DMON_ACTION_DELETE && last.action == DMON_ACTION_CREATE) {
+            res.action = DMON_ACTION_MODIFY;
+        } else if (first.action == DMON_ACTION_MOVE && last.action == DMON_ACTION_MODIFY) {
+            res.action = DMON_ACTION_MOVE;
+        }
+        // Keep the strings of the merged change and free all others
+        if (res.action == DMON_ACTION_MOVE && !res.old_path) {
+            res.old_path = first.old_path;
+            changes->data[i].old_path = NULL;
+        } else if (res.action != DMON_ACTION_MOVE && res.old_path) {
+            AIL_CALL_FREE(ail_default_allocator, res.old_path);
+            res.old_path = NULL;
+        }
+        changes->data[j - 1].path     = NULL;
+        changes->data[j - 1].old_path = NULL;
+        for (u32 k = i; k < j - 1; k++) {
+            AIL_CALL_FREE(ail_default_allocator, changes->data[k].path);
+            if (changes->data[k].old_path) AIL_CALL_FREE(ail_default_allocator, changes->data[k].old_path);
+        }
+        if (drop) changes_free(&res);
+        else {
+            changes->data[n++] = res;
+            batch->rules |= res.rules;
+        }
+        i = j;
+    }
+    changes->len = n;
+}
+
+// Takes all pending changes once no new changes were reported for `debounce_ms` milliseconds
+internal b32 changes_take(Batch *batch, u32 debounce_ms)
+{
+    if (changes_wait_time(debounce_ms) != 0) return false;
+    changes_mutex_lock(&changes_mutex);
+    *batch = changes_pending;
+    changes_pending.changes = ail_da_new_t(Change);
+    changes_pending.rules   = 0;
+    changes_mutex_unlock(&changes_mutex);
+    changes_merge(batch);
+    return batch->rules != 0;
+}
+
+// Moves the changes of `from` into `into`, which was taken earlier
+// Groups that are contained in a batch without any changes (i.e. when rerunning manually) are kept as well
+internal void changes_combine(Batch *into, Batch *from)
+{
+    u64 manual = (into->changes.len ? 0 : into->rules) | (from->changes.len ? 0 : from->rules);
+    ail_da_pushn(&into->changes, from->changes.data, from->changes.len);
+    ail_da_free(&from->changes);
+    from->rules = 0;
+    changes_merge(into);
+    into->rules |= manual;
+}
+
+// Returns the paths of all changed files of the group that still exist
+internal AIL_DA(str) changes_files(Batch *batch, u32 rule)
+{
+    AIL_DA(str) files = ail_da_new_t(str);
+    for (u32 i = 0; i < batch->changes.len; i++) {
+        Change *change = &batch->changes.data[i];
+        if ((change->rules & (1ull << rule)) && change->action != DMON_ACTION_DELETE) ail_da_push(&files, change->path);
+    }
+    return files;
+}
+
+// Writes the manifest and the list of changed files of the group into the temp directory
+// and provides them to the group's commands via environment variables
+internal void changes_export(Batch *batch, u32 rule, AIL_DA(str) *files)
+{
+    char path[1100];
+    changes_tmp_path(path, sizeof(path), rule, "manifest");
+    FILE *f = changes_create_tmp(path);
+    if (!f) log_err("Could not write manifest of changed files to '%s': %s", path, strerror(errno));
+    else {
+        for (u32 i = 0; i < batch->changes.len; i++) {
+            Change *change = &batch->changes.data[i];
+            if (!(change->rules & (1ull << rule))) continue;
+            if (change->old_path) fprintf(f, "%s\t%s\t%s\n", changes_action_str(change->action), change->path, change->old_path);
+            else                  fprintf(f, "%s\t%s\n",     changes_action_str(change->action), change->path);
+        }
+        fclose(f);
+        subproc_set_env("WATCH_EXEC_MANIFEST", path);
+    }
+
+    u64 len = 0;
+    changes_tmp_path(path, sizeof(path), rule, "files");
+    f = changes_create_tmp(path);
+    if (!f) log_err("Could not write list of changed files to '%s': %s", path, strerror(errno));
+    for (u32 i = 0; i < files->len; i++) {
+        if (f) fprintf(f, "%s\n", files->data[i]);
+        len += strlen(files->data[i]) + 1;
+    }
+    if (f) fclose(f);
+
+    if (len > CHANGES_ENV_MAX) {
+        log_warn("Too many changed files to provide them in WATCH_EXEC_CHANGED, use WATCH_EXEC_MANIFEST instead");
+        subproc_set_env("WATCH_EXEC_CHANGED", NULL);
+    } else {
+        AIL_DA(char) env = ail_da_new_with_alloc(char, len + 1, ail_default_allocator);
+        for (u32 i = 0; i < files->len; i++) {
+            if (i) ail_da_push(&env, '\n');
+            ail_da_pushn(&env, files->data[i], strlen(files->data[i]));
+        }
+        ail_da_push(&env, 0);
+        subproc_set_env("WATCH_EXEC_CHANGED", env.data);
+        ail_da_free(&env);
+    }
+}
+
+internal u32 changes_placeholder_count(AIL_DA(str) *argv)
+{
+    u32 n = 0;
+    for (u32 i = 0; i < argv->len; i++) n += !strcmp(argv->data[i], CHANGES_FILES_PLACEHOLDER);
+    return n;
+}
+
+// Maximum amount of bytes that the arguments of a command may occupy
+internal u64 changes_arg_max(void)
+{
+#if defined(_WIN32) || defined(__WIN32__)
+    return 32767; // Maximum length of a command line for CreateProcess
+#else
+    i64 max = sysconf(_SC_ARG_MAX);
+    if (max <= 0) max = 128*1024;
+    // The environment shares the same limit
+    for (char **env = environ; *env; env++) max -= strlen(*env) + 1 + sizeof(char *);
+    max -= 4096; // Leave some headroom for the environment variables set by us and the loader
+    return max > 4096 ? (u64)max : 4096;
+#endif
+}
+
+// Builds the next invocation of a command, in which each placeholder is replaced by as many changed files (starting at `*next`)
+// as fit into the system's size limit for arguments, but at most `max_files` (unless it is 0)
+// If the command doesn't contain a placeholder, the files are appended to it instead
+// `env_len` is the size of the environment variables, that are only set for this command
+internal AIL_DA(str) changes_expand_argv(AIL_DA(str) *argv, AIL_DA(str) *files, u32 *next, u32 max_files, u64 env_len)
+{
+    u32 placeholders = changes_placeholder_count(argv);
+    u64 budget = changes_arg_max();
+    budget = budget > env_len + 4096 ? budget - env_len : 4096;
+    u64 used   = 0;
+    for (u32 i = 0; i < argv->len; i++) used += strlen(argv->data[i]) + 1 + sizeof(char *);
+
+    u32 end = *next;
+    for (; end < files->len && (!max_files || end - *next < max_files); end++) {
+        u64 size = AIL_MAX(placeholders, 1)*(strlen(files->data[end]) + 1 + sizeof(char *));
+        if (end > *next && used + size > budget) break;
+        used += size;
+    }
+
+    AIL_DA(str) res = ail_da_new_t(str);
+    for (u32 i = 0; i < argv->len; i++) {
+        if (strcmp(argv->data[i], CHANGES_FILES_PLACEHOLDER)) ail_da_push(&res, argv->data[i]);
+        else {
+            for (u32 j = *next; j < end; j++) ail_da_push(&res, files->data[j]);
+        }
+    }
+    if (!placeholders) {
+        for (u32 j = *next; j < end; j++) ail_da_push(&res, files->data[j]);
+    }
+    *next = end;
+    return res;
+}
@@ -0,0 +1,120 @@
+#include "header.h"
+
+// When running headless, watch-exec can be controlled by writing commands into a fifo, one per line:
+//   - "run" or "r":    Rerun all commands
+//   - "cancel" or "c": Cancel the running commands
+//   - "quit" or "q":   Cancel the running commands and quit
+
+#if defined(_WIN32) || defined(__WIN32__)
+#else
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#ifndef CONTROL_LINE_LEN
+#   define CONTROL_LINE_LEN 256
+#endif
+
+typedef enum ControlCmd {
+    CONTROL_NONE,
+    CONTROL_RUN,
+    CONTROL_CANCEL,
+    CONTROL_QUIT,
+} ControlCmd;
+
+global TermHandle control_handle;
+global char       control_line[CONTROL_LINE_LEN];
+global u32        control_line_len;
+
+internal ControlCmd control_parse(AIL_SV line)
+{
+    line = ail_sv_trim(line);
+    if (!line.len) return CONTROL_NONE;
+    if (ail_sv_eq(line, SV_LIT_T("run"))    || ail_sv_eq(line, SV_LIT_T("r"))) return CONTROL_RUN;
+    if (ail_sv_eq(line, SV_LIT_T("cancel")) || ail_sv_eq(line, SV_LIT_T("c"))) return CONTROL_CANCEL;
+    if (ail_sv_eq(line, SV_LIT_T("quit"))   || ail_sv_eq(line, SV_LIT_T("q"))) return CONTROL_QUIT;
+    log_warn("Unknown control command '%.*s'", (int)line.len, line.str);
+    return CONTROL_NONE;
+}
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+// @TODO: Could be implemented with a named pipe
+internal b32 control_init(const char *path)
+{
+    AIL_UNUSED(path);
+    log_err("Controlling watch-exec via a fifo is not supported on Windows yet");
+    return false;
+}
+
+internal u32 control_read(ControlCmd *cmds, u32 max_cmds)
+{
+    AIL_UNUSED(cmds);
+    AIL_UNUSED(max_cmds);
+    return 0;
+}
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+global int control_keep_open = -1;
+
+// Creates the fifo if it doesn't exist yet and opens it for reading
+internal b32 control_init(const char *path)
+{
+    if (mkfifo(path, 0600) < 0 && errno != EEXIST) {
+        log_err("Could not create control fifo '%s': %s", path, strerror(errno));
+        return false;
+    }
+    control_handle = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (control_handle < 0) {
+        log_err("Could not open control fifo '%s': %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(control_handle, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+        log_err("Could not use '%s' for control commands, since it already exists and isn't a fifo", path);
+        close(control_handle);
+        return false;
+    }
+    // @Note: Keeping a writer open ourselves prevents the fifo from being reported as closed after every client that wrote to it
+    control_keep_open = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    return true;
+}
+
+// Reads up to `max_cmds` of the commands that were written into the fifo so far
+// Returns `max_cmds` if there might be more, which are kept for the next call, just like incomplete lines
+internal u32 control_read(ControlCmd *cmds, u32 max_cmds)
+{
+    u32 n = 0;
+    for (;;) {
+        u32 start = 0;
+        for (u32 i = 0; i < control_line_len && n < max_cmds; i++) {
+            if (control_line[i] != '\n') continue;
+            ControlCmd cmd = control_parse(ail_sv_from_parts(control_line + start, i - start));
+            if (cmd != CONTROL_NONE) cmds[n++] = cmd;
+            start = i + 1;
+        }
+        memmove(control_line, control_line + start, control_line_len - start);
+        control_line_len -= start;
+        if (n == max_cmds) break;
+        if (control_line_len == CONTROL_LINE_LEN) {
+            log_warn("Ignoring control command, that is longer than %d characters", CONTROL_LINE_LEN);
+            control_line_len = 0;
+        }
+        ssize_t got = read(control_handle, control_line + control_line_len, CONTROL_LINE_LEN - control_line_len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        control_line_len += (u32)got;
+    }
+    return n;
+}
+
+#endif
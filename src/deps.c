@@ -0,0 +1,570 @@
+#include "header.h"
+
+// Commands given with --deps only run if one of the changed files is a dependency of them according to the depfiles
+// (as written by `gcc -MD`) or compile_commands.json files that were given for them
+// All sources are read into a reverse index from the resolved path of every dependency to the commands and targets
+// depending on it. Before each run, the depfiles are checked for changes and only the changed ones are read again
+// The targets, whose dependencies changed, are provided to the command in WATCH_EXEC_TARGETS, separated by newlines
+//
+// A source given with --deps may be:
+//   - a depfile, whose relative paths are relative to the working directory
+//   - a directory, which is searched for depfiles (files ending with '.d') recursively
+//   - a compile_commands.json file, whose entries make each source file a dependency of the entry's output
+//     Additionally, the depfile next to each output ('<output>.d' or the output with its extension replaced by '.d')
+//     is read, with relative paths being relative to the entry's directory
+// @Note: Commands without any dependencies (i.e. before the first build) always run, just like for created or renamed files,
+// which aren't a dependency of any target yet
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <windows.h>
+#else
+#   include <dirent.h>
+#   include <sys/stat.h>
+#endif
+
+// A dependency of a target, read from a depfile or compile_commands.json
+typedef struct DepsEdge {
+    u64 path_hash;
+    u32 target;    // Index into the targets of the file
+} DepsEdge;
+AIL_DA_INIT(DepsEdge);
+
+// Depfile of an entry of compile_commands.json, that is named after the entry's output
+typedef struct DepsEntry {
+    char *depfiles[2]; // '<output>.d' and the output with its extension replaced by '.d'
+    char *dir;
+    char *target;
+} DepsEntry;
+AIL_DA_INIT(DepsEntry);
+
+typedef struct DepsFile {
+    char *path;
+    char *dir;    // Directory that relative paths inside of the file are relative to (NULL for the working directory)
+    char *target; // Target of all dependencies in the depfile of a compile_commands.json entry, NULL otherwise
+    u32   source; // Index into deps_sources
+    b32   json;   // compile_commands.json instead of a depfile
+    b32   seen;   // Whether the file still exists and still belongs to its source
+    u64   mtime;
+    u64   size;
+    AIL_DA(DepsEdge)  edges;
+    AIL_DA(str)       targets;
+    AIL_DA(DepsEntry) entries; // Only for compile_commands.json
+} DepsFile;
+AIL_DA_INIT(DepsFile);
+
+typedef struct DepsSource {
+    Cmd  *cmd;
+    char *path;
+} DepsSource;
+AIL_DA_INIT(DepsSource);
+
+// Entry of an open addressing hash map from the hash of a path to an index
+typedef struct DepsSlot {
+    u64 hash; // 0 for empty slots
+    u32 idx;
+} DepsSlot;
+
+typedef struct DepsMap {
+    DepsSlot *slots;
+    u32       cap;
+    u32       len;
+} DepsMap;
+
+// Element of the linked list of all edges leading to the same path in the reverse index
+typedef struct DepsLink {
+    u32 file;
+    u32 edge;
+    u32 next; // DEPS_NONE at the end of the list
+} DepsLink;
+AIL_DA_INIT(DepsLink);
+
+global AIL_DA(DepsSource) deps_sources;
+global AIL_DA(DepsFile)   deps_files;
+global DepsMap            deps_files_map; // Index of the file by the hash of its path and source
+global DepsMap            deps_index;     // Index of the first link by the hash of a dependency's path
+global AIL_DA(DepsLink)   deps_links;
+global b32                deps_dirty;     // Whether the reverse index needs to be built again
+
+#define DEPS_SEED 0xcbf29ce484222325ull
+#define DEPS_NONE UINT32_MAX
+
+internal char *deps_strdup(const char *s, u64 len)
+{
+    char *res = AIL_CALL_ALLOC(ail_default_allocator, len + 1);
+    memcpy(res, s, len);
+    res[len] = 0;
+    return res;
+}
+
+// Registers the sources of all commands given with --deps
+// @Note: The sources refer to their commands, so this may only be called once the groups won't be moved anymore
+internal void deps_init(RuleList *rules)
+{
+    deps_sources = ail_da_new_t(DepsSource);
+    for (u32 i = 0; i < rules->len; i++) {
+        for (u32 j = 0; j < rules->data[i].cmds.len; j++) {
+            Cmd *cmd = &rules->data[i].cmds.data[j];
+            for (u32 k = 0; k < cmd->deps_paths.len; k++) ail_da_push(&deps_sources, ((DepsSource){ .cmd = cmd, .path = cmd->deps_paths.data[k] }));
+        }
+    }
+}
+
+internal DepsSlot *deps_map_slot(DepsMap *map, u64 hash, b32 insert)
+{
+    if (!hash) hash = 1;
+    if (insert && 2*(map->len + 1) > map->cap) {
+        DepsMap old = *map;
+        map->cap   = old.cap ? 2*old.cap : 1024;
+        map->len   = 0;
+        map->slots = AIL_CALL_ALLOC(ail_default_allocator, sizeof(DepsSlot)*map->cap);
+        memset(map->slots, 0, sizeof(DepsSlot)*map->cap);
+        for (u32 i = 0; i < old.cap; i++) {
+            if (old.slots[i].hash) *deps_map_slot(map, old.slots[i].hash, true) = old.slots[i];
+        }
+        if (old.slots) AIL_CALL_FREE(ail_default_allocator, old.slots);
+    }
+    if (!map->cap) return NULL;
+    u32 mask = map->cap - 1;
+    for (u32 i = (u32)hash & mask;; i = (i + 1) & mask) {
+        if (map->slots[i].hash == hash) return &map->slots[i];
+        if (!map->slots[i].hash) {
+            if (!insert) return NULL;
+            map->slots[i].hash = hash;
+            map->slots[i].idx  = DEPS_NONE;
+            map->len++;
+            return &map->slots[i];
+        }
+    }
+}
+
+internal void deps_map_clear(DepsMap *map)
+{
+    if (map->slots) memset(map->slots, 0, sizeof(DepsSlot)*map->cap);
+    map->len = 0;
+}
+
+// Hash of the resolved path or 0 if it isn't inside of any watched directory
+internal u64 deps_path_hash(const char *dir, const char *path, u64 len)
+{
+    char joined[CHANGES_PATH_LEN], resolved[CHANGES_PATH_LEN];
+    b32 absolute = len && (path[0] == '/' || (len > 2 && path[1] == ':'));
+    if (absolute || !dir) snprintf(joined, sizeof(joined), "%.*s", (int)len, path);
+    else                  snprintf(joined, sizeof(joined), "%s/%.*s", dir, (int)len, path);
+    if (!changes_resolve(joined, resolved, sizeof(resolved))) return 0;
+    u64 hash = history_hash(DEPS_SEED, resolved, strlen(resolved));
+    return hash ? hash : 1;
+}
+
+internal void deps_add_edge(DepsFile *file, const char *path, u64 len)
+{
+    u64 hash = deps_path_hash(file->dir, path, len);
+    if (hash) ail_da_push(&file->edges, ((DepsEdge){ .path_hash = hash, .target = file->targets.len - 1 }));
+}
+
+internal void deps_add_target(DepsFile *file, const char *target, u64 len)
+{
+    ail_da_push(&file->targets, deps_strdup(target, len));
+}
+
+internal void deps_clear_file(DepsFile *file)
+{
+    for (u32 i = 0; i < file->targets.len; i++) AIL_CALL_FREE(ail_default_allocator, file->targets.data[i]);
+    for (u32 i = 0; i < file->entries.len; i++) {
+        DepsEntry *entry = &file->entries.data[i];
+        AIL_CALL_FREE(ail_default_allocator, entry->depfiles[0]);
+        AIL_CALL_FREE(ail_default_allocator, entry->depfiles[1]);
+        AIL_CALL_FREE(ail_default_allocator, entry->dir);
+        AIL_CALL_FREE(ail_default_allocator, entry->target);
+    }
+    file->targets.len = 0;
+    file->edges.len   = 0;
+    file->entries.len = 0;
+}
+
+// Reads the next path of a make rule into `buf`, removing the escaping of spaces, '#' and '$'
+// Returns the amount of characters consumed or 0 at the end of the line
+internal u64 deps_next_word(const char *s, u64 len, char *buf, u64 buf_len, u64 *word_len, b32 *is_target)
+{
+    u64 i = 0, n = 0;
+    while (i < len && (s[i] == ' ' || s[i] == '\t' || (s[i] == '\\' && i + 1 < len && (s[i + 1] == '\n' || s[i + 1] == '\r')))) {
+        i += s[i] == '\\' ? 2 : 1;
+        if (i < len && s[i - 1] == '\r' && s[i] == '\n') i++;
+    }
+    if (i >= len || s[i] == '\n' || s[i] == '\r') return 0;
+    *is_target = false;
+    for (; i < len && s[i] != ' ' && s[i] != '\t' && s[i] != '\n' && s[i] != '\r'; i++) {
+        char c = s[i];
+        if (c == '\\' && i + 1 < len && (s[i + 1] == ' ' || s[i + 1] == '#')) c = s[++i];
+        else if (c == '\\' && i + 1 < len && (s[i + 1] == '\n' || s[i + 1] == '\r')) break;
+        else if (c == '$' && i + 1 < len && s[i + 1] == '$') i++;
+        // @Note: A colon followed by a backslash or slash belongs to a drive letter on Windows (i.e. 'C:\src\a.h')
+        else if (c == ':' && (i + 1 >= len || s[i + 1] == ' ' || s[i + 1] == '\t' || s[i + 1] == '\n' || s[i + 1] == '\r')) {
+            *is_target = true;
+            i++;
+            break;
+        }
+        if (n + 1 < buf_len) buf[n++] = c;
+    }
+    *word_len = n;
+    return i;
+}
+
+// Reads a depfile, in which each rule lists the dependencies of its targets: '<target>...: <dependency>...'
+// Lines can be continued with a backslash
+internal void deps_read_depfile(DepsFile *file, const char *data, u64 len)
+{
+    char word[CHANGES_PATH_LEN];
+    b32  has_target = false;
+    for (u64 i = 0; i < len; ) {
+        if (data[i] == '\n' || data[i] == '\r') {
+            has_target = false;
+            i++;
+            continue;
+        }
+        if (data[i] == '#') {
+            while (i < len && data[i] != '\n') i++;
+            continue;
+        }
+        u64 word_len = 0;
+        b32 is_target;
+        u64 n = deps_next_word(data + i, len - i, word, sizeof(word), &word_len, &is_target);
+        if (!n) {
+            while (i < len && data[i] != '\n' && data[i] != '\r') i++;
+            continue;
+        }
+        i += n;
+        if (is_target) {
+            // @Note: Only the first of several targets of a rule is remembered
+            if (!has_target && word_len && !file->target) deps_add_target(file, word, word_len);
+            has_target = true;
+        } else if (has_target && word_len && file->targets.len) {
+            deps_add_edge(file, word, word_len);
+        }
+    }
+}
+
+// Reads the JSON string starting at the quote at `*i` into `buf`
+internal b32 deps_json_string(const char *data, u64 len, u64 *i, char *buf, u64 buf_len)
+{
+    u64 n = 0;
+    for ((*i)++; *i < len && data[*i] != '"'; (*i)++) {
+        char c = data[*i];
+        if (c == '\\' && *i + 1 < len) {
+            c = data[++(*i)];
+            if      (c == 'n') c = '\n';
+            else if (c == 't') c = '\t';
+            else if (c == 'u') { *i += 4; c = '?'; } // Paths with escaped unicode characters won't resolve anyways
+        }
+        if (n + 1 < buf_len) buf[n++] = c;
+    }
+    buf[n] = 0;
+    if (*i >= len) return false;
+    (*i)++;
+    return true;
+}
+
+internal void deps_add_json_entry(DepsFile *file, const char *dir, const char *src, const char *out)
+{
+    char *file_dir = file->dir;
+    file->dir = (char *)dir;
+    const char *target = out[0] ? out : src;
+    deps_add_target(file, target, strlen(target));
+    deps_add_edge(file, src, strlen(src));
+    file->dir = file_dir;
+    if (!out[0]) return;
+    char path[CHANGES_PATH_LEN];
+    const char *ext = strrchr(out, '.');
+    b32 absolute = out[0] == '/' || (out[0] && out[1] == ':');
+    DepsEntry entry = { .dir = deps_strdup(dir, strlen(dir)), .target = deps_strdup(out, strlen(out)) };
+    for (u32 variant = 0; variant < 2; variant++) {
+        u64 out_len = (variant && ext && !strchr(ext, '/')) ? (u64)(ext - out) : strlen(out);
+        if (absolute) snprintf(path, sizeof(path), "%.*s.d", (int)out_len, out);
+        else          snprintf(path, sizeof(path), "%s/%.*s.d", dir, (int)out_len, out);
+        entry.depfiles[variant] = deps_strdup(path, strlen(path));
+    }
+    ail_da_push(&file->entries, entry);
+}
+
+// Reads the directory, file and output of every entry of a compilation database
+// @Note: This isn't a complete JSON parser, it only relies on the entries being objects inside of an array
+internal void deps_read_json(DepsFile *file, const char *data, u64 len)
+{
+    char key[64], val[CHANGES_PATH_LEN];
+    char dir[CHANGES_PATH_LEN] = {0}, src[CHANGES_PATH_LEN] = {0}, out[CHANGES_PATH_LEN] = {0};
+    u32 depth = 0;
+    for (u64 i = 0; i < len; ) {
+        char c = data[i];
+        if (c == '{' || c == '[') {
+            depth++;
+            if (depth == 2) dir[0] = src[0] = out[0] = 0;
+            i++;
+        } else if (c == '}' || c == ']') {
+            if (depth == 2 && src[0]) deps_add_json_entry(file, dir[0] ? dir : file->dir, src, out);
+            if (depth) depth--;
+            i++;
+        } else if (c == '"') {
+            if (!deps_json_string(data, len, &i, key, sizeof(key))) break;
+            while (i < len && (data[i] == ' ' || data[i] == '\t' || data[i] == '\n' || data[i] == '\r')) i++;
+            if (i >= len || data[i] != ':' || depth != 2) continue;
+            i++;
+            while (i < len && (data[i] == ' ' || data[i] == '\t' || data[i] == '\n' || data[i] == '\r')) i++;
+            if (i >= len || data[i] != '"') continue;
+            if (!deps_json_string(data, len, &i, val, sizeof(val))) break;
+            if      (!strcmp(key, "directory")) snprintf(dir, sizeof(dir), "%s", val);
+            else if (!strcmp(key, "file"))      snprintf(src, sizeof(src), "%s", val);
+            else if (!strcmp(key, "output"))    snprintf(out, sizeof(out), "%s", val);
+        } else i++;
+    }
+}
+
+// Reads the file again if it changed since it was read last
+// Returns the index of the file
+internal u32 deps_update_file(u32 source, const char *path, const char *dir, const char *target, b32 json, u64 mtime, u64 size)
+{
+    u64 hash = history_hash(history_hash(DEPS_SEED, (char *)&source, sizeof(source)), path, strlen(path));
+    DepsSlot *slot = deps_map_slot(&deps_files_map, hash, true);
+    if (slot->idx == DEPS_NONE) {
+        slot->idx = deps_files.len;
+        DepsFile new_file = {
+            .path    = deps_strdup(path, strlen(path)),
+            .dir     = dir ? deps_strdup(dir, strlen(dir)) : NULL,
+            .source  = source,
+            .json    = json,
+            .edges   = ail_da_new_t(DepsEdge),
+            .targets = ail_da_new_t(str),
+            .entries = ail_da_new_t(DepsEntry),
+        };
+        if (json) {
+            // Entries without a directory are relative to the directory of compile_commands.json
+            const char *slash = strrchr(path, '/');
+            new_file.dir = slash ? deps_strdup(path, slash - path) : deps_strdup(".", 1);
+        }
+        ail_da_push(&deps_files, new_file);
+    }
+    u32 idx = slot->idx;
+    DepsFile *file = &deps_files.data[idx];
+    file->seen = true;
+    if (target && (!file->target || strcmp(file->target, target))) {
+        if (file->target) AIL_CALL_FREE(ail_default_allocator, file->target);
+        file->target = deps_strdup(target, strlen(target));
+        file->mtime  = 0;
+    }
+    if (file->mtime == mtime && file->size == size) return idx;
+    FILE *f = fopen(path, "rb");
+    if (!f) return idx;
+    AIL_DA(char) data = ail_da_new_t(char);
+    char buf[4096];
+    u64 n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) ail_da_pushn(&data, buf, n);
+    fclose(f);
+    deps_clear_file(file);
+    if (file->target) deps_add_target(file, file->target, strlen(file->target));
+    if (json) deps_read_json(file, data.data, data.len);
+    else      deps_read_depfile(file, data.data, data.len);
+    ail_da_free(&data);
+    file->mtime = mtime;
+    file->size  = size;
+    deps_dirty  = true;
+    return idx;
+}
+
+internal b32 deps_is_depfile(const char *name)
+{
+    u64 len = strlen(name);
+    return len > 2 && !strcmp(name + len - 2, ".d");
+}
+
+internal b32 deps_is_json(const char *path)
+{
+    u64 len = strlen(path);
+    return len >= 5 && !strcmp(path + len - 5, ".json");
+}
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+internal void deps_walk(u32 source, const char *dir)
+{
+    char pattern[CHANGES_PATH_LEN];
+    snprintf(pattern, sizeof(pattern), "%s/*", dir);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        if (!strcmp(data.cFileName, ".") || !strcmp(data.cFileName, "..")) continue;
+        char path[CHANGES_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/%s", dir, data.cFileName);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) deps_walk(source, path);
+        } else if (deps_is_depfile(data.cFileName)) {
+            u64 mtime = ((u64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+            u64 size  = ((u64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+            deps_update_file(source, path, NULL, NULL, false, mtime, size);
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+}
+
+// Returns the index of the file or DEPS_NONE if it doesn't exist
+internal u32 deps_stat_file(u32 source, const char *path, const char *dir, const char *target)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) return DEPS_NONE;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        deps_walk(source, path);
+        return DEPS_NONE;
+    }
+    u64 mtime = ((u64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    u64 size  = ((u64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    return deps_update_file(source, path, dir, target, !target && deps_is_json(path), mtime, size);
+}
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+internal u64 deps_mtime(struct stat *st)
+{
+#if defined(__APPLE__)
+    return (u64)st->st_mtimespec.tv_sec*1000000000ull + (u64)st->st_mtimespec.tv_nsec;
+#else
+    return (u64)st->st_mtim.tv_sec*1000000000ull + (u64)st->st_mtim.tv_nsec;
+#endif
+}
+
+// @Note: Symbolic links to directories aren't followed, to not loop forever
+internal void deps_walk(u32 source, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        char path[CHANGES_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        struct stat st;
+        if (lstat(path, &st) < 0) continue;
+        if (S_ISDIR(st.st_mode)) deps_walk(source, path);
+        else if (deps_is_depfile(entry->d_name) && (S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && !stat(path, &st) && S_ISREG(st.st_mode)))) {
+            deps_update_file(source, path, NULL, NULL, false, deps_mtime(&st), (u64)st.st_size);
+        }
+    }
+    closedir(d);
+}
+
+// Returns the index of the file or DEPS_NONE if it doesn't exist
+internal u32 deps_stat_file(u32 source, const char *path, const char *dir, const char *target)
+{
+    struct stat st;
+    if (stat(path, &st) < 0) return DEPS_NONE;
+    if (S_ISDIR(st.st_mode)) {
+        deps_walk(source, path);
+        return DEPS_NONE;
+    }
+    return deps_update_file(source, path, dir, target, !target && deps_is_json(path), deps_mtime(&st), (u64)st.st_size);
+}
+
+#endif
+
+internal void deps_update_source(u32 source)
+{
+    u32 idx = deps_stat_file(source, deps_sources.data[source].path, NULL, NULL);
+    if (idx == DEPS_NONE || !deps_files.data[idx].json) return;
+    // @Note: The list of files may grow, so the compilation database is looked up again every time
+    for (u32 i = 0; i < deps_files.data[idx].entries.len; i++) {
+        DepsEntry entry = deps_files.data[idx].entries.data[i];
+        if (deps_stat_file(source, entry.depfiles[0], entry.dir, entry.target) == DEPS_NONE) {
+            deps_stat_file(source, entry.depfiles[1], entry.dir, entry.target);
+        }
+    }
+}
+
+// Checks all sources for new, changed and deleted depfiles and builds the reverse index again if anything changed
+internal void deps_update(void)
+{
+    changes_resolve_reset();
+    for (u32 i = 0; i < deps_files.len; i++) deps_files.data[i].seen = false;
+    for (u32 i = 0; i < deps_sources.len; i++) deps_update_source(i);
+    for (u32 i = 0; i < deps_files.len; i++) {
+        DepsFile *file = &deps_files.data[i];
+        if (file->seen || (!file->edges.len && !file->targets.len)) continue;
+        deps_clear_file(file);
+        file->mtime = file->size = 0;
+        deps_dirty  = true;
+    }
+    if (!deps_dirty) return;
+    deps_map_clear(&deps_index);
+    if (!deps_links.data) deps_links = ail_da_new_t(DepsLink);
+    deps_links.len = 0;
+    u32 n_edges = 0;
+    for (u32 i = 0; i < deps_files.len; i++) {
+        DepsFile *file = &deps_files.data[i];
+        for (u32 j = 0; j < file->edges.len; j++) {
+            DepsSlot *slot = deps_map_slot(&deps_index, file->edges.data[j].path_hash, true);
+            ail_da_push(&deps_links, ((DepsLink){ .file = i, .edge = j, .next = slot->idx }));
+            slot->idx = deps_links.len - 1;
+        }
+        n_edges += file->edges.len;
+    }
+    runlog_printf("### Read %u dependencies of %u files from the depfiles\n", n_edges, deps_index.len);
+    deps_dirty = false;
+}
+
+// Returns whether the command depends on any of the group's changed files and stores the affected targets
+// in `targets`, separated by newlines. Always returns true, if the command doesn't have any dependencies yet
+// `targets` stays empty if all targets should be built
+internal b32 deps_affected(Cmd *cmd, Batch *batch, u32 rule, AIL_DA(char) *targets)
+{
+    b32 has_deps = false, changed = false, affected = false, all = false;
+    for (u32 i = 0; i < deps_files.len && !has_deps; i++) {
+        has_deps = deps_sources.data[deps_files.data[i].source].cmd == cmd && deps_files.data[i].edges.len;
+    }
+    if (!has_deps) return true;
+    changes_resolve_reset();
+    DepsMap reported = {0}; // Targets that were already added
+    for (u32 i = 0; i < batch->changes.len; i++) {
+        Change *change = &batch->changes.data[i];
+        if (!(change->rules & (1ull << rule))) continue;
+        changed = true;
+        for (u32 k = 0; k < 2; k++) {
+            const char *path = k ? change->old_path : change->path;
+            if (!path) continue;
+            u64 hash = deps_path_hash(NULL, path, strlen(path));
+            if (!hash) {
+                // @Note: Paths that can't be resolved anymore (i.e. inside of deleted directories) affect all targets
+                all = true;
+                continue;
+            }
+            DepsSlot *slot = deps_map_slot(&deps_index, hash, false);
+            b32 known = false;
+            for (u32 l = slot ? slot->idx : DEPS_NONE; l != DEPS_NONE; l = deps_links.data[l].next) {
+                DepsFile *file = &deps_files.data[deps_links.data[l].file];
+                if (deps_sources.data[file->source].cmd != cmd) continue;
+                affected = known = true;
+                char *target = file->targets.data[file->edges.data[deps_links.data[l].edge].target];
+                DepsSlot *seen = deps_map_slot(&reported, history_hash(DEPS_SEED, target, strlen(target)), true);
+                if (seen->idx != DEPS_NONE) continue;
+                seen->idx = 0;
+                if (targets->len) ail_da_push(targets, '\n');
+                ail_da_pushn(targets, target, strlen(target));
+            }
+            // @Note: New files aren't a dependency of anything until the next build, but may be needed by any target
+            // (i.e. a new source file or a header that shadows another one), so they affect all targets
+            if (!k && !known && (change->action == DMON_ACTION_CREATE || change->action == DMON_ACTION_MOVE)) all = true;
+        }
+    }
+    if (reported.slots) AIL_CALL_FREE(ail_default_allocator, reported.slots);
+    // @Note: Rerunning manually always runs all commands
+    if (all || !changed) targets->len = 0;
+    // @Note: The environment shares its size limit with the arguments and Linux limits each variable to 128KiB as well
+    if (targets->len > CHANGES_ENV_MAX) {
+        log_warn("Too many affected targets to provide them in WATCH_EXEC_TARGETS, so all targets are built");
+        targets->len = 0;
+    }
+    if (targets->len) ail_da_push(targets, 0);
+    return affected || all || !changed;
+}
@@ -0,0 +1,644 @@
+#include "header.h"
+
+// A single invocation of a command
+typedef struct Job {
+    AIL_DA(str) argv;
+    char       *arg_str;
+    u64         cache_key; // 0 if the command isn't cached
+} Job;
+AIL_DA_INIT(Job);
+
+typedef enum ExecState {
+    EXEC_PENDING,
+    EXEC_RUNNING,
+    EXEC_SUCCEEDED,
+    EXEC_FAILED,
+    EXEC_SKIPPED,
+} ExecState;
+
+// A command of a group together with all of its invocations
+typedef struct ExecNode {
+    Cmd        *cmd;
+    AIL_DA(Job) jobs;
+    ExecState   state;
+    u32         next_job;     // Index of the next job to start
+    u32         running;      // Amount of jobs currently running
+    u32         failed;       // Amount of jobs that failed
+    u32         cached;       // Amount of jobs that were skipped, since they succeeded for the same files before
+    u32         timed_out;    // Amount of jobs that were stopped, since they exceeded the command's timeout
+    u32         max_parallel; // Maximum amount of jobs of this node that may run at the same time
+    char       *targets;      // Targets whose dependencies changed, provided in WATCH_EXEC_TARGETS (NULL for all targets)
+    u64         start_ns;
+    u64         end_ns;
+} ExecNode;
+
+global u32 exec_max_jobs = 1;       // Maximum amount of processes that may run at the same time
+global u32 exec_kill_grace_ms = 0; // Time that cancelled processes get to stop before they're killed
+
+internal void exec_init(u32 max_jobs, u32 kill_grace_ms)
+{
+    exec_max_jobs      = max_jobs ? max_jobs : subproc_core_count();
+    exec_kill_grace_ms = kill_grace_ms;
+}
+
+internal void exec_free_jobs(AIL_DA(Job) *jobs)
+{
+    for (u32 i = 0; i < jobs->len; i++) {
+        ail_da_free(&jobs->data[i].argv);
+        AIL_CALL_FREE(ail_default_allocator, jobs->data[i].arg_str);
+    }
+    ail_da_free(jobs);
+}
+
+internal const char *exec_state_str(ExecState state)
+{
+    switch (state) {
+        case EXEC_PENDING:   return "pending";
+        case EXEC_RUNNING:   return "running";
+        case EXEC_SUCCEEDED: return "ok";
+        case EXEC_FAILED:    return "failed";
+        case EXEC_SKIPPED:   return "skipped";
+    }
+    AIL_UNREACHABLE();
+    return "";
+}
+
+// Splits the command into the invocations that are necessary to pass all changed files to it
+// `state` is the hash of the group's files, that cached jobs are looked up by
+internal void exec_build_jobs(ExecNode *node, AIL_DA(str) *files, u64 state)
+{
+    Cmd *cmd = node->cmd;
+    node->jobs = ail_da_new_t(Job);
+    node->max_parallel = 1;
+    // @Note: WATCH_EXEC_TARGETS is only set right before the command starts, so it isn't part of the environment yet
+    u64 env_len = node->targets ? strlen("WATCH_EXEC_TARGETS=") + strlen(node->targets) + 1 + sizeof(char *) : 0;
+    // @Note: Workers and servers receive all changed files themselves, so a single job only provides their command line
+    if (cmd->worker || cmd->server || (!changes_placeholder_count(&cmd->argv) && !cmd->each)) {
+        Job job = { .argv = ail_da_new_t(str) };
+        ail_da_pushn(&job.argv, cmd->argv.data, cmd->argv.len);
+        job.arg_str = subproc_join_argv(&job.argv, ail_default_allocator);
+        ail_da_push(&node->jobs, job);
+    } else {
+        for (u32 next = 0; next < files->len; ) {
+            Job job = { .argv = changes_expand_argv(&cmd->argv, files, &next, cmd->each, env_len) };
+            job.arg_str = subproc_join_argv(&job.argv, ail_default_allocator);
+            ail_da_push(&node->jobs, job);
+        }
+        // @Note: Chunks that were only split due to the size limit of the command line keep running one after another
+        if (cmd->each) node->max_parallel = node->jobs.len;
+    }
+    if (cmd->cached) {
+        for (u32 i = 0; i < node->jobs.len; i++) node->jobs.data[i].cache_key = cache_key(state, node->jobs.data[i].arg_str);
+    }
+}
+
+internal void exec_finish_node(ExecNode *node)
+{
+    node->end_ns = timer_now_ns();
+    if (node->failed) {
+        node->state = EXEC_FAILED;
+        if (node->jobs.len > 1) log_warn("'%s' failed for %u of %u invocations", node->cmd->str, node->failed, node->jobs.len);
+    } else {
+        node->state = EXEC_SUCCEEDED;
+        log_succ("'%s' ran successfully", node->cmd->str);
+    }
+}
+
+// Updates which commands can run now that their dependencies finished
+// Commands depending on a failed or skipped command are skipped themselves
+internal void exec_update_states(ExecNode *nodes, u32 n)
+{
+    for (u32 i = 0; i < n; i++) {
+        ExecNode *node = &nodes[i];
+        if (node->state != EXEC_PENDING) continue;
+        b32 ready = true;
+        for (u32 j = 0; j < n; j++) {
+            if (!(node->cmd->after & (1ull << j))) continue;
+            if (nodes[j].state == EXEC_FAILED || nodes[j].state == EXEC_SKIPPED) {
+                node->state = EXEC_SKIPPED;
+                log_info("Skipping '%s', since '%s' didn't succeed", node->cmd->str, nodes[j].cmd->name);
+                break;
+            }
+            if (nodes[j].state != EXEC_SUCCEEDED) ready = false;
+        }
+        if (node->state == EXEC_PENDING && ready && !node->jobs.len) {
+            log_info("Skipping '%s', since no files were changed", node->cmd->str);
+            node->state = EXEC_SUCCEEDED;
+        }
+    }
+}
+
+// Orders the commands by the expected duration of the longest chain of commands that starts with them (their critical path),
+// so that the commands holding up the run the most are started first when there are fewer cores than commands ready to run
+// Returns the expected duration of the whole run in milliseconds or a negative number if no command ran before
+// @Note: Needs to be called after the commands that are skipped anyways were marked as succeeded, which don't take any time
+internal f64 exec_plan(ExecNode *nodes, u32 n, u32 *order)
+{
+    f64 expected[BUFFER_LEN], priority[BUFFER_LEN];
+    f64 known_sum = 0;
+    u32 known = 0;
+    for (u32 i = 0; i < n; i++) {
+        expected[i] = history_expected_ms(nodes[i].cmd->str);
+        if (expected[i] >= 0) {
+            known_sum += expected[i];
+            known++;
+        }
+    }
+    for (u32 i = 0; i < n; i++) {
+        if (expected[i] < 0) expected[i] = known ? known_sum/known : 0;
+        b32 cached = nodes[i].cmd->cached;
+        for (u32 j = 0; cached && j < nodes[i].jobs.len; j++) cached = cache_has(nodes[i].jobs.data[j].cache_key);
+        if (!nodes[i].jobs.len || nodes[i].state != EXEC_PENDING || cached) expected[i] = 0;
+    }
+    // Commands only depend on commands given before them, so all dependents of a command come after it
+    for (u32 i = n; i-- > 0; ) {
+        f64 longest = 0;
+        for (u32 j = i + 1; j < n; j++) {
+            if ((nodes[j].cmd->after & (1ull << i)) && priority[j] > longest) longest = priority[j];
+        }
+        priority[i] = expected[i] + longest;
+    }
+    for (u32 i = 0; i < n; i++) {
+        u32 j = i;
+        for (; j > 0 && priority[order[j - 1]] < priority[i]; j--) order[j] = order[j - 1];
+        order[j] = i;
+    }
+    if (!known) return -1;
+
+    // Simulate the run with the same scheduling to predict its duration
+    f64 finish[BUFFER_LEN];
+    b32 started[BUFFER_LEN] = {0};
+    f64 now = 0, end = 0;
+    u32 n_started = 0;
+    while (n_started < n) {
+        u32 n_running = 0;
+        for (u32 i = 0; i < n; i++) n_running += started[i] && finish[i] > now;
+        for (u32 k = 0; k < n && n_running < exec_max_jobs; k++) {
+            u32 i = order[k];
+            if (started[i]) continue;
+            b32 ready = true;
+            for (u32 j = 0; j < n; j++) {
+                if ((nodes[i].cmd->after & (1ull << j)) && (!started[j] || finish[j] > now)) ready = false;
+            }
+            if (!ready) continue;
+            started[i] = true;
+            finish[i]  = now + expected[i];
+            end        = AIL_MAX(end, finish[i]);
+            n_started++;
+            n_running++;
+        }
+        f64 next = -1;
+        for (u32 i = 0; i < n; i++) {
+            if (started[i] && finish[i] > now && (next < 0 || finish[i] < next)) next = finish[i];
+        }
+        if (next < 0) {
+            // Only commands finishing immediately were started, so their dependents can start right away
+            if (!n_running) break;
+            continue;
+        }
+        now = next;
+    }
+    return end;
+}
+
+internal void exec_print_summary(ExecNode *nodes, u32 n, u64 total_ns, f64 predicted_ms)
+{
+    if (predicted_ms >= 0) log_info("Summary (%.2fs in total, %.2fs predicted):", (f64)total_ns/1e9, predicted_ms/1e3);
+    else                   log_info("Summary (%.2fs in total):", (f64)total_ns/1e9);
+    for (u32 i = 0; i < n; i++) {
+        ExecNode *node = &nodes[i];
+        const char *state = node->timed_out ? "timeout" : exec_state_str(node->state);
+        if (node->start_ns) log_info("  %-8s %8.2fs  %s", state, (f64)(node->end_ns - node->start_ns)/1e9, node->cmd->name);
+        else                log_info("  %-8s %9s  %s",    state, "-", node->cmd->name);
+    }
+}
+
+// A command that keeps running in the background: A batch of changed files that was sent to a worker (see worker.c)
+// or an instance of a server, that is waited for to become ready (see server.c)
+typedef struct BgJob {
+    Cmd *cmd;
+    u32  batch;
+    u32  node;
+} BgJob;
+
+// All groups that run for one batch of changes, one group after another
+// The run only advances in exec_run_update, so that new changes and key presses can be handled while it is running
+typedef struct ExecRun {
+    b32         active;
+    Batch       batch;
+    RuleList   *rules;
+    u64         rules_left;   // Groups that weren't started yet
+    u32         n_groups;     // Amount of groups that were started
+    u64         start_ns;
+    f64         predicted_ms; // Expected duration of all groups started so far (negative if unknown)
+    // The group that is currently running
+    Rule       *rule;
+    AIL_DA(str) files;
+    SubProcOpts opts;
+    char        stdin_path[1100];
+    ExecNode    nodes[BUFFER_LEN];
+    u32         order[BUFFER_LEN];
+    u32         n;
+    u64         group_start_ns;
+    f64         group_predicted_ms;
+    SubProc    *running;
+    u32        *run_node;
+    u64        *run_key;      // Cache key of each running job
+    u32        *run_trace;    // Id of the trace file of each running job (0 if it isn't traced)
+    char       *run_token;    // Jobserver token used by each running job (see jobserver.c)
+    u64        *run_stopped;  // Time at which each running job was asked to stop after timing out (0 if it wasn't, UINT64_MAX once it was killed)
+    u32         n_running;
+    BgJob       bg_jobs[BUFFER_LEN];
+    u32         n_bg_jobs;
+} ExecRun;
+
+internal void exec_group_start(ExecRun *run, u32 rule_idx)
+{
+    run->rule  = &run->rules->data[rule_idx];
+    run->files = changes_files(&run->batch, rule_idx);
+    changes_export(&run->batch, rule_idx, &run->files);
+    changes_tmp_path(run->stdin_path, sizeof(run->stdin_path), rule_idx, "files");
+    run->opts = (SubProcOpts){
+        .stdin_path = run->rule->stdin_files ? run->stdin_path : NULL,
+        .launcher   = limits_launcher,
+        .n_launcher = limits_launcher_len,
+    };
+    run->n    = run->rule->cmds.len;
+    run->group_start_ns = timer_now_ns();
+    memset(run->nodes, 0, sizeof(run->nodes));
+    u64 state = 0;
+    for (u32 i = 0; i < run->n; i++) {
+        if (run->rule->cmds.data[i].cached) {
+            state = cache_group_state(rule_idx);
+            break;
+        }
+    }
+    for (u32 i = 0; i < run->n; i++) {
+        if (run->rule->cmds.data[i].deps) {
+            deps_update();
+            break;
+        }
+    }
+    for (u32 i = 0; i < run->n; i++) {
+        ExecNode *node = &run->nodes[i];
+        node->cmd = &run->rule->cmds.data[i];
+        if (node->cmd->traced && !trace_affected(node->cmd, &run->batch, rule_idx)) {
+            log_info("Skipping '%s', since it didn't read any of the changed files", node->cmd->str);
+            node->state = EXEC_SUCCEEDED;
+        }
+        if (node->cmd->deps && node->state == EXEC_PENDING) {
+            AIL_DA(char) targets = ail_da_new_t(char);
+            if (!deps_affected(node->cmd, &run->batch, rule_idx, &targets)) {
+                log_info("Skipping '%s', since none of its dependencies changed", node->cmd->str);
+                node->state = EXEC_SUCCEEDED;
+            }
+            if (targets.len) node->targets = targets.data;
+            else ail_da_free(&targets);
+        }
+        exec_build_jobs(node, &run->files, state);
+        if (node->state == EXEC_PENDING && throttle_skip(node->cmd, &run->batch, rule_idx)) node->state = EXEC_SUCCEEDED;
+    }
+    run->group_predicted_ms = exec_plan(run->nodes, run->n, run->order);
+    if (run->group_predicted_ms < 0) run->predicted_ms = -1;
+    else if (run->predicted_ms >= 0) run->predicted_ms += run->group_predicted_ms;
+    run->n_groups++;
+}
+
+// Durations are only recorded for groups that weren't cancelled, since they'd make the predictions too optimistic
+internal void exec_group_finish(ExecRun *run, b32 cancelled)
+{
+    ExecNode *nodes = run->nodes;
+    for (u32 i = 0; i < run->n; i++) {
+        // @Note: Only happens if waiting for the child processes failed or the run was cancelled
+        if (nodes[i].state == EXEC_PENDING || nodes[i].state == EXEC_RUNNING) {
+            if (cancelled) throttle_cancelled(nodes[i].cmd);
+            nodes[i].state = EXEC_FAILED;
+        }
+        if (!cancelled && nodes[i].state == EXEC_SUCCEEDED && nodes[i].start_ns && nodes[i].cached < nodes[i].jobs.len) history_record(nodes[i].cmd->str, nodes[i].end_ns - nodes[i].start_ns);
+        exec_free_jobs(&nodes[i].jobs);
+        if (nodes[i].targets) AIL_CALL_FREE(ail_default_allocator, nodes[i].targets);
+    }
+    if (!cancelled && run->n > 1) exec_print_summary(nodes, run->n, timer_now_ns() - run->group_start_ns, run->group_predicted_ms);
+    ail_da_free(&run->files);
+    run->rule = NULL;
+}
+
+internal void exec_run_finish(ExecRun *run, b32 cancelled)
+{
+    limits_run_end(cancelled);
+    runlog_end_run();
+    history_save();
+    if (!cancelled && run->n_groups > 1) {
+        f64 total_s = (f64)(timer_now_ns() - run->start_ns)/1e9;
+        if (run->predicted_ms >= 0) log_info("All groups finished after %.2fs (%.2fs predicted)", total_s, run->predicted_ms/1e3);
+        else                        log_info("All groups finished after %.2fs", total_s);
+    }
+    AIL_CALL_FREE(ail_default_allocator, run->running);
+    AIL_CALL_FREE(ail_default_allocator, run->run_node);
+    AIL_CALL_FREE(ail_default_allocator, run->run_key);
+    AIL_CALL_FREE(ail_default_allocator, run->run_trace);
+    AIL_CALL_FREE(ail_default_allocator, run->run_token);
+    AIL_CALL_FREE(ail_default_allocator, run->run_stopped);
+    run->active = false;
+    self_run_end();
+}
+
+// Records the files written so far by the running commands, so that their changes can be told apart from other ones
+internal void exec_run_peek_writes(ExecRun *run)
+{
+    for (u32 i = 0; run->active && i < run->n_running; i++) {
+        if (run->run_trace[i]) trace_peek(run->run_trace[i]);
+    }
+}
+
+// Starts all commands of the current group that can run now, with at most exec_max_jobs processes running at the same time
+// Returns false once the group is done
+internal b32 exec_group_schedule(ExecRun *run)
+{
+    ExecNode *nodes = run->nodes;
+    u32 n = run->n;
+    for (;;) {
+        exec_update_states(nodes, n);
+        for (u32 k = 0; k < n && run->n_running < exec_max_jobs; k++) {
+            u32 i = run->order[k];
+            ExecNode *node = &nodes[i];
+            if (node->state != EXEC_PENDING && node->state != EXEC_RUNNING) continue;
+            b32 ready = true;
+            for (u32 j = 0; j < n; j++) {
+                if ((node->cmd->after & (1ull << j)) && nodes[j].state != EXEC_SUCCEEDED) ready = false;
+            }
+            if (!ready) continue;
+            // @Note: The command's duration only starts once its first job started, not while it waits for a jobserver token
+            if (node->state == EXEC_PENDING) node->state = EXEC_RUNNING;
+            // After the first failure of a command, none of its remaining invocations are started
+            // @Note: Workers and servers keep running anyways, so they don't count towards the maximum amount of processes
+            if ((node->cmd->worker || node->cmd->server) && node->next_job < node->jobs.len) {
+                Job   *job = &node->jobs.data[node->next_job++];
+                BgJob *bg  = &run->bg_jobs[run->n_bg_jobs];
+                if (!node->start_ns) node->start_ns = timer_now_ns();
+                b32 started = node->cmd->server ? server_start(node->cmd, &job->argv) : worker_send(node->cmd, &job->argv, &run->files, &bg->batch);
+                if (started) {
+                    bg->cmd  = node->cmd;
+                    bg->node = i;
+                    run->n_bg_jobs++;
+                    node->running++;
+                } else {
+                    log_err("'%s' couldn't be executed properly", node->cmd->str);
+                    node->failed++;
+                }
+            }
+            while (!node->failed && node->next_job < node->jobs.len && node->running < node->max_parallel && run->n_running < exec_max_jobs) {
+                Job *job = &node->jobs.data[node->next_job++];
+                if (job->cache_key && cache_replay(job->cache_key, job->arg_str)) {
+                    if (!node->start_ns) node->start_ns = timer_now_ns();
+                    node->cached++;
+                    continue;
+                }
+                char token;
+                if (!jobserver_acquire(&token)) {
+                    node->next_job--; // Started once a token was returned
+                    break;
+                }
+                if (!node->start_ns) node->start_ns = timer_now_ns();
+                SubProcOpts opts = run->opts;
+                opts.capture = job->cache_key != 0;
+                u32 trace_id = (node->cmd->traced || self_precise) ? trace_begin(node->cmd->traced) : 0;
+                if (node->cmd->deps) subproc_set_env("WATCH_EXEC_TARGETS", node->targets);
+                jobserver_begin();
+                b32 started  = subproc_start(&run->running[run->n_running], &job->argv, job->arg_str, opts, ail_default_allocator);
+                jobserver_end();
+                if (trace_id) trace_end();
+                if (node->cmd->deps) subproc_set_env("WATCH_EXEC_TARGETS", NULL);
+                if (started) {
+                    run->run_key[run->n_running]     = job->cache_key;
+                    run->run_trace[run->n_running]   = trace_id;
+                    run->run_token[run->n_running]   = token;
+                    run->run_stopped[run->n_running] = 0;
+                    run->run_node[run->n_running++]  = i;
+                    node->running++;
+                } else {
+                    if (trace_id) trace_collect(node->cmd, trace_id, false);
+                    jobserver_release(token);
+                    log_err("'%s' couldn't be executed properly", job->arg_str);
+                    node->failed++;
+                }
+            }
+            if (!node->running && (node->failed || node->next_job == node->jobs.len)) exec_finish_node(node);
+        }
+        if (run->n_running || run->n_bg_jobs) return true;
+        // @Note: Commands can only depend on commands given before them, so another pass always makes progress
+        b32 pending = false;
+        for (u32 i = 0; i < n; i++) pending |= nodes[i].state == EXEC_PENDING;
+        if (!pending) return false;
+    }
+}
+
+// Moves on to the next group once the current one is done and finishes the run after the last group
+internal void exec_run_advance(ExecRun *run)
+{
+    while (run->active) {
+        if (run->rule) {
+            if (exec_group_schedule(run)) return;
+            exec_group_finish(run, false);
+        }
+        if (!run->rules_left) {
+            batch_free(&run->batch);
+            exec_run_finish(run, false);
+            return;
+        }
+        u32 rule_idx = 0;
+        while (!(run->rules_left & (1ull << rule_idx))) rule_idx++;
+        run->rules_left &= ~(1ull << rule_idx);
+        exec_group_start(run, rule_idx);
+    }
+}
+
+// Takes ownership of the batch and starts running the commands of all groups contained in it
+// A failing command only stops the commands of its own group that depend on it
+internal void exec_run_start(ExecRun *run, Batch batch, RuleList *rules)
+{
+    memset(run, 0, sizeof(*run));
+    run->active      = true;
+    run->batch       = batch;
+    run->rules       = rules;
+    run->rules_left  = batch.rules;
+    run->start_ns    = timer_now_ns();
+    run->running     = AIL_CALL_ALLOC(ail_default_allocator, sizeof(SubProc)*exec_max_jobs);
+    run->run_node    = AIL_CALL_ALLOC(ail_default_allocator, sizeof(u32)*exec_max_jobs);
+    run->run_key     = AIL_CALL_ALLOC(ail_default_allocator, sizeof(u64)*exec_max_jobs);
+    run->run_trace   = AIL_CALL_ALLOC(ail_default_allocator, sizeof(u32)*exec_max_jobs);
+    run->run_token   = AIL_CALL_ALLOC(ail_default_allocator, exec_max_jobs);
+    run->run_stopped = AIL_CALL_ALLOC(ail_default_allocator, sizeof(u64)*exec_max_jobs);
+    runlog_start_run();
+    self_run_begin();
+    limits_run_begin();
+    exec_run_advance(run);
+}
+
+internal void exec_remove_running(ExecRun *run, u32 idx)
+{
+    run->nodes[run->run_node[idx]].running--;
+    jobserver_release(run->run_token[idx]);
+    if (run->running[idx].capture.data) ail_da_free(&run->running[idx].capture);
+    run->running[idx]     = run->running[--run->n_running];
+    run->run_node[idx]    = run->run_node[run->n_running];
+    run->run_key[idx]     = run->run_key[run->n_running];
+    run->run_trace[idx]   = run->run_trace[run->n_running];
+    run->run_token[idx]   = run->run_token[run->n_running];
+    run->run_stopped[idx] = run->run_stopped[run->n_running];
+}
+
+// Forwards the output of a running command, that the reactor reported
+internal void exec_run_handle(ExecRun *run, ReactorEvent ev)
+{
+    if (!run->active || ev.kind != REACTOR_OUTPUT) return;
+    for (u32 i = 0; i < run->n_running; i++) {
+        if ((u32)run->running[i].pid == ev.id) subproc_handle_output(&run->running[i]);
+    }
+}
+
+// Returns the time at which the running job needs to be stopped or killed due to its command's timeouts (UINT64_MAX for never)
+internal u64 exec_job_deadline(ExecRun *run, u32 idx)
+{
+    SubProc *proc = &run->running[idx];
+    Cmd     *cmd  = run->nodes[run->run_node[idx]].cmd;
+    u64 stopped = run->run_stopped[idx];
+    if (stopped) return stopped == UINT64_MAX ? UINT64_MAX : stopped + exec_kill_grace_ms;
+    u64 deadline = UINT64_MAX;
+    if (cmd->timeout)      deadline = proc->start_ms + cmd->timeout;
+    if (cmd->idle_timeout) deadline = AIL_MIN(deadline, proc->output_ms + cmd->idle_timeout);
+    return deadline;
+}
+
+// Stops the jobs that exceeded their command's timeouts together with all processes they started,
+// killing them if they're still running after exec_kill_grace_ms
+// @Note: Workers and servers keep running across runs, so they aren't stopped by timeouts
+internal void exec_check_timeouts(ExecRun *run)
+{
+    u64 now = timer_now_ms();
+    for (u32 i = 0; i < run->n_running; i++) {
+        if (now < exec_job_deadline(run, i)) continue;
+        SubProc  *proc = &run->running[i];
+        ExecNode *node = &run->nodes[run->run_node[i]];
+        if (run->run_stopped[i]) {
+            log_warn("Killing '%s', since it's still running %ums after it timed out", node->cmd->str, exec_kill_grace_ms);
+            subproc_kill(proc, true);
+            run->run_stopped[i] = UINT64_MAX;
+            continue;
+        }
+        if (node->cmd->timeout && now >= proc->start_ms + node->cmd->timeout) {
+            log_warn("'%s' timed out after %.1fs, stopping it...", node->cmd->str, node->cmd->timeout/1e3);
+        } else {
+            log_warn("'%s' didn't print anything for %.1fs, stopping it...", node->cmd->str, node->cmd->idle_timeout/1e3);
+        }
+        runlog_printf("### '%s' timed out\n", node->cmd->str);
+        subproc_kill(proc, false);
+        run->run_stopped[i] = now;
+        node->timed_out++;
+    }
+}
+
+// Handles the commands that finished and starts the commands that can run now
+internal void exec_run_update(ExecRun *run)
+{
+    exec_run_advance(run);
+    if (run->active) exec_check_timeouts(run);
+    for (u32 i = 0; run->active && i < run->n_running; ) {
+        if (!subproc_reap(&run->running[i])) {
+            i++;
+            continue;
+        }
+        SubProcRes res  = run->running[i].res;
+        ExecNode  *node = &run->nodes[run->run_node[i]];
+        b32 succeeded = res.finished && !res.exitCode && !run->run_stopped[i];
+        if (!res.finished) {
+            log_err("'%s' couldn't be executed properly", node->cmd->str);
+            node->failed++;
+        } else if (run->run_stopped[i]) {
+            node->failed++; // Reported when it timed out already
+        } else if (res.exitCode) {
+            log_warn("'%s' failed with exit Code %d", node->cmd->str, res.exitCode);
+            node->failed++;
+        }
+        if (res.finished) runlog_printf("### '%s' exited with code %d\n", node->cmd->str, res.exitCode);
+        AIL_DA(char) *capture = &run->running[i].capture;
+        if (succeeded && run->run_key[i] && capture->data) cache_store(run->run_key[i], capture->data, capture->len);
+        if (run->run_trace[i]) trace_collect(node->cmd, run->run_trace[i], succeeded);
+        exec_remove_running(run, i);
+        if (!node->running && (node->failed || node->next_job == node->jobs.len)) exec_finish_node(node);
+        exec_run_advance(run);
+        i = 0;
+    }
+    for (u32 i = 0; run->active && i < run->n_bg_jobs; ) {
+        BgJob *bg = &run->bg_jobs[i];
+        i32 code;
+        b32 done = bg->cmd->server ? server_started(bg->cmd, &code) : worker_batch_done(bg->cmd, bg->batch, &code);
+        if (!done) {
+            i++;
+            continue;
+        }
+        ExecNode *node = &run->nodes[bg->node];
+        if (code) {
+            log_warn("'%s' failed with exit Code %d", node->cmd->str, code);
+            node->failed++;
+        }
+        node->running--;
+        *bg = run->bg_jobs[--run->n_bg_jobs];
+        if (!node->running) exec_finish_node(node);
+        exec_run_advance(run);
+        i = 0;
+    }
+}
+
+// Returns the time after which exec_run_update needs to be called again, even if the reactor didn't report anything for the run
+internal i32 exec_run_timeout(ExecRun *run)
+{
+    i32 timeout_ms = -1;
+    u64 now = timer_now_ms();
+    for (u32 i = 0; run->active && i < run->n_running; i++) {
+        i32 interval = subproc_poll_interval(&run->running[i]);
+        u64 deadline = exec_job_deadline(run, i);
+        if (deadline != UINT64_MAX) {
+            i32 left = deadline > now ? (i32)AIL_MIN(deadline - now, (u64)INT32_MAX) : 0;
+            if (interval < 0 || left < interval) interval = left;
+        }
+        if (interval >= 0 && (timeout_ms < 0 || interval < timeout_ms)) timeout_ms = interval;
+    }
+    return timeout_ms;
+}
+
+// Stops all running commands, first asking them to stop and killing them if they're still running after exec_kill_grace_ms
+// Returns the batch of the run, so that its changes can be handled by the next run
+internal Batch exec_run_cancel(ExecRun *run)
+{
+    if (run->rule) {
+        if (run->n_running || run->n_bg_jobs) log_info("Cancelling the running commands...");
+        for (u32 i = 0; i < run->n_running; i++) subproc_kill(&run->running[i], false);
+        u64  deadline = timer_now_ms() + exec_kill_grace_ms;
+        b32  forced   = false;
+        b32  killed   = run->n_running > 0;
+        while (run->n_running) {
+            u64 now = timer_now_ms();
+            if (!forced && now >= deadline) {
+                log_warn("Killing the commands that are still running after %ums", exec_kill_grace_ms);
+                for (u32 i = 0; i < run->n_running; i++) subproc_kill(&run->running[i], true);
+                forced = true;
+            }
+            i32 idx = subproc_wait_any(run->running, run->n_running, forced ? -1 : (i32)(deadline - now));
+            if (idx < 0) continue;
+            runlog_printf("### '%s' was cancelled\n", run->nodes[run->run_node[idx]].cmd->str);
+            if (run->run_trace[idx]) trace_collect(run->nodes[run->run_node[idx]].cmd, run->run_trace[idx], false);
+            exec_remove_running(run, idx);
+        }
+        if (killed) jobserver_refill();
+        // @Note: Workers keep running, since their batches are handled in order anyways, and servers keep their current instance
+        for (u32 i = 0; i < run->n_bg_jobs; i++) {
+            if (run->bg_jobs[i].cmd->server) server_cancel(run->bg_jobs[i].cmd);
+            runlog_printf("### '%s' was cancelled\n", run->bg_jobs[i].cmd->str);
+        }
+        run->n_bg_jobs = 0;
+        exec_group_finish(run, true);
+    }
+    exec_run_finish(run, true);
+    return run->batch;
+}
@@ -0,0 +1,172 @@
+#include "header.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#   include <immintrin.h>
+#endif
+#if defined(_WIN32) || defined(__WIN32__)
+    typedef struct FilterSeg { const void *iov_base; size_t iov_len; } FilterSeg;
+#else
+#   include <sys/uio.h>
+#   include <unistd.h>
+    typedef struct iovec FilterSeg;
+#endif
+
+#define FILTER_MAX_SEGS 64
+
+// @Note: Certain ANSI escape codes should not be forwarded to the console to prevent weird artifacts
+// Currently these codes are specifically some erase functions:
+//   - "\x1b[H":  Moves cursor to position 0,0
+//   - "\x1b[1J": Erases from cursor to beginning of screen
+//   - "\x1b[2J": Erases entire screen
+// For a full list of existing ansi escape codes, see this handy cheatsheet: https://gist.github.com/ConnerWill/d4b6c776b509add763e17f9f113fd25b
+// The filter is a small state machine, so that sequences split across several chunks of output are still recognized
+typedef enum FilterState {
+    FILTER_TEXT,
+    FILTER_ESC,     // Seen "\x1b"
+    FILTER_CSI,     // Seen "\x1b["
+    FILTER_CSI_NUM, // Seen "\x1b[1" or "\x1b[2"
+} FilterState;
+
+typedef struct AnsiFilter {
+    FilterState state;
+    u32  pending_len;
+    char pending[4]; // Bytes of the sequence that is currently being matched
+} AnsiFilter;
+
+global b32 filter_force_scalar; // Only used for benchmarking
+
+// Returns the index of the first ESC byte or `len` if there is none
+internal u64 filter_find_esc(const char *data, u64 len)
+{
+    u64 i = 0;
+    if (!filter_force_scalar) {
+#if defined(__AVX2__)
+        const __m256i esc32 = _mm256_set1_epi8(0x1b);
+        for (; i + 32 <= len; i += 32) {
+            u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), esc32));
+            if (mask) return i + __builtin_ctz(mask);
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i esc16 = _mm_set1_epi8(0x1b);
+        for (; i + 16 <= len; i += 16) {
+            u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), esc16));
+            if (mask) return i + __builtin_ctz(mask);
+        }
+#endif
+    }
+    for (; i < len; i++) {
+        if (data[i] == '\x1b') return i;
+    }
+    return len;
+}
+
+internal void filter_flush_segs(FilterSeg *segs, u32 *n)
+{
+    if (!*n) return;
+#if defined(_WIN32) || defined(__WIN32__)
+    for (u32 i = 0; i < *n; i++) fwrite(segs[i].iov_base, 1, segs[i].iov_len, stdout);
+    fflush(stdout);
+#else
+    // @Note: Everything else is printed via stdio, which might still have something buffered
+    fflush(stdout);
+    FilterSeg *seg = segs;
+    u32 left = *n;
+    while (left) {
+        ssize_t written = writev(STDOUT_FILENO, seg, (int)left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        while (left && (size_t)written >= seg->iov_len) {
+            written -= seg->iov_len;
+            seg++;
+            left--;
+        }
+        if (left) {
+            seg->iov_base = (char *)seg->iov_base + written;
+            seg->iov_len -= written;
+        }
+    }
+#endif
+    *n = 0;
+}
+
+internal void filter_push_seg(FilterSeg *segs, u32 *n, const char *data, u64 len)
+{
+    if (!len) return;
+    if (*n == FILTER_MAX_SEGS) filter_flush_segs(segs, n);
+    segs[*n].iov_base = (void *)data;
+    segs[*n].iov_len  = len;
+    (*n)++;
+}
+
+// Prints the data without the forbidden sequences
+// The end of a sequence might be contained in the next call, so the bytes of an unfinished sequence are kept until then
+// The data is never modified
+internal void filter_write(AnsiFilter *f, const char *data, u64 len)
+{
+    FilterSeg segs[FILTER_MAX_SEGS];
+    u32 n = 0;
+    // @Note: The beginning of a sequence from a previous call is copied, since f->pending is reused for the following sequences
+    char carry[sizeof(f->pending)];
+    u32  carry_len = f->pending_len;
+    memcpy(carry, f->pending, carry_len);
+    b32  carried   = f->state != FILTER_TEXT;
+    u64  seq_start = 0;
+    u64  i = 0;
+    while (i < len) {
+        if (f->state == FILTER_TEXT) {
+            u64 esc = i + filter_find_esc(data + i, len - i);
+            filter_push_seg(segs, &n, data + i, esc - i);
+            if (esc == len) break;
+            f->state       = FILTER_ESC;
+            f->pending[0]  = '\x1b';
+            f->pending_len = 1;
+            carried   = false;
+            seq_start = esc;
+            i = esc + 1;
+            continue;
+        }
+        char c = data[i];
+        b32 matched = false, done = false;
+        switch (f->state) {
+            case FILTER_ESC:     matched = c == '[';                          break;
+            case FILTER_CSI:     matched = c == 'H' || c == '1' || c == '2'; done = c == 'H'; break;
+            case FILTER_CSI_NUM: matched = done = c == 'J';                   break;
+            case FILTER_TEXT:    break;
+        }
+        if (done) {
+            f->state = FILTER_TEXT;
+            f->pending_len = 0;
+            i++;
+        } else if (matched) {
+            f->pending[f->pending_len++] = c;
+            f->state = f->state == FILTER_ESC ? FILTER_CSI : FILTER_CSI_NUM;
+            i++;
+        } else {
+            // Not a forbidden sequence, so its bytes are printed after all and the current byte is looked at again as normal text
+            if (carried) {
+                filter_push_seg(segs, &n, carry, carry_len);
+                filter_push_seg(segs, &n, data, i);
+            } else {
+                filter_push_seg(segs, &n, data + seq_start, i - seq_start);
+            }
+            carried  = false;
+            f->state = FILTER_TEXT;
+            f->pending_len = 0;
+        }
+    }
+    filter_flush_segs(segs, &n);
+}
+
+// Prints the bytes of an unfinished sequence at the end of the output
+internal void filter_finish(AnsiFilter *f)
+{
+    if (f->pending_len) {
+        fwrite(f->pending, 1, f->pending_len, stdout);
+        fflush(stdout);
+    }
+    f->state = FILTER_TEXT;
+    f->pending_len = 0;
+}
@@ -5,12 +5,13 @@
 
 // @TODO: Features to add:
 // - ignore folders
-// - allow specifying seperate commands for seperate dirs/matches
 // - provide non-recursive option
-// - run subprocess in seperate thread so they can be killed at any time to start again
 // - work with unicode instead of ascii
 // - provide non-regex options (maybe glob? maybe flat text?)
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE // For tee() and splice()
+#endif
 #include <stdio.h>
 #define DMON_IMPL
 #include "../deps/dmon/dmon.h"
@@ -24,10 +25,6 @@
 #define SV_LIT   AIL_SV_FROM_LITERAL
 #define SV_LIT_T AIL_SV_FROM_LITERAL_T
 
-#include "term.c"
-#include "log.c"
-#include "subproc.c"
-
 #define BUFFER_LEN 32
 typedef struct StrList {
     u32 len;
@@ -37,11 +34,78 @@ typedef struct RegexList {
     u32 len;
     AIL_PM_Pattern data[BUFFER_LEN];
 } RegexList;
+// How changed files are sent to a command that is kept running as a worker (see worker.c)
+typedef enum WorkerProto {
+    WORKER_NONE,   // The command is started anew for every run
+    WORKER_LINES,  // One file per line, followed by an empty line
+    WORKER_LENGTH, // The length of the batch on its own line, followed by the files, each terminated by a NUL byte
+} WorkerProto;
+// Triggers of a command with a minimum interval that start it (see throttle.c)
+typedef enum ThrottleEdge {
+    THROTTLE_LEADING  = 1, // Right away, if the command didn't start during the last interval
+    THROTTLE_TRAILING = 2, // Once the interval is over, if the command was triggered during it
+} ThrottleEdge;
+typedef struct Cmd {
+    str         str;   // Command as given by the user
+    str         name;  // Name to refer to the command by, defaults to the command itself
+    AIL_DA(str) argv;
+    u32         each;  // Run the command once per chunk of this many changed files (0 to run it once with all files)
+    u64         after; // Bitmask of the commands in the same group that need to succeed before this one can run
+    WorkerProto worker;
+    b32         server; // Keep the command running after the run, until the next run started a new instance of it
+    str         listen; // Address of the socket, that is passed to the server (optional)
+    u32         ready_timeout; // Milliseconds after which a new instance of the server counts as ready without reporting it (0 to wait forever)
+    b32         cached; // Skip the command if it succeeded before for the same content of the group's files
+    b32         traced; // Skip the command if it didn't read any of the changed files the last time it succeeded
+    b32         deps;   // Skip the command if none of the changed files is a dependency of it according to its depfiles
+    AIL_DA(str) deps_paths; // Depfiles, directories and compile_commands.json files given with --deps
+    u32         min_interval; // Minimum milliseconds between two starts of the command (0 for none)
+    u32         edges;        // ThrottleEdge flags of the triggers that start the command, if it has a minimum interval
+    u32         timeout;      // Milliseconds after which an invocation of the command is stopped (0 for none)
+    u32         idle_timeout; // Milliseconds without any output after which an invocation of the command is stopped (0 for none)
+} Cmd;
 typedef struct CmdList {
     u32 len;
-    str data[BUFFER_LEN];
-    AIL_DA(str) cmds[BUFFER_LEN];
+    Cmd data[BUFFER_LEN];
 } CmdList;
 #define list_push(list, el) ((list).data[(list).len++] = (el))
 
+// A rule group bundles the directories, patterns and commands that belong together
+// Only the commands of groups whose patterns matched a change are executed
+typedef struct Rule {
+    u64       dirs; // Bitmask of indices into the global list of watched directories
+    RegexList regexs;
+    CmdList   cmds;
+    b32       stdin_files; // Provide the list of changed files as stdin to the commands
+} Rule;
+typedef struct RuleList {
+    u32  len;
+    Rule data[BUFFER_LEN];
+} RuleList;
+AIL_STATIC_ASSERT(BUFFER_LEN <= 64); // Sets of dirs/rules are stored as u64 bitmasks
+
+#include "timer.c"
+#include "term.c"
+#include "log.c"
+#include "reactor.c"
+#include "control.c"
+#include "runlog.c"
+#include "filter.c"
+#include "plan.c"
+#include "subproc.c"
+#include "zygote.c"
+#include "limits.c"
+#include "changes.c"
+#include "jobserver.c"
+#include "throttle.c"
+#include "worker.c"
+#include "server.c"
+#include "history.c"
+#include "cache.c"
+#include "self.c"
+#include "trace.c"
+#include "deps.c"
+#include "exec.c"
+#include "bench.c"
+
 #endif // _HEADER_H
@@ -0,0 +1,121 @@
+#include "header.h"
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <direct.h>
+#   define history_getcwd _getcwd
+#else
+#   include <unistd.h>
+#   define history_getcwd getcwd
+#endif
+
+#ifndef HISTORY_WEIGHT
+#   define HISTORY_WEIGHT 0.3 // Weight of the latest duration in the moving average of a command's durations
+#endif
+
+// Moving average of the durations of a command
+typedef struct HistoryEntry {
+    u64 key;
+    f64 avg_ms;
+    u32 count;
+} HistoryEntry;
+AIL_DA_INIT(HistoryEntry);
+
+global AIL_DA(HistoryEntry) history_entries;
+global char                 history_path[1024];
+global char                 history_cwd[1024];
+global b32                  history_dirty;
+
+internal u64 history_hash(u64 hash, const char *s, u64 len)
+{
+    // 64-bit FNV-1a
+    for (u64 i = 0; i < len; i++) {
+        hash ^= (u8)s[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// The same command may do something else in a different directory, so the working directory is part of the key
+internal u64 history_key(const char *cmd)
+{
+    u64 hash = history_hash(0xcbf29ce484222325ull, history_cwd, strlen(history_cwd) + 1);
+    return history_hash(hash, cmd, strlen(cmd));
+}
+
+internal HistoryEntry *history_find(u64 key)
+{
+    for (u32 i = 0; i < history_entries.len; i++) {
+        if (history_entries.data[i].key == key) return &history_entries.data[i];
+    }
+    return NULL;
+}
+
+// Loads the durations of previous runs from `path` or, if it is NULL, from the user's cache directory
+internal void history_init(const char *path)
+{
+    history_entries = ail_da_new_t(HistoryEntry);
+    if (!history_getcwd(history_cwd, sizeof(history_cwd))) history_cwd[0] = 0;
+    if (path) snprintf(history_path, sizeof(history_path), "%s", path);
+    else {
+#if defined(_WIN32) || defined(__WIN32__)
+        char *dir = getenv("LOCALAPPDATA");
+        if (dir) snprintf(history_path, sizeof(history_path), "%s\\watch-exec-history", dir);
+#else
+        char *dir = getenv("XDG_CACHE_HOME");
+        if (dir && dir[0]) snprintf(history_path, sizeof(history_path), "%s/watch-exec-history", dir);
+        else if ((dir = getenv("HOME"))) snprintf(history_path, sizeof(history_path), "%s/.cache/watch-exec-history", dir);
+#endif
+    }
+    if (!history_path[0]) return;
+
+    FILE *f = fopen(history_path, "rb");
+    if (!f) return;
+    HistoryEntry entry;
+    unsigned long long key;
+    while (fscanf(f, "%llx %lf %u", &key, &entry.avg_ms, &entry.count) == 3) {
+        entry.key = key;
+        ail_da_push(&history_entries, entry);
+    }
+    fclose(f);
+}
+
+internal void history_save(void)
+{
+    if (!history_path[0] || !history_dirty) return;
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", history_path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        log_warn("Could not save durations of commands to '%s': %s", history_path, strerror(errno));
+        history_path[0] = 0; // Don't warn again after every run
+        return;
+    }
+    for (u32 i = 0; i < history_entries.len; i++) {
+        HistoryEntry *entry = &history_entries.data[i];
+        fprintf(f, "%016llx %.3f %u\n", (unsigned long long)entry->key, entry->avg_ms, entry->count);
+    }
+    fclose(f);
+    remove(history_path); // Windows doesn't allow renaming onto existing files
+    rename(tmp_path, history_path);
+    history_dirty = false;
+}
+
+internal void history_record(const char *cmd, u64 duration_ns)
+{
+    f64 ms = (f64)duration_ns/1e6;
+    u64 key = history_key(cmd);
+    HistoryEntry *entry = history_find(key);
+    if (!entry) ail_da_push(&history_entries, ((HistoryEntry){ .key = key, .avg_ms = ms, .count = 1 }));
+    else {
+        entry->avg_ms = HISTORY_WEIGHT*ms + (1 - HISTORY_WEIGHT)*entry->avg_ms;
+        entry->count++;
+    }
+    history_dirty = true;
+}
+
+// Returns the expected duration of the command in milliseconds or a negative number if the command never ran before
+internal f64 history_expected_ms(const char *cmd)
+{
+    HistoryEntry *entry = history_find(history_key(cmd));
+    return entry ? entry->avg_ms : -1;
+}
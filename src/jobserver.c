@@ -0,0 +1,163 @@
+#include "header.h"
+
+// With --jobserver, watch-exec acts as the jobserver of GNU make (4.4 or newer) and other tools supporting its protocol
+// (i.e. ninja 1.13 or newer), so that all commands running at the same time share a budget of n jobs, instead of each
+// of them using all cores. The tokens are bytes in a fifo, which is announced to the commands via MAKEFLAGS
+// ('-j<n> --jobserver-auth=fifo:<path>'). Only commands started with a token get it, workers and servers don't
+// Like make itself, watch-exec holds one implicit token, which is used by the first running command. Every further
+// command needs to take a token from the fifo before it's started and returns it once it exited
+// @Note: Tokens held by killed commands are lost, so the fifo is filled up again after a run was cancelled
+
+#if defined(_WIN32) || defined(__WIN32__)
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#endif
+
+global b32  jobserver_enabled;
+global u32  jobserver_tokens;      // Amount of tokens in the fifo while nothing is running, one less than the budget
+global int  jobserver_fd = -1;     // Opened for reading and writing, so that reading never reports the end of the file
+global char jobserver_path[1100];
+global b32  jobserver_implicit;    // Whether the implicit token is used by a running command
+global b32  jobserver_waiting;     // Whether the fifo is registered with the reactor, since a command waits for a token
+global char jobserver_makeflags[2048];
+global char *jobserver_orig_makeflags; // Value of MAKEFLAGS for all other commands
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+// @TODO: GNU make uses a named semaphore on Windows ('--jobserver-auth=<name>')
+internal b32 jobserver_init(u32 jobs)
+{
+    AIL_UNUSED(jobs);
+    log_err("Acting as a jobserver is not supported on Windows yet");
+    return false;
+}
+
+internal b32 jobserver_acquire(char *token)
+{
+    *token = 0;
+    return true;
+}
+
+internal void jobserver_release(char token)
+{
+    AIL_UNUSED(token);
+}
+
+internal void jobserver_handle(void)
+{
+}
+
+internal void jobserver_begin(void)
+{
+}
+
+internal void jobserver_end(void)
+{
+}
+
+internal void jobserver_refill(void)
+{
+}
+
+internal void jobserver_deinit(void)
+{
+}
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+internal void jobserver_refill(void)
+{
+    if (!jobserver_enabled) return;
+    char buf[256];
+    while (read(jobserver_fd, buf, sizeof(buf)) > 0) {}
+    memset(buf, '+', sizeof(buf));
+    for (u32 left = jobserver_tokens; left; ) {
+        ssize_t n = write(jobserver_fd, buf, AIL_MIN(left, sizeof(buf)));
+        if (n <= 0) break;
+        left -= (u32)n;
+    }
+}
+
+// Creates the fifo with the tokens for a budget of `jobs` jobs
+internal b32 jobserver_init(u32 jobs)
+{
+    snprintf(jobserver_path, sizeof(jobserver_path), "%s/jobserver", changes_tmp_base);
+    remove(jobserver_path);
+    if (mkfifo(jobserver_path, 0600) < 0) {
+        log_err("Could not create the jobserver's fifo '%s': %s", jobserver_path, strerror(errno));
+        return false;
+    }
+    jobserver_fd = open(jobserver_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (jobserver_fd < 0) {
+        log_err("Could not open the jobserver's fifo '%s': %s", jobserver_path, strerror(errno));
+        remove(jobserver_path);
+        return false;
+    }
+    jobserver_enabled = true;
+    jobserver_tokens  = jobs - 1;
+    jobserver_refill();
+    jobserver_orig_makeflags = getenv("MAKEFLAGS");
+    snprintf(jobserver_makeflags, sizeof(jobserver_makeflags), "%s -j%u --jobserver-auth=fifo:%s",
+             jobserver_orig_makeflags ? jobserver_orig_makeflags : "", jobs, jobserver_path);
+    return true;
+}
+
+// Announces the fifo to the next started process, which holds a token
+// jobserver_end needs to be called right after starting it, so that workers and servers don't take part
+internal void jobserver_begin(void)
+{
+    if (jobserver_enabled) subproc_set_env("MAKEFLAGS", jobserver_makeflags);
+}
+
+internal void jobserver_end(void)
+{
+    if (jobserver_enabled) subproc_set_env("MAKEFLAGS", jobserver_orig_makeflags);
+}
+
+// Takes a token for the next command, which is 0 for the implicit one
+// Returns false if no token is available, in which case the reactor reports once one was returned
+internal b32 jobserver_acquire(char *token)
+{
+    *token = 0;
+    if (!jobserver_enabled) return true;
+    if (!jobserver_implicit) {
+        jobserver_implicit = true;
+        return true;
+    }
+    if (read(jobserver_fd, token, 1) == 1) return true;
+    if (!jobserver_waiting) jobserver_waiting = reactor_add(jobserver_fd, REACTOR_JOBSERVER, 0);
+    return false;
+}
+
+internal void jobserver_release(char token)
+{
+    if (!jobserver_enabled) return;
+    if (!token) jobserver_implicit = false;
+    else if (write(jobserver_fd, &token, 1) != 1) log_warn("Could not return a token to the jobserver: %s", strerror(errno));
+}
+
+// Stops waiting for tokens, since commands waiting for one are tried again anyways
+internal void jobserver_handle(void)
+{
+    if (!jobserver_waiting) return;
+    reactor_remove(jobserver_fd);
+    jobserver_waiting = false;
+}
+
+internal void jobserver_deinit(void)
+{
+    if (!jobserver_enabled) return;
+    close(jobserver_fd);
+    remove(jobserver_path);
+}
+
+#endif
@@ -0,0 +1,396 @@
+#include "header.h"
+
+// Keeps the commands from competing with the rest of the system and with watch-exec's own watcher thread:
+//   - With --cpu-max, --memory-max or --io-weight (or just --cgroup), each run gets its own cgroup v2 leaf with these
+//     limits, next to a leaf that watch-exec moves itself into. The CPU time and peak memory usage of the run are
+//     read from its cgroup and reported once it finished (Linux only)
+//   - With --nice and --ioprio, the commands run with a lower CPU and I/O priority
+// Since posix_spawn can't run any code in the child, the commands are started via watch-exec itself
+// ('watch-exec --launch <cgroup.procs> <nice> <ioprio> <command>...'), which applies the settings before executing
+// the command, so that none of the processes started by the command escape them
+// If any of these are given, the watcher thread is started with a nice value one below watch-exec's own, so that busy
+// commands don't delay noticing changes (Linux only, if the system allows it)
+// @Note: Workers and servers keep running across runs, so they're started without the launcher
+// watch-exec's own leaf is left behind, since it can only be removed after watch-exec exited
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <windows.h>
+#else
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <limits.h>
+#   include <sys/stat.h>
+#   include <sys/resource.h>
+#   if defined(__linux__)
+#       include <sys/syscall.h>
+#   endif
+#endif
+
+#define LIMITS_LAUNCH_FLAG "--launch"
+#define LIMITS_UNSET       "-"
+
+typedef struct Limits {
+    char *cpu_max;    // Value for cpu.max
+    char *memory_max; // Value for memory.max
+    u32   io_weight;  // Value for io.weight, 0 if not set
+    b32   cgroup;     // Whether each run gets its own cgroup, also without any of the limits above
+    b32   has_nice;
+    i32   nice;
+    u32   ioprio;     // Class and level as expected by ioprio_set, 0 if not set
+} Limits;
+
+global Limits      limits;
+global char        limits_base[1024];       // cgroup that watch-exec was started in, which the runs' cgroups are created in
+global char        limits_run_dir[1100];    // cgroup of the current run, empty if there is none
+global u32         limits_next_run = 1;
+global AIL_DA(str) limits_stale;            // cgroups of earlier runs, that still contained processes
+global char        limits_exe[1024];
+global char        limits_args[3][1200];    // Arguments of the launcher for the cgroup, nice value and I/O priority
+global str         limits_launcher[5];
+global u32         limits_launcher_len;     // 0 if the commands don't need to be started via the launcher
+
+internal b32 limits_use_cgroup(void)
+{
+    return limits.cgroup || limits.cpu_max || limits.memory_max || limits.io_weight;
+}
+
+internal b32 limits_used(void)
+{
+    return limits_use_cgroup() || limits.has_nice || limits.ioprio;
+}
+
+// Accepts a percentage of a single core (i.e. '150%') or the value of cpu.max ('<quota> [<period>]'),
+// which is only checked by the kernel
+internal b32 limits_parse_cpu_max(const char *s)
+{
+    u64 len = strlen(s);
+    if (len < 2 || s[len - 1] != '%') {
+        limits.cpu_max = strdup(s);
+        return true;
+    }
+    char *end;
+    f64 percent = strtod(s, &end);
+    if (end != s + len - 1 || percent < 0.001) return false;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%llu 100000", (unsigned long long)(percent*1000)); // Period of 100ms
+    limits.cpu_max = strdup(buf);
+    return true;
+}
+
+// Accepts 'idle', 'best-effort[:<level>]' or 'realtime[:<level>]' with levels from 0 (highest) to 7 (lowest)
+internal b32 limits_parse_ioprio(const char *s)
+{
+    static const char *classes[] = { "realtime", "best-effort", "idle" };
+    for (u32 i = 0; i < AIL_ARRLEN(classes); i++) {
+        u64 len = strlen(classes[i]);
+        if (strncmp(s, classes[i], len) || (s[len] && s[len] != ':')) continue;
+        u32 level = 4;
+        if (s[len] == ':') {
+            if (s[len + 1] < '0' || s[len + 1] > '7' || s[len + 2]) return false;
+            level = (u32)(s[len + 1] - '0');
+        }
+        limits.ioprio = ((i + 1) << 13) | (i == 2 ? 0 : level);
+        return true;
+    }
+    return false;
+}
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+internal b32 limits_init(const char *program)
+{
+    AIL_UNUSED(program);
+    if (!limits_used()) return true;
+    // @TODO: Runs could be placed in job objects, which support limits for CPU and memory as well
+    log_err("Limiting the resources of commands is not supported on Windows yet");
+    return false;
+}
+
+internal int limits_launch(int argc, char **argv)
+{
+    AIL_UNUSED(argc);
+    AIL_UNUSED(argv);
+    return 127;
+}
+
+internal void limits_run_begin(void)
+{
+}
+
+internal void limits_run_end(b32 cancelled)
+{
+    AIL_UNUSED(cancelled);
+}
+
+internal void limits_deinit(void)
+{
+}
+
+// @Note: Limits are rejected by limits_init on Windows, so the watcher always runs with the normal priority
+internal void limits_start_watcher(void)
+{
+    dmon_init();
+}
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+internal b32 limits_write(const char *dir, const char *file, const char *value)
+{
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    b32 ok = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+    close(fd);
+    return ok;
+}
+
+// Reads the file into buf and returns whether it existed
+internal b32 limits_read(const char *dir, const char *file, char *buf, u32 buf_len)
+{
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    ssize_t n = read(fd, buf, buf_len - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = 0;
+    return n > 0;
+}
+
+// Entry point of the launcher, that starts the commands
+internal int limits_launch(int argc, char **argv)
+{
+    if (argc < 6) {
+        fprintf(stderr, "watch-exec: Invalid usage of %s\n", LIMITS_LAUNCH_FLAG);
+        return 127;
+    }
+    if (strcmp(argv[2], LIMITS_UNSET)) {
+        int fd = open(argv[2], O_WRONLY | O_CLOEXEC);
+        if (fd < 0 || write(fd, "0", 1) != 1) fprintf(stderr, "watch-exec: Could not join the cgroup of the run: %s\n", strerror(errno));
+        if (fd >= 0) close(fd);
+    }
+    if (strcmp(argv[3], LIMITS_UNSET) && setpriority(PRIO_PROCESS, 0, atoi(argv[3])) < 0) {
+        fprintf(stderr, "watch-exec: Could not set the nice value: %s\n", strerror(errno));
+    }
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    if (strcmp(argv[4], LIMITS_UNSET) && syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, atoi(argv[4])) < 0) {
+        fprintf(stderr, "watch-exec: Could not set the I/O priority: %s\n", strerror(errno));
+    }
+#endif
+    execvp(argv[5], argv + 5);
+    fprintf(stderr, "watch-exec: Could not execute '%s': %s\n", argv[5], strerror(errno));
+    return 127;
+}
+
+#if defined(__linux__)
+// Finds the cgroup v2 hierarchy and the cgroup that watch-exec runs in
+internal b32 limits_find_cgroup(char *buf, u32 buf_len)
+{
+    char line[4096], mount[1024] = {0}, path[1024] = {0};
+    FILE *f = fopen("/proc/self/mountinfo", "rb");
+    while (f && !mount[0] && fgets(line, sizeof(line), f)) {
+        // '<id> <parent> <major:minor> <root> <mount point> <options> [<optional fields>] - <type> ...'
+        char *sep = strstr(line, " - ");
+        if (!sep || strncmp(sep + 3, "cgroup2 ", 8)) continue;
+        if (sscanf(line, "%*s %*s %*s %*s %1023s", mount) != 1) mount[0] = 0;
+    }
+    if (f) fclose(f);
+    f = fopen("/proc/self/cgroup", "rb");
+    while (f && !path[0] && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3)) continue;
+        line[strcspn(line, "\n")] = 0;
+        snprintf(path, sizeof(path), "%s", line + 3);
+    }
+    if (f) fclose(f);
+    if (!mount[0] || !path[0]) return false;
+    snprintf(buf, buf_len, "%s%s", mount, strcmp(path, "/") ? path : "");
+    return true;
+}
+
+// Moves watch-exec into its own leaf and enables the needed controllers for the leaves of the runs
+// @Note: Except for the root, cgroups with processes in them can't enable controllers for their children
+internal b32 limits_init_cgroup(void)
+{
+    if (!limits_find_cgroup(limits_base, sizeof(limits_base))) {
+        log_err("Could not find the cgroup v2 hierarchy, which is needed to limit the resources of runs");
+        return false;
+    }
+    char self_dir[1100], pid[32];
+    snprintf(self_dir, sizeof(self_dir), "%s/watch-exec-%d", limits_base, (int)getpid());
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    if ((mkdir(self_dir, 0755) < 0 && errno != EEXIST) || !limits_write(self_dir, "cgroup.procs", pid)) {
+        log_err("Could not move watch-exec into the cgroup '%s': %s", self_dir, strerror(errno));
+        log_err("Start watch-exec in its own delegated cgroup, i.e. with 'systemd-run --user --scope -p Delegate=yes watch-exec ...'");
+        return false;
+    }
+    char available[256] = {0};
+    limits_read(limits_base, "cgroup.controllers", available, sizeof(available));
+    struct { const char *name; b32 needed; } controllers[] = {
+        { "cpu",    limits.cpu_max != NULL },
+        { "memory", limits.memory_max != NULL },
+        { "io",     limits.io_weight != 0 },
+    };
+    for (u32 i = 0; i < AIL_ARRLEN(controllers); i++) {
+        char enable[16];
+        snprintf(enable, sizeof(enable), "+%s", controllers[i].name);
+        // @Note: The memory controller is enabled whenever possible, since it reports the peak memory usage of the runs
+        if (!strstr(available, controllers[i].name)) {
+            if (!controllers[i].needed) continue;
+            log_err("The %s controller isn't available in the cgroup '%s'", controllers[i].name, limits_base);
+            return false;
+        }
+        if (!limits_write(limits_base, "cgroup.subtree_control", enable) && controllers[i].needed) {
+            log_err("Could not enable the %s controller in the cgroup '%s': %s", controllers[i].name, limits_base, strerror(errno));
+            log_err("Start watch-exec in its own delegated cgroup, i.e. with 'systemd-run --user --scope -p Delegate=yes watch-exec ...'");
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+// Writes the limits into the cgroup and returns false if any of them couldn't be set
+internal b32 limits_apply(const char *dir)
+{
+    char weight[32];
+    snprintf(weight, sizeof(weight), "default %u", limits.io_weight);
+    if (limits.cpu_max && !limits_write(dir, "cpu.max", limits.cpu_max)) {
+        log_err("Could not set cpu.max to '%s': %s", limits.cpu_max, strerror(errno));
+        return false;
+    }
+    if (limits.memory_max && !limits_write(dir, "memory.max", limits.memory_max)) {
+        log_err("Could not set memory.max to '%s': %s", limits.memory_max, strerror(errno));
+        return false;
+    }
+    if (limits.io_weight && !limits_write(dir, "io.weight", weight)) {
+        log_err("Could not set io.weight to %u: %s", limits.io_weight, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Prepares the launcher and the cgroups, if any limits were given
+internal b32 limits_init(const char *program)
+{
+    if (!limits_used()) return true;
+#if defined(__linux__)
+    ssize_t n = readlink("/proc/self/exe", limits_exe, sizeof(limits_exe) - 1);
+    if (n > 0) limits_exe[n] = 0;
+    else snprintf(limits_exe, sizeof(limits_exe), "%s", program);
+    if (limits_use_cgroup()) {
+        if (!limits_init_cgroup()) return false;
+        // The limits are checked once up front, so that invalid values are reported right away
+        char test_dir[1100];
+        snprintf(test_dir, sizeof(test_dir), "%s/watch-exec-%d-run-0", limits_base, (int)getpid());
+        if (mkdir(test_dir, 0755) < 0 && errno != EEXIST) {
+            log_err("Could not create the cgroup '%s': %s", test_dir, strerror(errno));
+            return false;
+        }
+        b32 ok = limits_apply(test_dir);
+        rmdir(test_dir);
+        if (!ok) return false;
+    }
+#else
+    if (limits_use_cgroup() || limits.ioprio) {
+        log_err("Limiting the resources or the I/O priority of commands is only supported on Linux");
+        return false;
+    }
+    char *exe = strchr(program, '/') ? (char *)program : subproc_resolve(program);
+    if (!exe || !realpath(exe, limits_exe)) {
+        log_err("Could not find the executable of watch-exec, that starts the commands with a different nice value");
+        return false;
+    }
+#endif
+    snprintf(limits_args[0], sizeof(limits_args[0]), LIMITS_UNSET);
+    if (limits.has_nice) snprintf(limits_args[1], sizeof(limits_args[1]), "%d", limits.nice);
+    else                 snprintf(limits_args[1], sizeof(limits_args[1]), LIMITS_UNSET);
+    if (limits.ioprio)   snprintf(limits_args[2], sizeof(limits_args[2]), "%u", limits.ioprio);
+    else                 snprintf(limits_args[2], sizeof(limits_args[2]), LIMITS_UNSET);
+    limits_launcher[0]  = limits_exe;
+    limits_launcher[1]  = LIMITS_LAUNCH_FLAG;
+    limits_launcher[2]  = limits_args[0];
+    limits_launcher[3]  = limits_args[1];
+    limits_launcher[4]  = limits_args[2];
+    limits_launcher_len = AIL_ARRLEN(limits_launcher);
+    limits_stale = ail_da_new_t(str);
+    return true;
+}
+
+// Creates the cgroup for the next run, that its commands are placed in by the launcher
+internal void limits_run_begin(void)
+{
+    if (!limits_base[0]) return;
+    for (u32 i = 0; i < limits_stale.len; ) {
+        if (rmdir(limits_stale.data[i]) < 0 && errno == EBUSY) i++;
+        else {
+            free(limits_stale.data[i]);
+            limits_stale.data[i] = limits_stale.data[--limits_stale.len];
+        }
+    }
+    snprintf(limits_run_dir, sizeof(limits_run_dir), "%s/watch-exec-%d-run-%u", limits_base, (int)getpid(), limits_next_run++);
+    if ((mkdir(limits_run_dir, 0755) < 0 && errno != EEXIST) || !limits_apply(limits_run_dir)) {
+        log_warn("Could not create the cgroup '%s', so the commands run without limits: %s", limits_run_dir, strerror(errno));
+        rmdir(limits_run_dir);
+        limits_run_dir[0] = 0;
+        snprintf(limits_args[0], sizeof(limits_args[0]), LIMITS_UNSET);
+        return;
+    }
+    snprintf(limits_args[0], sizeof(limits_args[0]), "%s/cgroup.procs", limits_run_dir);
+}
+
+// Reports the resource usage of the run and removes its cgroup
+internal void limits_run_end(b32 cancelled)
+{
+    if (!limits_run_dir[0]) return;
+    char buf[4096];
+    if (!cancelled && limits_read(limits_run_dir, "cpu.stat", buf, sizeof(buf))) {
+        char *usage = strstr(buf, "usage_usec ");
+        f64 cpu_s = usage ? (f64)strtoull(usage + 11, NULL, 10)/1e6 : 0;
+        if (limits_read(limits_run_dir, "memory.peak", buf, sizeof(buf))) {
+            f64 peak_mib = (f64)strtoull(buf, NULL, 10)/(1024.0*1024.0);
+            log_info("The run used %.2fs of CPU time and %.1f MiB of memory at most", cpu_s, peak_mib);
+            runlog_printf("### The run used %.2fs of CPU time and %.1f MiB of memory at most\n", cpu_s, peak_mib);
+        } else {
+            log_info("The run used %.2fs of CPU time", cpu_s);
+            runlog_printf("### The run used %.2fs of CPU time\n", cpu_s);
+        }
+    }
+    // @Note: Processes, that the commands left behind, keep the cgroup alive until they exit
+    if (rmdir(limits_run_dir) < 0 && errno == EBUSY) ail_da_push(&limits_stale, strdup(limits_run_dir));
+    limits_run_dir[0] = 0;
+    snprintf(limits_args[0], sizeof(limits_args[0]), LIMITS_UNSET);
+}
+
+internal void limits_deinit(void)
+{
+    for (u32 i = 0; i < limits_stale.len; i++) rmdir(limits_stale.data[i]);
+}
+
+// Linux keeps a nice value per thread, which new threads inherit, so the main thread lowers its own around starting the watcher
+// @Note: Lowering the nice value needs privileges (i.e. CAP_SYS_NICE or a high enough RLIMIT_NICE), so failing is fine
+internal void limits_start_watcher(void)
+{
+#if defined(__linux__)
+    if (limits_used()) {
+        id_t tid = (id_t)syscall(SYS_gettid);
+        errno = 0;
+        int prio = getpriority(PRIO_PROCESS, tid);
+        if (!errno && prio > -20 && !setpriority(PRIO_PROCESS, tid, prio - 1)) {
+            dmon_init();
+            setpriority(PRIO_PROCESS, tid, prio);
+            return;
+        }
+    }
+#endif
+    dmon_init();
+}
+
+#endif
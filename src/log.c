@@ -1,6 +1,13 @@
 #include "header.h"
 
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <windows.h>
+#else
+#   include <time.h>
+#endif
+
 global TermState log_term_state;
+global b32       log_structured; // Lines start with a timestamp and their level instead of being colored, i.e. when running headless
 
 internal void log_init(void)
 {
@@ -13,13 +20,45 @@ internal void log_deinit(void)
 	term_set_state(log_term_state);
 }
 
+// Writes the current time in UTC as in ISO 8601 (i.e. "2024-01-31T12:34:56.789Z")
+internal void log_timestamp(char *buf, u32 buf_len)
+{
+#if defined(_WIN32) || defined(__WIN32__)
+    SYSTEMTIME t;
+    GetSystemTime(&t);
+    snprintf(buf, buf_len, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", t.wYear, t.wMonth, t.wDay, t.wHour, t.wMinute, t.wSecond, t.wMilliseconds);
+#else
+    struct timespec ts;
+    struct tm t;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gmtime_r(&ts.tv_sec, &t);
+    snprintf(buf, buf_len, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, (int)(ts.tv_nsec/1000000));
+#endif
+}
+
+internal void log_begin(const char *level, const char *color)
+{
+    if (log_structured) {
+        char ts[32];
+        log_timestamp(ts, sizeof(ts));
+        printf("%s %-5s ", ts, level);
+    } else {
+        printf("%s[%s]: ", color, level);
+    }
+}
+
+internal void log_end(b32 colored)
+{
+    fputs(colored && !log_structured ? "\x1b[0m\n" : "\n", stdout);
+}
+
 AIL_PRINTF_FORMAT(1, 2)
 internal void log_err(char *format, ...) {
     va_list args;
     va_start(args, format);
-    fputs("\x1b[31m[ERROR]: ", stdout);
+    log_begin("ERROR", "\x1b[31m");
     vprintf(format, args);
-    fputs("\x1b[0m\n", stdout);
+    log_end(true);
     va_end(args);
 }
 
@@ -27,9 +66,9 @@ AIL_PRINTF_FORMAT(1, 2)
 internal void log_warn(char *format, ...) {
     va_list args;
     va_start(args, format);
-    fputs("\x1b[33m[WARN]: ", stdout);
+    log_begin("WARN", "\x1b[33m");
     vprintf(format, args);
-    fputs("\x1b[0m\n", stdout);
+    log_end(true);
     va_end(args);
 }
 
@@ -37,9 +76,9 @@ AIL_PRINTF_FORMAT(1, 2)
 internal void log_info(char *format, ...) {
     va_list args;
     va_start(args, format);
-    fputs("[INFO]: ", stdout);
+    log_begin("INFO", "");
     vprintf(format, args);
-    fputs("\n", stdout);
+    log_end(false);
     va_end(args);
 }
 
@@ -47,8 +86,8 @@ AIL_PRINTF_FORMAT(1, 2)
 internal void log_succ(char *format, ...) {
     va_list args;
     va_start(args, format);
-    fputs("\x1b[32m[SUCC]: ", stdout);
+    log_begin("SUCC", "\x1b[32m");
     vprintf(format, args);
-    fputs("\x1b[0m\n", stdout);
+    log_end(true);
     va_end(args);
 }
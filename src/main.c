@@ -1,8 +1,28 @@
 #include "header.h"
 
-global StrList   dirs;
-global RegexList regexs;
-global CmdList   cmds;
+#ifndef DEFAULT_DEBOUNCE_MS
+#   define DEFAULT_DEBOUNCE_MS 50
+#endif
+#ifndef DEFAULT_LOG_MAX_SIZE_MB
+#   define DEFAULT_LOG_MAX_SIZE_MB 16
+#endif
+#ifndef DEFAULT_KILL_GRACE_MS
+#   define DEFAULT_KILL_GRACE_MS 2000
+#endif
+#ifndef DEFAULT_MAX_DEFER_MS
+#   define DEFAULT_MAX_DEFER_MS 60000
+#endif
+#ifndef DEFAULT_READY_TIMEOUT_MS
+#   define DEFAULT_READY_TIMEOUT_MS 5000
+#endif
+#ifndef DEFAULT_LOG_KEEP
+#   define DEFAULT_LOG_KEEP 10
+#endif
+
+global StrList  dirs;
+global RuleList rules;
+global u32      debounce_ms = DEFAULT_DEBOUNCE_MS;
+global ExecRun  run;
 
 internal void print_help(char *program)
 {
@@ -16,6 +36,7 @@ internal void print_help(char *program)
     printf("  3. %s [<flag>]+\n", program);
     printf("\n");
     printf("Usage options 3 allows providing several directories/match-strings/commands\n");
+    printf("and splitting them into groups, so that each change only runs the commands it concerns\n");
     printf("\n");
     printf("When using option 3, the following syntax variants are available for specifying options:\n");
     printf("  1. <flag>=<value>\n");
@@ -24,11 +45,96 @@ internal void print_help(char *program)
     printf("The ordering of options doesn't matter except for the order of commands\n");
     printf("All commands are executed in the order that they are provided in when the specified files are changed\n");
     printf("\n");
+    printf("The flag --group starts a new group. All following directories, patterns and commands belong to this group\n");
+    printf("When a file changes, only the commands of the groups, whose directories and patterns match the file, are executed\n");
+    printf("Groups without their own directories or patterns use the ones given before the first --group\n");
+    printf("\n");
+    printf("By default, each command of a group runs after the previous one succeeded\n");
+    printf("With --after, a command instead runs as soon as the given commands of its group succeeded,\n");
+    printf("so that independent commands can run at the same time. A bare --after lets the command start immediately\n");
+    printf("If a command fails, only the commands depending on it are skipped\n");
+    printf("\n");
+    printf("Commands are split into their arguments once at startup and run without a shell, but understand part of its syntax:\n");
+    printf("  - '...' and \"...\" quote arguments, a backslash quotes the next character\n");
+    printf("  - 'NAME=value' in front of a program sets the environment variable only for it\n");
+    printf("  - 'a | b' passes the output of a to b, 'a && b' runs b if a succeeded, 'a || b' if it failed and 'a ; b' always\n");
+    printf("Variables, globs and redirections aren't supported, commands needing them can run via \"sh -c '...'\" instead\n");
+    printf("\n");
+    printf("Commands receive information about the files, that were changed since they ran last:\n");
+    printf("  - '{files}':           This argument is replaced by the changed files that still exist\n");
+    printf("                         The command is run several times if the files don't fit into a single command line\n");
+    printf("                         If no files were changed (i.e. when rerunning manually), the command is skipped\n");
+    printf("  - WATCH_EXEC_CHANGED:  Environment variable containing the changed files that still exist, separated by newlines\n");
+    printf("                         It is unset if the list would be too long for the environment\n");
+    printf("  - WATCH_EXEC_MANIFEST: Environment variable containing the path to a file, that lists every change on its own line:\n");
+    printf("                         '<create|modify|delete|rename>\\t<path>[\\t<old path>]'\n");
+    printf("\n");
     printf("Option flags:\n");
     printf("  -d|--dir:     Directory to match files inside of\n");
     printf("  -g|--glob:    Glob pattern to match file-names against\n");
     printf("  -r|--regex:   Regular Expression to match file-names against\n");
     printf("  -c|--cmd:     Command to execute when a matching file was changed\n");
+    printf("  -G|--group:   Start a new group of directories/patterns/commands\n");
+    printf("  --stdin-files: Provide the changed files of the group as stdin to its commands\n");
+    printf("  --each[=<n>]: Run the preceding command once per changed file (or per chunk of n files) in parallel\n");
+    printf("                The files replace the '{files}' argument or are appended to the command\n");
+    printf("  --worker[=<protocol>]: Keep the preceding command running and send it the changed files of each run via stdin\n");
+    printf("                'lines' (default): One file per line, followed by an empty line\n");
+    printf("                'length': The length of the list in bytes on its own line, followed by the files, each terminated by a NUL byte\n");
+    printf("                The command needs to print a line '%s [<exit code>]' once it finished handling the files\n", SUBPROC_MARKER);
+    printf("  --server:     Keep the preceding command running after the run, until its next instance is ready\n");
+    printf("                The command reports that it is ready by sending 'READY=1' to the socket in NOTIFY_SOCKET (see sd_notify)\n");
+    printf("  --ready-timeout: Milliseconds after which a new instance of the preceding server counts as ready without reporting it\n");
+    printf("                (default: %d, 0 waits until it reports it), implies --server\n", DEFAULT_READY_TIMEOUT_MS);
+    printf("  --listen:     Address ('[<host>:]<port>') to listen on for the preceding server, passed to it as fd 3 (see sd_listen_fds)\n");
+    printf("  --cache:      Skip the preceding command if it succeeded before for the same content of its group's files\n");
+    printf("                Its output from back then is printed instead, so it shouldn't be used for commands that create files\n");
+    printf("  --cache-dir:  Directory to store the output of cached commands in (default: watch-exec-cache in the user's cache directory)\n");
+    printf("  --trace:      Only rerun the preceding command if it read one of the changed files the last time it succeeded\n");
+    printf("                The files are recorded by preloading %s into the command (Linux only)\n", TRACE_LIB_NAME);
+    printf("  --trace-lib:  Path to %s (default: next to the executable)\n", TRACE_LIB_NAME);
+    printf("  --deps:       Depfiles, directories containing depfiles or compile_commands.json files of the preceding command\n");
+    printf("                It only runs if one of the changed files is a dependency in them or is new, with the affected targets in WATCH_EXEC_TARGETS\n");
+    printf("  --min-interval: Milliseconds that need to pass between two starts of the preceding command, optionally followed by an edge:\n");
+    printf("                'leading': Start it right away and ignore further changes during the interval\n");
+    printf("                'trailing': Start it once the interval is over with all changes made during it\n");
+    printf("                By default, both are used\n");
+    printf("  --timeout:    Milliseconds after which each invocation of the preceding command is stopped together with all processes it started\n");
+    printf("  --idle-timeout: Milliseconds without any output after which each invocation of the preceding command is stopped\n");
+    printf("  --name:       Name of the preceding command to refer to it in --after (default: the command itself)\n");
+    printf("  --after:      Names of commands, given before the preceding command, that need to succeed before it runs\n");
+    printf("  -j|--jobs:    Maximum amount of commands running at the same time (default: amount of cores)\n");
+    printf("  --jobserver[=<n>]: Act as a jobserver for make and ninja, so that all running commands share n jobs (default: amount of cores)\n");
+    printf("                The jobserver is passed to the commands (but not to workers and servers) via MAKEFLAGS (needs GNU make 4.4 or ninja 1.13)\n");
+    printf("  --history:    File to store the durations of previous runs in (default: watch-exec-history in the user's cache directory)\n");
+    printf("                They are used to start the commands holding up a run the most first\n");
+    printf("  --log-dir:    Directory to additionally write the output of each run into, one log file per run\n");
+    printf("  --log-max-size: Size in MiB after which a run's log is continued in a new file (default: %d, 0 disables it)\n", DEFAULT_LOG_MAX_SIZE_MB);
+    printf("  --log-keep:   Amount of the newest log files to keep, older ones are deleted (default: %d, 0 keeps all)\n", DEFAULT_LOG_KEEP);
+    printf("  --bench-spawn[=<n>]: Measure how long starting the first command takes on average over n runs (default: 1000) and exit\n");
+    printf("  --bench-filter[=<n>]: Measure the throughput of filtering n MiB (default: 256) of command output and exit\n");
+    printf("  --kill-grace: Milliseconds that cancelled commands get to stop before they're killed (default: %d)\n", DEFAULT_KILL_GRACE_MS);
+    printf("  --no-restart: Wait for running commands to finish instead of restarting them when files change\n");
+    printf("  --max-pressure: Defer runs while the pressure of a resource is above a share, i.e. 'cpu=50%%' or 'io=20%%' (Linux only)\n");
+    printf("                The pressure is the share of time that tasks were stalled waiting for the cpu, memory or io (see /proc/pressure)\n");
+    printf("  --max-defer:  Milliseconds after which a deferred run starts anyways (default: %d, 0 waits for the pressure to drop)\n", DEFAULT_MAX_DEFER_MS);
+    printf("  --cgroup:     Run the commands of each run in their own cgroup and report their CPU time and memory usage (Linux only)\n");
+    printf("                watch-exec needs to be started in a delegated cgroup, i.e. via 'systemd-run --user --scope -p Delegate=yes'\n");
+    printf("  --cpu-max:    CPU time that each run may use, in percent of a core ('150%%') or as cpu.max ('<quota> <period>'), implies --cgroup\n");
+    printf("  --memory-max: Memory that each run may use (i.e. '4G'), implies --cgroup\n");
+    printf("  --io-weight:  I/O weight of each run from 1 to 10000 (default: 100), implies --cgroup\n");
+    printf("  --nice:       Nice value from -20 to 19 to run the commands with, given as '--nice 10' or '--nice=-5'\n");
+    printf("  --ioprio:     I/O priority to run the commands with: 'idle', 'best-effort[:<0-7>]' or 'realtime[:<0-7>]' (Linux only)\n");
+    printf("  --allow-self-trigger: Run commands for changes, that the commands made themselves, too\n");
+    printf("                By default, every command runs with %s in LD_PRELOAD (Linux only), which records the files it writes\n", TRACE_LIB_NAME);
+    printf("                Without the library, all changes are ignored while commands run with --no-restart\n");
+    printf("  --pty:        Run the commands in a pseudo-terminal, so that they print colors and flush their output right away (Linux only)\n");
+    printf("  --zygote:     Start the commands from a helper process forked at startup, so that starting them stays fast\n");
+    printf("                no matter how much memory watch-exec uses (compare with --bench-spawn)\n");
+    printf("  --headless:   Don't use the terminal, which is the default if stdin isn't a terminal\n");
+    printf("                Each line of output starts with a timestamp and its kind (INFO, WARN, ERROR, SUCC or OUT), SIGHUP reruns all commands\n");
+    printf("  --control:    Fifo to read commands from, one per line: 'run', 'cancel' or 'quit'\n");
+    printf("  --debounce:   Milliseconds without further changes to wait for before running commands (default: %d)\n", DEFAULT_DEBOUNCE_MS);
     printf("  -h|--help:    Show this help message\n");
     printf("  -v|--version: Show the program's version\n");
     printf("\n");
@@ -58,7 +164,7 @@ internal void print_help(char *program)
     printf("\n");
     printf("While the program is running, you use the following commands:\n");
     printf("- 'q': quit the program\n");
-    printf("- 'r': rerun all commands immediately\n");
+    printf("- 'r': rerun the commands of all groups immediately\n");
 }
 
 internal void print_version(char *program)
@@ -91,33 +197,163 @@ internal void log_ail_pm_comp_err(AIL_PM_Exp_Type exp_type, AIL_PM_Err err, cons
     if (show_idx) log_err("   %*c", err.idx, '^');
 }
 
-internal void run_cmds(void)
+// Marks the directory as watched by the rule, adding it to the global list of watched directories if necessary
+internal b32 add_dir(Rule *rule, char *dir, char *program)
 {
-    for (u32 i = 0; i < cmds.len; i++) {
-        SubProcRes proc = subproc_exec(&cmds.cmds[i], cmds.data[i], ail_default_allocator);
-        if (!proc.finished) {
-            log_err("'%s' couldn't be executed properly", cmds.data[i]);
-            break;
-        } else if (proc.exitCode) {
-            log_warn("'%s' failed with exit Code %d", cmds.data[i], proc.exitCode);
-            break;
-        } else {
-            log_succ("'%s' ran successfully", cmds.data[i]);
+    for (u32 i = 0; i < dirs.len; i++) {
+        if (!strcmp(dirs.data[i], dir)) {
+            rule->dirs |= 1ull << i;
+            return true;
+        }
+    }
+    if (dirs.len == BUFFER_LEN) {
+        log_err("Invalid Usage: At most %d directories are supported", BUFFER_LEN);
+        printf("See detailed usage info by running `%s --help`\n", program);
+        return false;
+    }
+    list_push(dirs, dir);
+    rule->dirs |= 1ull << (dirs.len - 1);
+    return true;
+}
+
+// By default, a command runs after the previous command of its group succeeded
+internal b32 add_cmd(Rule *rule, char *cmd, char *program)
+{
+    if (rule->cmds.len == BUFFER_LEN) {
+        log_err("Invalid Usage: At most %d commands per group are supported", BUFFER_LEN);
+        printf("See detailed usage info by running `%s --help`\n", program);
+        return false;
+    }
+    u64 after = rule->cmds.len ? 1ull << (rule->cmds.len - 1) : 0;
+    list_push(rule->cmds, ((Cmd){ .str = cmd, .name = cmd, .after = after, .ready_timeout = DEFAULT_READY_TIMEOUT_MS }));
+    return true;
+}
+
+internal i32 find_cmd(Rule *rule, const char *name)
+{
+    for (u32 i = 0; i < rule->cmds.len; i++) {
+        if (!strcmp(rule->cmds.data[i].name, name)) return i;
+    }
+    return -1;
+}
+
+internal b32 add_pattern(RegexList *regexs, char *pattern, AIL_PM_Exp_Type exp_type, char *program)
+{
+    if (regexs->len == BUFFER_LEN) {
+        log_err("Invalid Usage: At most %d patterns per group are supported", BUFFER_LEN);
+        printf("See detailed usage info by running `%s --help`\n", program);
+        return false;
+    }
+    AIL_SV arg = ail_sv_from_cstr(pattern);
+    AIL_PM_Comp_Res comp_res = ail_pm_compile_sv_a(arg, exp_type, ail_default_allocator);
+    if (comp_res.failed) {
+        log_ail_pm_comp_err(exp_type, comp_res.err, arg.str);
+        return false;
+    }
+    list_push(*regexs, comp_res.pattern);
+    return true;
+}
+
+// Checks whether `arg` is the flag with the given short or long name, optionally followed by '=<value>'
+internal b32 is_flag(AIL_SV arg, AIL_SV short_name, AIL_SV long_name)
+{
+    AIL_SV names[] = { short_name, long_name };
+    for (u32 i = 0; i < AIL_ARRLEN(names); i++) {
+        if (ail_sv_starts_with(arg, names[i]) && (arg.len == names[i].len || arg.str[names[i].len] == '=')) return true;
+    }
+    return false;
+}
+
+internal b32 is_long_flag(AIL_SV arg, AIL_SV name)
+{
+    return is_flag(arg, name, name);
+}
+
+// Collects the values of the flag at argv[*i], which are either given as '<flag>=<value>' or as the following non-flag arguments
+// Afterwards *i is the index of the next flag
+internal b32 get_flag_values(i32 argc, char **argv, i32 *i, StrList *vals, char *program)
+{
+    char *flag = argv[*i];
+    AIL_SV arg = ail_sv_from_cstr(argv[*i]);
+    if (ail_sv_find_char(arg, '=') >= 0) {
+        ail_sv_split_next_char(&arg, '=', true);
+        if (!arg.len) {
+            log_err("Expected a value after the equals sign in '%s'", argv[*i]);
+            printf("See detailed usage info by running `%s --help`\n", program);
+            return false;
+        }
+        list_push(*vals, (char*)arg.str);
+        (*i)++;
+    } else {
+        for (++(*i); *i < argc && argv[*i][0] != '-'; (*i)++) {
+            if (vals->len == BUFFER_LEN) {
+                log_err("Invalid Usage: At most %d values can be given to '%s' at once", BUFFER_LEN, flag);
+                printf("See detailed usage info by running `%s --help`\n", program);
+                return false;
+            }
+            list_push(*vals, argv[*i]);
         }
     }
+    return true;
+}
+
+// Flags that modify a command need to be given after the command they apply to
+internal b32 check_cmd_given(Rule *rule, char *flag, char *program)
+{
+    if (rule->cmds.len) return true;
+    log_err("'%s' needs to be given after the command it applies to", flag);
+    printf("See detailed usage info by running `%s --help`\n", program);
+    return false;
+}
+
+internal b32 parse_u32(const char *s, u32 *out)
+{
+    char *end;
+    errno = 0;
+    unsigned long n = strtoul(s, &end, 10);
+    if (errno || end == s || *end || n > UINT32_MAX) return false;
+    *out = (u32)n;
+    return true;
+}
+
+internal u64 all_rules_mask(void)
+{
+    return rules.len == 64 ? ~0ull : (1ull << rules.len) - 1;
+}
+
+// Starts a run for the batch, after cancelling the current run, whose changes are then handled by the new run as well
+internal void start_run(Batch batch)
+{
+    // @Note: A batch without any groups only runs the commands whose pending changes are due (see throttle.c)
+    throttle_only = !batch.rules;
+    throttle_take(&batch);
+    if (run.active) {
+        Batch cancelled = exec_run_cancel(&run);
+        changes_combine(&cancelled, &batch);
+        batch = cancelled;
+        log_info("Restarting the commands...");
+    }
+    exec_run_start(&run, batch, &rules);
+}
+
+internal void run_all(void)
+{
+    Batch batch = { .changes = ail_da_new_t(Change), .rules = all_rules_mask() };
+    start_run(batch);
 }
 
 internal void watch_callback(dmon_watch_id watch_id, dmon_action action, const char* root_dir, const char* filepath, const char* oldfilepath, void* user_data)
 {
-    AIL_UNUSED(user_data);
     AIL_UNUSED(watch_id);
-    AIL_SV fpath_sv = ail_sv_from_cstr((char*)filepath);
-    b32 matched = regexs.len == 0;
-    for (u32 i = 0; !matched && i < regexs.len; i++) {
-        matched = ail_pm_matches_sv(regexs.data[i], fpath_sv);
-        if (oldfilepath) matched |= ail_pm_matches_sv(regexs.data[i], fpath_sv);
+    cache_note((u32)(uintptr_t)user_data, filepath, oldfilepath);
+    u64 dir  = 1ull << (uintptr_t)user_data;
+    u64 mask = 0;
+    for (u32 i = 0; i < rules.len; i++) {
+        Rule *rule = &rules.data[i];
+        if (!(rule->dirs & dir)) continue;
+        if (rule_matches(rule, filepath) || (oldfilepath && rule_matches(rule, oldfilepath))) mask |= 1ull << i;
     }
-    if (!matched) return;
+    if (!mask) return;
 
     switch (action) {
         case DMON_ACTION_CREATE:
@@ -133,105 +369,380 @@ internal void watch_callback(dmon_watch_id watch_id, dmon_action action, const c
             log_info("Renamed %s%s to %s%s...", root_dir, oldfilepath, root_dir, filepath);
             break;
     }
-    run_cmds();
+    changes_push(action, root_dir, filepath, oldfilepath, mask);
 }
 
 int main(int argc, char **argv)
 {
     AIL_ASSERT(argc > 0);
     char *program = argv[0];
+    if (argc > 1 && !strcmp(argv[1], LIMITS_LAUNCH_FLAG)) return limits_launch(argc, argv);
     if (argc == 1) {
         log_err("Invalid Usage: Too few arguments");
         print_help(program);
         return 1;
     }
 
+    u32 max_jobs = 0;
+    u32 jobserver_jobs = 0;
+    b32 jobserver = false;
+    u32 bench_spawn_runs = 0;
+    u32 bench_filter_mib = 0;
+    u32 kill_grace_ms = DEFAULT_KILL_GRACE_MS;
+    u32 max_defer_ms = DEFAULT_MAX_DEFER_MS;
+    b32 restart = true;
+    b32 headless = false;
+    b32 pty = false;
+    b32 zygote = false;
+    char *control_path = NULL;
+    char *history_file = NULL;
+    char *cache_dir = NULL;
+    b32 uses_cache = false;
+    char *trace_lib_path = NULL;
+    b32 uses_trace = false;
+    b32 allow_self_trigger = false;
+    char *log_dir = NULL;
+    u32 log_max_size_mb = DEFAULT_LOG_MAX_SIZE_MB;
+    u32 log_keep = DEFAULT_LOG_KEEP;
+    rules.len = 1;
     if (argv[1][0] == '-') { // Flags are used in command line options (Usage variant 3)
         for (i32 i = 1; i < argc; ) {
             AIL_SV arg = ail_sv_from_cstr(argv[i]);
-            // @Cleanup: Lots of code duplication, but couldn't figure out how to compress it nicely ¯\_(ツ)_/¯
-            if (ail_sv_starts_with(arg, SV_LIT_T("-d")) || ail_sv_starts_with(arg, SV_LIT_T("--dir"))) {
-                i64 _eq_idx = ail_sv_find_char(arg, '=');
-                if (_eq_idx >= 0) {
-                    ail_sv_split_next_char(&arg, '=', true);
-                    if (!arg.len) {
-                        log_err("Expected a value after the equals sign in '%s'", argv[i]);
+            Rule *rule = &rules.data[rules.len - 1];
+            StrList vals = {0};
+            if (is_flag(arg, SV_LIT_T("-d"), SV_LIT_T("--dir"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                for (u32 j = 0; j < vals.len; j++) {
+                    if (!add_dir(rule, vals.data[j], program)) return 1;
+                }
+            } else if (is_flag(arg, SV_LIT_T("-g"), SV_LIT_T("--glob"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                for (u32 j = 0; j < vals.len; j++) {
+                    if (!add_pattern(&rule->regexs, vals.data[j], AIL_PM_EXP_GLOB, program)) return 1;
+                }
+            } else if (is_flag(arg, SV_LIT_T("-r"), SV_LIT_T("--regex"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                for (u32 j = 0; j < vals.len; j++) {
+                    if (!add_pattern(&rule->regexs, vals.data[j], AIL_PM_EXP_REGEX, program)) return 1;
+                }
+            } else if (is_flag(arg, SV_LIT_T("-c"), SV_LIT_T("--cmd"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                for (u32 j = 0; j < vals.len; j++) {
+                    if (!add_cmd(rule, vals.data[j], program)) return 1;
+                }
+            } else if (is_flag(arg, SV_LIT_T("-G"), SV_LIT_T("--group"))) {
+                if (rule->dirs || rule->regexs.len || rule->cmds.len) {
+                    if (rules.len == BUFFER_LEN) {
+                        log_err("Invalid Usage: At most %d groups are supported", BUFFER_LEN);
                         printf("See detailed usage info by running `%s --help`\n", program);
-                    } else {
-                        list_push(dirs, (char*)arg.str);
-                    }
-                } else {
-                    for (++i; i < argc && argv[i][0] != '-'; i++) {
-                        list_push(dirs, argv[i]);
+                        return 1;
                     }
+                    rules.len++;
                 }
-            } else if (ail_sv_starts_with(arg, SV_LIT_T("-g")) || ail_sv_starts_with(arg, SV_LIT_T("--glob"))) {
-                i64 _eq_idx = ail_sv_find_char(arg, '=');
-                if (_eq_idx >= 0) {
-                    ail_sv_split_next_char(&arg, '=', true);
-                    if (!arg.len) {
-                        log_err("Expected a value after the equals sign in '%s'", argv[i]);
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--stdin-files"))) {
+                rule->stdin_files = true;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--each"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                u32 n = 1;
+                if (ail_sv_find_char(arg, '=') >= 0) {
+                    if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                    if (!parse_u32(vals.data[0], &n) || !n) {
+                        log_err("Expected a positive amount of files for '%s'", argv[i - 1]);
                         printf("See detailed usage info by running `%s --help`\n", program);
-                    } else {
-                        AIL_PM_Comp_Res comp_res = ail_pm_compile_sv_a(arg, AIL_PM_EXP_GLOB, ail_default_allocator);
-                        if (comp_res.failed) {
-                            log_ail_pm_comp_err(AIL_PM_EXP_GLOB, comp_res.err, arg.str);
-                            return 1;
-                        } else list_push(regexs, comp_res.pattern);
+                        return 1;
                     }
-                } else {
-                    for (++i; i < argc && argv[i][0] != '-'; i++) {
-                        AIL_SV a = ail_sv_from_cstr(argv[i]);
-                        AIL_PM_Comp_Res comp_res = ail_pm_compile_sv_a(a, AIL_PM_EXP_GLOB, ail_default_allocator);
-                        if (comp_res.failed) {
-                            log_ail_pm_comp_err(AIL_PM_EXP_GLOB, comp_res.err, a.str);
-                            return 1;
-                        } else list_push(regexs, comp_res.pattern);
+                } else i++;
+                rule->cmds.data[rule->cmds.len - 1].each = n;
+            } else if (is_long_flag(arg, SV_LIT_T("--worker"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                WorkerProto proto = WORKER_LINES;
+                if (ail_sv_find_char(arg, '=') >= 0) {
+                    if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                    if (!strcmp(vals.data[0], "lines"))       proto = WORKER_LINES;
+                    else if (!strcmp(vals.data[0], "length")) proto = WORKER_LENGTH;
+                    else {
+                        log_err("Expected 'lines' or 'length' as the protocol for '%s'", argv[i - 1]);
+                        printf("See detailed usage info by running `%s --help`\n", program);
+                        return 1;
                     }
+                } else i++;
+                rule->cmds.data[rule->cmds.len - 1].worker = proto;
+            } else if (is_long_flag(arg, SV_LIT_T("--server"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                rule->cmds.data[rule->cmds.len - 1].server = true;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--listen"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1) {
+                    log_err("Expected a single address for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
                 }
-            } else if (ail_sv_starts_with(arg, SV_LIT_T("-r")) || ail_sv_starts_with(arg, SV_LIT_T("--regex"))) {
-                i64 _eq_idx = ail_sv_find_char(arg, '=');
-                if (_eq_idx >= 0) {
-                    ail_sv_split_next_char(&arg, '=', true);
-                    if (!arg.len) {
-                        log_err("Expected a value after the equals sign in '%s'", argv[i]);
-                        printf("See detailed usage info by running `%s --help`\n", program);
-                    } else {
-                        AIL_PM_Comp_Res comp_res = ail_pm_compile_sv_a(arg, AIL_PM_EXP_REGEX, ail_default_allocator);
-                        if (comp_res.failed) {
-                            log_ail_pm_comp_err(AIL_PM_EXP_REGEX, comp_res.err, arg.str);
+                rule->cmds.data[rule->cmds.len - 1].server = true;
+                rule->cmds.data[rule->cmds.len - 1].listen = vals.data[0];
+            } else if (is_long_flag(arg, SV_LIT_T("--cache"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                rule->cmds.data[rule->cmds.len - 1].cached = true;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--cache-dir"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1) {
+                    log_err("Expected a single directory for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+                cache_dir = vals.data[0];
+            } else if (is_long_flag(arg, SV_LIT_T("--trace"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                rule->cmds.data[rule->cmds.len - 1].traced = true;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--deps"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                Cmd *cmd = &rule->cmds.data[rule->cmds.len - 1];
+                if (!cmd->deps_paths.data) cmd->deps_paths = ail_da_new_t(str);
+                for (u32 j = 0; j < vals.len; j++) ail_da_push(&cmd->deps_paths, vals.data[j]);
+                cmd->deps = true;
+            } else if (is_long_flag(arg, SV_LIT_T("--min-interval"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (!throttle_parse_interval(&rule->cmds.data[rule->cmds.len - 1], &vals)) {
+                    log_err("Expected a positive amount of milliseconds, optionally followed by 'leading' or 'trailing', after --min-interval");
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--ready-timeout"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                Cmd *cmd = &rule->cmds.data[rule->cmds.len - 1];
+                if (vals.len != 1 || !parse_u32(vals.data[0], &cmd->ready_timeout)) {
+                    log_err("Expected a single amount of milliseconds for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+                cmd->server = true;
+            } else if (is_long_flag(arg, SV_LIT_T("--timeout")) || is_long_flag(arg, SV_LIT_T("--idle-timeout"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                b32 idle = is_long_flag(arg, SV_LIT_T("--idle-timeout"));
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                Cmd *cmd = &rule->cmds.data[rule->cmds.len - 1];
+                if (vals.len != 1 || !parse_u32(vals.data[0], idle ? &cmd->idle_timeout : &cmd->timeout)) {
+                    log_err("Expected a single amount of milliseconds for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--trace-lib"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1) {
+                    log_err("Expected a single path for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+                trace_lib_path = vals.data[0];
+            } else if (is_long_flag(arg, SV_LIT_T("--name"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1) {
+                    log_err("Expected a single name for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+                if (find_cmd(rule, vals.data[0]) >= 0) {
+                    log_err("The name '%s' is already used by another command of the same group", vals.data[0]);
+                    return 1;
+                }
+                rule->cmds.data[rule->cmds.len - 1].name = vals.data[0];
+            } else if (is_long_flag(arg, SV_LIT_T("--after"))) {
+                if (!check_cmd_given(rule, argv[i], program)) return 1;
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                Cmd *cmd = &rule->cmds.data[rule->cmds.len - 1];
+                cmd->after = 0;
+                for (u32 j = 0; j < vals.len; j++) {
+                    AIL_SV names = ail_sv_from_cstr(vals.data[j]);
+                    while (names.len) {
+                        char *name = ail_sv_to_cstr(ail_sv_split_next_char(&names, ',', true));
+                        i32 idx = find_cmd(rule, name);
+                        if (idx < 0 || (u32)idx == rule->cmds.len - 1) {
+                            log_err("'%s' can only run after commands of the same group that were given before it, but there is no such command '%s'", cmd->str, name);
                             return 1;
-                        } else list_push(regexs, comp_res.pattern);
+                        }
+                        cmd->after |= 1ull << idx;
                     }
-                } else {
-                    for (++i; i < argc && argv[i][0] != '-'; i++) {
-                        AIL_SV a = ail_sv_from_cstr(argv[i]);
-                        AIL_PM_Comp_Res comp_res = ail_pm_compile_sv_a(a, AIL_PM_EXP_REGEX, ail_default_allocator);
-                        if (comp_res.failed) {
-                            log_ail_pm_comp_err(AIL_PM_EXP_REGEX, comp_res.err, a.str);
-                            return 1;
-                        } else list_push(regexs, comp_res.pattern);
+                }
+            } else if (is_flag(arg, SV_LIT_T("-j"), SV_LIT_T("--jobs"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1 || !parse_u32(vals.data[0], &max_jobs)) {
+                    log_err("Expected a single amount of processes for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--jobserver"))) {
+                jobserver = true;
+                if (ail_sv_find_char(arg, '=') >= 0) {
+                    if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                    if (!parse_u32(vals.data[0], &jobserver_jobs) || !jobserver_jobs) {
+                        log_err("Expected a positive amount of jobs for '%s'", argv[i - 1]);
+                        printf("See detailed usage info by running `%s --help`\n", program);
+                        return 1;
                     }
+                } else i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--history"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1) {
+                    log_err("Expected a single file for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
                 }
-            } else if (ail_sv_starts_with(arg, SV_LIT_T("-c")) || ail_sv_starts_with(arg, SV_LIT_T("--cmd"))) {
-                i64 _eq_idx = ail_sv_find_char(arg, '=');
-                if (_eq_idx >= 0) {
-                    ail_sv_split_next_char(&arg, '=', true);
-                    if (!arg.len) {
-                        log_err("Expected a value after the equals sign in '%s'", argv[i]);
+                history_file = vals.data[0];
+            } else if (is_long_flag(arg, SV_LIT_T("--log-dir"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1) {
+                    log_err("Expected a single directory for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+                log_dir = vals.data[0];
+            } else if (is_long_flag(arg, SV_LIT_T("--log-max-size"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1 || !parse_u32(vals.data[0], &log_max_size_mb)) {
+                    log_err("Expected a single size in MiB for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--log-keep"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1 || !parse_u32(vals.data[0], &log_keep)) {
+                    log_err("Expected a single amount of files for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--bench-spawn"))) {
+                bench_spawn_runs = 1000;
+                if (ail_sv_find_char(arg, '=') >= 0) {
+                    if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                    if (!parse_u32(vals.data[0], &bench_spawn_runs) || !bench_spawn_runs) {
+                        log_err("Expected a positive amount of runs for '%s'", argv[i - 1]);
                         printf("See detailed usage info by running `%s --help`\n", program);
-                    } else {
-                        list_push(cmds, (char*)arg.str);
+                        return 1;
                     }
-                } else {
-                    for (++i; i < argc && argv[i][0] != '-'; i++) {
-                        list_push(cmds, argv[i]);
+                } else i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--bench-filter"))) {
+                bench_filter_mib = 256;
+                if (ail_sv_find_char(arg, '=') >= 0) {
+                    if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                    if (!parse_u32(vals.data[0], &bench_filter_mib) || !bench_filter_mib) {
+                        log_err("Expected a positive size in MiB for '%s'", argv[i - 1]);
+                        printf("See detailed usage info by running `%s --help`\n", program);
+                        return 1;
                     }
+                } else i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--kill-grace"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1 || !parse_u32(vals.data[0], &kill_grace_ms)) {
+                    log_err("Expected a single amount of milliseconds for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
                 }
-            } else if (ail_sv_starts_with(arg, SV_LIT_T("-v")) || ail_sv_starts_with(arg, SV_LIT_T("--version"))) {
+            } else if (is_long_flag(arg, SV_LIT_T("--no-restart"))) {
+                restart = false;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--max-pressure"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                b32 valid = vals.len > 0;
+                for (u32 j = 0; j < vals.len && valid; j++) valid = throttle_parse_pressure(vals.data[j]);
+                if (!valid) {
+                    log_err("Expected 'cpu', 'memory' or 'io' followed by '=' and a percentage after --max-pressure");
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--max-defer"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1 || !parse_u32(vals.data[0], &max_defer_ms)) {
+                    log_err("Expected a single amount of milliseconds for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--cgroup"))) {
+                limits.cgroup = true;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--cpu-max"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1 || !limits_parse_cpu_max(vals.data[0])) {
+                    log_err("Expected a percentage of a core or a value for cpu.max after --cpu-max");
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--memory-max"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1) {
+                    log_err("Expected a single size after --memory-max");
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+                limits.memory_max = vals.data[0];
+            } else if (is_long_flag(arg, SV_LIT_T("--io-weight"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1 || !parse_u32(vals.data[0], &limits.io_weight) || !limits.io_weight || limits.io_weight > 10000) {
+                    log_err("Expected a weight from 1 to 10000 after --io-weight");
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--nice"))) {
+                // @Note: Negative values start with a dash, so they are taken as the value instead of as the next flag
+                if (!strchr(argv[i], '=') && i + 1 < argc && argv[i + 1][0] == '-' && argv[i + 1][1] >= '0' && argv[i + 1][1] <= '9') {
+                    list_push(vals, argv[i + 1]);
+                    i += 2;
+                } else if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                char *end = NULL;
+                long n = vals.len == 1 ? strtol(vals.data[0], &end, 10) : 0;
+                if (vals.len != 1 || !vals.data[0][0] || *end || n < -20 || n > 19) {
+                    log_err("Expected a nice value from -20 to 19 after --nice");
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+                limits.has_nice = true;
+                limits.nice     = (i32)n;
+            } else if (is_long_flag(arg, SV_LIT_T("--ioprio"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1 || !limits_parse_ioprio(vals.data[0])) {
+                    log_err("Expected 'idle', 'best-effort[:<0-7>]' or 'realtime[:<0-7>]' after --ioprio");
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_long_flag(arg, SV_LIT_T("--allow-self-trigger"))) {
+                allow_self_trigger = true;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--pty"))) {
+                pty = true;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--zygote"))) {
+                zygote = true;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--headless"))) {
+                headless = true;
+                i++;
+            } else if (is_long_flag(arg, SV_LIT_T("--control"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1) {
+                    log_err("Expected a single fifo for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+                control_path = vals.data[0];
+            } else if (is_long_flag(arg, SV_LIT_T("--debounce"))) {
+                if (!get_flag_values(argc, argv, &i, &vals, program)) return 1;
+                if (vals.len != 1 || !parse_u32(vals.data[0], &debounce_ms)) {
+                    log_err("Expected a single amount of milliseconds for '%s'", arg.str);
+                    printf("See detailed usage info by running `%s --help`\n", program);
+                    return 1;
+                }
+            } else if (is_flag(arg, SV_LIT_T("-v"), SV_LIT_T("--version"))) {
                 print_version(program);
                 return 0;
-            } else if (ail_sv_starts_with(arg, SV_LIT_T("-h")) || ail_sv_starts_with(arg, SV_LIT_T("--help"))) {
+            } else if (is_flag(arg, SV_LIT_T("-h"), SV_LIT_T("--help"))) {
                 print_help(program);
                 return 0;
             } else {
@@ -241,42 +752,104 @@ int main(int argc, char **argv)
                 return 1;
             }
         }
-        if (dirs.len == 0) {
-            log_err("Invalid Usage: No directory specified");
-            printf("See detailed usage info by running `%s --help`\n", program);
-            return 1;
+        if (bench_filter_mib) {
+            bench_filter(bench_filter_mib);
+            return 0;
         }
-        if (cmds.len == 0) {
-            log_err("Invalid Usage: No command specified");
-            printf("See detailed usage info by running `%s --help`\n", program);
-            return 1;
+        // @Note: Options given before the first group only form their own group if they contain commands.
+        // Their directories and patterns are shared with all groups that don't specify any directories or patterns themselves
+        if (rules.len > 1) {
+            u64 shared_dirs = rules.data[0].dirs;
+            RegexList shared_regexs = rules.data[0].regexs;
+            if (!rules.data[0].cmds.len) memmove(&rules.data[0], &rules.data[1], sizeof(Rule)*(--rules.len));
+            for (u32 i = 0; i < rules.len; i++) {
+                if (!rules.data[i].dirs) rules.data[i].dirs = shared_dirs;
+                if (!rules.data[i].regexs.len) rules.data[i].regexs = shared_regexs;
+            }
+        }
+        for (u32 i = 0; i < rules.len; i++) {
+            if (!rules.data[i].dirs) {
+                if (rules.len > 1) log_err("Invalid Usage: No directory specified for group %u", i + 1);
+                else               log_err("Invalid Usage: No directory specified");
+                printf("See detailed usage info by running `%s --help`\n", program);
+                return 1;
+            }
+            if (!rules.data[i].cmds.len) {
+                if (rules.len > 1) log_err("Invalid Usage: No command specified for group %u", i + 1);
+                else               log_err("Invalid Usage: No command specified");
+                printf("See detailed usage info by running `%s --help`\n", program);
+                return 1;
+            }
         }
     } else { // Flags are not used
+        Rule *rule = &rules.data[0];
         if (argc == 2) {
             log_err("Invalid usage: Too few arguments");
             print_help(program);
             return 1;
         } if (argc == 3) { // Usage variant 1
-            list_push(dirs, argv[1]);
-            list_push(cmds, argv[2]);
+            if (!add_dir(rule, argv[1], program) || !add_cmd(rule, argv[2], program)) return 1;
         } else { // Usage variant 2
-            list_push(dirs, argv[1]);
-            AIL_SV arg = ail_sv_from_cstr(argv[2]);
-            AIL_PM_Comp_Res comp_res = ail_pm_compile_sv_a(arg, AIL_PM_EXP_GLOB, ail_default_allocator);
-            if (comp_res.failed) {
-                log_ail_pm_comp_err(AIL_PM_EXP_GLOB, comp_res.err, arg.str);
+            if (!add_dir(rule, argv[1], program)) return 1;
+            if (!add_pattern(&rule->regexs, argv[2], AIL_PM_EXP_GLOB, program)) return 1;
+            for (i32 i = 3; i < argc; i++) {
+                if (!add_cmd(rule, argv[i], program)) return 1;
+            }
+        }
+    }
+
+    for (u32 r = 0; r < rules.len; r++) {
+        CmdList *cmds = &rules.data[r].cmds;
+        for (u32 i = 0; i < cmds->len; i++) {
+            if (cmds->data[i].worker && cmds->data[i].each) {
+                log_err("'%s' can't run as a worker and once per changed file at the same time", cmds->data[i].str);
+                return 1;
+            }
+            if (cmds->data[i].server && (cmds->data[i].worker || cmds->data[i].each)) {
+                log_err("'%s' can't run as a server and as a worker or once per changed file at the same time", cmds->data[i].str);
+                return 1;
+            }
+            if (cmds->data[i].cached && (cmds->data[i].worker || cmds->data[i].server)) {
+                log_err("'%s' can't be cached, since it keeps running as a worker or server", cmds->data[i].str);
                 return 1;
-            } else list_push(regexs, comp_res.pattern);
-            for (i32 i = 3; i < argc; i++) list_push(cmds, argv[i]);
+            }
+            uses_cache |= cmds->data[i].cached;
+            if (!plan_compile(cmds->data[i].str, &cmds->data[i].argv)) {
+                printf("See detailed usage info by running `%s --help`\n", program);
+                return 1;
+            }
+            // @Note: LISTEN_PID can only name a single process
+            if (cmds->data[i].server && plan_find_end(cmds->data[i].argv.data, 0, cmds->data[i].argv.len, false) < cmds->data[i].argv.len) {
+                log_err("'%s' can't run as a server, since it consists of several commands", cmds->data[i].str);
+                return 1;
+            }
+            // @Note: Commands receiving the changed files would need to read files, that they never read before
+            if (cmds->data[i].traced && (cmds->data[i].worker || cmds->data[i].server || cmds->data[i].each || changes_placeholder_count(&cmds->data[i].argv))) {
+                log_err("'%s' can't be traced, since it keeps running or receives the changed files as arguments", cmds->data[i].str);
+                return 1;
+            }
+            uses_trace |= cmds->data[i].traced;
         }
     }
 
-    for (u32 i = 0; i < cmds.len; i++) {
-        AIL_DA(AIL_SV) parts = ail_sv_split_whitespace(ail_sv_from_cstr(cmds.data[i]), true);
-        cmds.cmds[i] = ail_da_new_t(str);
-        for (u32 j = 0; j < parts.len; j++) {
-            ail_da_push(&cmds.cmds[i], ail_sv_to_cstr(parts.data[j]));
+    for (u32 r = 0; r < rules.len; r++) {
+        for (u32 i = 0; i < rules.data[r].cmds.len; i++) {
+            Cmd *cmd = &rules.data[r].cmds.data[i];
+            for (u32 j = 0; j < cmd->argv.len; j = plan_find_end(cmd->argv.data, j, cmd->argv.len, false) + 1) {
+                while (j < cmd->argv.len && cmd->argv.data[j] == plan_env) j += 2;
+                if (j < cmd->argv.len && !subproc_resolve(cmd->argv.data[j])) log_warn("Could not find '%s' in PATH", cmd->argv.data[j]);
+            }
+        }
+    }
+    // @Note: The zygote is forked before anything else is opened or allocated, so that it stays as small as possible
+    if (zygote && !zygote_init()) return 1;
+    if (bench_spawn_runs) {
+        if (!plan_is_simple(&rules.data[0].cmds.data[0].argv)) {
+            log_err("--bench-spawn can only measure a single command without variable assignments");
+            return 1;
         }
+        bench_spawn(&rules.data[0].cmds.data[0].argv, bench_spawn_runs);
+        return 0;
     }
 
 #if 0
@@ -284,34 +857,195 @@ int main(int argc, char **argv)
     for (u32 i = 0; i < dirs.len; i++) {
         printf("  > %s\n", dirs.data[i]);
     }
-    printf("Regexs:\n");
-    for (u32 i = 0; i < regexs.len; i++) {
-        char buf[1024];
-        int n = ail_pm_pattern_to_str(regexs.data[i], buf, sizeof(buf));
-        AIL_SV sv   = ail_sv_from_parts(buf, n);
-        AIL_Str str = ail_sv_replace(sv, SV_LIT_T("\n"), SV_LIT_T("\n    "));
-        printf("  > %s\n", str.str);
-    }
-    printf("Cmds:\n");
-    for (u32 i = 0; i < cmds.len; i++) {
-        printf("  > %s\n", cmds.data[i]);
+    for (u32 r = 0; r < rules.len; r++) {
+        printf("Group %u:\n", r + 1);
+        printf("  Dirs:\n");
+        for (u32 i = 0; i < dirs.len; i++) {
+            if (rules.data[r].dirs & (1ull << i)) printf("    > %s\n", dirs.data[i]);
+        }
+        printf("  Regexs:\n");
+        for (u32 i = 0; i < rules.data[r].regexs.len; i++) {
+            char buf[1024];
+            int n = ail_pm_pattern_to_str(rules.data[r].regexs.data[i], buf, sizeof(buf));
+            AIL_SV sv   = ail_sv_from_parts(buf, n);
+            AIL_Str str = ail_sv_replace(sv, SV_LIT_T("\n"), SV_LIT_T("\n      "));
+            printf("    > %s\n", str.str);
+        }
+        printf("  Cmds:\n");
+        for (u32 i = 0; i < rules.data[r].cmds.len; i++) {
+            printf("    > %s\n", rules.data[r].cmds.data[i].str);
+        }
     }
 #endif
 
-    term_init();
+    // @Note: Without a terminal (i.e. when started by a service manager or with redirected stdin), watch-exec always runs headless
+    term_init(headless);
+    if (!term_available) headless = true;
+    if (headless) {
+        log_structured = true;
+#if defined(_WIN32) || defined(__WIN32__)
+        setvbuf(stdout, NULL, _IONBF, 0); // Line buffering isn't supported on Windows
+#else
+        setvbuf(stdout, NULL, _IOLBF, 0);
+#endif
+    }
+    if (control_path && !control_init(control_path)) return 1;
     subproc_init();
-    dmon_init();
+    if (pty && !subproc_pty_init()) return 1;
+    subproc_pty = pty;
+    if (!changes_init()) return 1;
+    changes_resolve_init(&dirs);
+    exec_init(max_jobs, kill_grace_ms);
+    if (jobserver && !jobserver_init(jobserver_jobs ? jobserver_jobs : subproc_core_count())) {
+        changes_deinit();
+        return 1;
+    }
+    history_init(history_file);
+    if (uses_cache) cache_init(cache_dir, &dirs, &rules);
+    deps_init(&rules);
+    if (uses_trace && !trace_init(program, trace_lib_path, true)) {
+        changes_deinit();
+        return 1;
+    }
+    if (!allow_self_trigger) {
+        b32 precise = uses_trace || trace_init(program, trace_lib_path, false);
+        self_init(precise, restart);
+        if (precise) log_info("Running all commands with %s preloaded, to ignore the changes they make themselves (disable with --allow-self-trigger)...", TRACE_LIB_NAME);
+        if (!precise && restart) log_info("Changes made by the commands themselves can't be recognized without %s, so they trigger the commands again", TRACE_LIB_NAME);
+    }
+    runlog_init(log_dir, (u64)log_max_size_mb << 20, log_keep);
+    if (!limits_init(program)) {
+        changes_deinit();
+        return 1;
+    }
+    if (!throttle_init(max_defer_ms)) {
+        changes_deinit();
+        return 1;
+    }
+    reactor_init(); // @Note: Needs to happen before the watcher's thread is started, so that it inherits the blocked signals
+    if (!server_init(&rules, kill_grace_ms)) {
+        changes_deinit();
+        return 1;
+    }
+    limits_start_watcher();
     log_info("Watching for file changes...");
-    log_info("Quit with 'q', rerun all commands with 'r'...");
+    if (!headless) log_info("Quit with 'q', rerun all commands with 'r'...");
+    else           log_info("Running headless, quit with SIGINT or SIGTERM, rerun all commands with SIGHUP...");
+    if (control_path) log_info("Reading commands ('run', 'cancel' or 'quit') from '%s'...", control_path);
     for (u32 i = 0; i < dirs.len; i++) {
-        dmon_watch(dirs.data[i], watch_callback, DMON_WATCHFLAGS_RECURSIVE, NULL);
+        dmon_watch(dirs.data[i], watch_callback, DMON_WATCHFLAGS_RECURSIVE, (void *)(uintptr_t)i);
+    }
+    // @Note: Everything happens in reaction to the events reported by the reactor, so the loop never blocks anywhere else
+    // The only exception is cancelling a run, which waits up to the grace period for the commands to stop
+    reactor_add(changes_wake_read, REACTOR_CHANGES, 0);
+    if (!headless)    reactor_add(term_handles.in, REACTOR_INPUT, 0);
+    if (control_path && !reactor_add(control_handle, REACTOR_CONTROL, 0)) {
+        log_err("Could not wait for commands in control fifo '%s'", control_path);
+        changes_deinit();
+        return 1;
+    }
+    zygote_watch();
+    // Servers are started right away instead of waiting for the first change
+    if (servers.len) run_all();
+    b32 quit = false;
+    while (!quit) {
+        // @Note: New changes only interrupt a run if they'd restart it, but the wake handle needs to be reset anyways
+        i32 debounce_left = throttle_wait_time(changes_wait_time(debounce_ms), run.active);
+        reactor_set_timer((restart || !run.active) ? debounce_left : -1);
+        ReactorEvent events[64];
+        i32 timeout_ms = exec_run_timeout(&run), worker_ms = worker_poll_interval(), server_ms = server_poll_interval();
+        if (worker_ms >= 0 && (timeout_ms < 0 || worker_ms < timeout_ms)) timeout_ms = worker_ms;
+        if (server_ms >= 0 && (timeout_ms < 0 || server_ms < timeout_ms)) timeout_ms = server_ms;
+        u32 n_events = reactor_wait(timeout_ms, events, AIL_ARRLEN(events));
+        for (u32 i = 0; i < n_events && !quit; i++) {
+            switch (events[i].kind) {
+                case REACTOR_INPUT: {
+                    int c = term_get_char_timeout(0, changes_wake_read);
+                    if (term_input_closed) reactor_remove(term_handles.in);
+                    if (c >= 0) {
+                        c |= 0x20;
+                        if (c == 'q') quit = true;
+                        if (c == 'r') run_all();
+                    }
+                } break;
+                case REACTOR_SIGNAL:
+                    // @Note: SIGHUP also means that the terminal was closed when not running headless
+                    if (events[i].id == REACTOR_SIGWINCH) {
+                        if (subproc_pty) subproc_resize_ptys();
+                    } else if (headless && events[i].id == REACTOR_SIGHUP) {
+                        log_info("Received SIGHUP, rerunning all commands...");
+                        run_all();
+                    } else {
+                        log_info("Received signal %u, quitting...", events[i].id);
+                        quit = true;
+                    }
+                    break;
+                case REACTOR_CONTROL: {
+                    ControlCmd cmds[16];
+                    u32 n_cmds = AIL_ARRLEN(cmds);
+                    while (n_cmds == AIL_ARRLEN(cmds) && !quit) {
+                        n_cmds = control_read(cmds, AIL_ARRLEN(cmds));
+                        for (u32 j = 0; j < n_cmds && !quit; j++) {
+                            switch (cmds[j]) {
+                                case CONTROL_RUN: run_all(); break;
+                                case CONTROL_QUIT: quit = true; break;
+                                case CONTROL_CANCEL:
+                                    if (run.active) {
+                                        Batch batch = exec_run_cancel(&run);
+                                        batch_free(&batch);
+                                    }
+                                    break;
+                                case CONTROL_NONE: break;
+                            }
+                        }
+                    }
+                } break;
+                case REACTOR_OUTPUT:
+                case REACTOR_EXIT:
+                    exec_run_handle(&run, events[i]);
+                    worker_handle(events[i]);
+                    server_handle(events[i]);
+                    break;
+                case REACTOR_NOTIFY:
+                    server_handle(events[i]);
+                    break;
+                case REACTOR_JOBSERVER:
+                    jobserver_handle();
+                    break;
+                case REACTOR_ZYGOTE:
+                    zygote_handle();
+                    break;
+                case REACTOR_WORKER:
+                    worker_handle(events[i]);
+                    break;
+                case REACTOR_CHANGES:
+                case REACTOR_TIMER:
+                    break;
+            }
+        }
+        if (quit) break;
+        worker_update();
+        server_update();
+        if (run.active) exec_run_update(&run);
+        Batch batch;
+        if ((restart || !run.active) && !changes_wait_time(debounce_ms) && throttle_admit() && changes_take(&batch, debounce_ms)) {
+            exec_run_peek_writes(&run);
+            if (self_filter(&batch)) start_run(batch);
+            else batch_free(&batch);
+        } else if (!run.active && throttle_due() && throttle_admit()) {
+            start_run((Batch){ .changes = ail_da_new_t(Change) });
+        }
     }
-    for (;;) {
-        char c = (term_get_char() | 0x20);
-        if (c == 'q') break;
-        if (c == 'r') run_cmds();
+    if (run.active) {
+        Batch batch = exec_run_cancel(&run);
+        batch_free(&batch);
     }
+    worker_stop_all(kill_grace_ms);
+    server_stop_all();
+    limits_deinit();
+    jobserver_deinit();
     dmon_deinit();
+    changes_deinit();
     subproc_deinit();
     term_deinit();
     return 0;
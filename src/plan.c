@@ -0,0 +1,163 @@
+#include "header.h"
+
+// Commands are split into their arguments once at startup, so that every run starts the programs right away instead of
+// going through a shell. The syntax is a small subset of the one of POSIX shells:
+// - Single quotes keep everything up to the next single quote as is, double quotes keep everything except for a
+//   backslash in front of '"' or '\', and a backslash outside of quotes keeps the next character as is
+// - 'NAME=value' in front of a command sets the environment variable only for that command
+// - 'a | b' connects the output of a to the input of b, while the errors of both are shown like their output
+// - 'a && b' only runs b if a succeeded, 'a || b' only if a failed and 'a ; b' always runs it
+// The plan is stored as a flat list of arguments, in which the operators and the assignments are marked by the sentinels
+// below, so that the placeholders can be replaced by the changed files like in any other command (see changes.c)
+// @Note: Variables, globs, redirections and subshells aren't supported, commands needing them can still run via `sh -c '...'`
+
+#ifndef PLAN_PIPELINE_MAX
+#   define PLAN_PIPELINE_MAX 16 // Maximum amount of commands in a pipeline
+#endif
+#ifndef PLAN_ERR_LEN
+#   define PLAN_ERR_LEN 128
+#endif
+
+// @Note: The sentinels are compared by their address, so arguments with the same content (i.e. a quoted '|') aren't operators
+global char plan_pipe[] = "|";
+global char plan_and[]  = "&&";
+global char plan_or[]   = "||";
+global char plan_seq[]  = ";";
+global char plan_env[]  = "="; // Precedes each variable assignment
+
+internal b32 plan_is_op(const char *arg)
+{
+    return arg == plan_pipe || arg == plan_and || arg == plan_or || arg == plan_seq;
+}
+
+// Returns the index after the last argument of the pipeline (or only the command, unless `pipeline` is set) starting at `from`
+internal u32 plan_find_end(str *args, u32 from, u32 len, b32 pipeline)
+{
+    u32 i = from;
+    while (i < len && !(plan_is_op(args[i]) && (!pipeline || args[i] != plan_pipe))) i++;
+    return i;
+}
+
+// Returns whether the plan is a single command without any variable assignments, that could run as is
+internal b32 plan_is_simple(AIL_DA(str) *argv)
+{
+    for (u32 i = 0; i < argv->len; i++) {
+        if (plan_is_op(argv->data[i]) || argv->data[i] == plan_env) return false;
+    }
+    return true;
+}
+
+internal char *plan_strdup(const char *s, u64 len)
+{
+    char *res = AIL_CALL_ALLOC(ail_default_allocator, len + 1);
+    memcpy(res, s, len);
+    res[len] = 0;
+    return res;
+}
+
+// Splits the command into its arguments, operators and variable assignments
+// Returns false if it's invalid, which is already reported then
+internal b32 plan_compile(const char *cmd, AIL_DA(str) *argv)
+{
+    *argv = ail_da_new_t(str);
+    AIL_DA(char) word = ail_da_new_t(char);
+    char err[PLAN_ERR_LEN] = {0};
+    b32  in_word  = false; // Whether a word was started, which might still be empty (i.e. '')
+    b32  name     = true;  // Whether the word only consists of unquoted characters, that are valid in a variable's name, so far
+    b32  assign   = false; // Whether the word is a variable assignment
+    u32  n_words  = 0;     // Arguments of the current command, not counting the variable assignments
+    u32  n_piped  = 1;     // Commands in the current pipeline
+    const char *c = cmd;
+    while (!err[0]) {
+        char ch = *c;
+        b32 space = ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+        if (!ch || space || ch == '|' || ch == '&' || ch == ';') {
+            if (in_word) {
+                if (assign) ail_da_push(argv, plan_env);
+                else n_words++;
+                ail_da_push(argv, plan_strdup(word.data, word.len));
+                word.len = 0;
+                in_word  = false;
+                name     = true;
+                assign   = false;
+            }
+            if (!ch) break;
+            if (space) {
+                c++;
+                continue;
+            }
+            char *op = plan_seq;
+            if (ch == '|') op = c[1] == '|' ? plan_or : plan_pipe;
+            else if (ch == '&') {
+                if (c[1] != '&') {
+                    snprintf(err, sizeof(err), "Running commands in the background with '&' is not supported");
+                    break;
+                }
+                op = plan_and;
+            }
+            if (!n_words) {
+                snprintf(err, sizeof(err), "Expected a command before '%s'", op);
+                break;
+            }
+            if (op != plan_pipe) n_piped = 1;
+            else if (++n_piped > PLAN_PIPELINE_MAX) {
+                snprintf(err, sizeof(err), "Pipelines can consist of at most %d commands", PLAN_PIPELINE_MAX);
+                break;
+            }
+            ail_da_push(argv, op);
+            n_words = 0;
+            c += strlen(op);
+            continue;
+        }
+        in_word = true;
+        if (ch == '\'') {
+            const char *end = strchr(c + 1, '\'');
+            if (!end) {
+                snprintf(err, sizeof(err), "Expected a closing single quote");
+                break;
+            }
+            ail_da_pushn(&word, c + 1, end - c - 1);
+            name = false;
+            c    = end + 1;
+        } else if (ch == '"') {
+            for (c++; *c && *c != '"'; c++) {
+                if (*c == '\\' && (c[1] == '"' || c[1] == '\\')) c++;
+                ail_da_push(&word, *c);
+            }
+            if (!*c) {
+                snprintf(err, sizeof(err), "Expected a closing double quote");
+                break;
+            }
+            name = false;
+            c++;
+        } else if (ch == '\\') {
+            if (!c[1]) {
+                snprintf(err, sizeof(err), "Expected a character after the backslash at the end");
+                break;
+            }
+            ail_da_push(&word, c[1]);
+            name = false;
+            c   += 2;
+        } else {
+            // @Note: Only assignments in front of the program are variables, later ones are regular arguments
+            if (ch == '=' && name && word.len && !assign && !n_words) assign = true;
+            else if (!(ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (word.len && ch >= '0' && ch <= '9'))) name = false;
+            ail_da_push(&word, ch);
+            c++;
+        }
+    }
+    if (!err[0] && argv->len && !n_words) {
+        if (plan_is_op(argv->data[argv->len - 1])) snprintf(err, sizeof(err), "Expected a command after '%s'", argv->data[argv->len - 1]);
+        else snprintf(err, sizeof(err), "Expected a command after the variable assignments");
+    }
+#if defined(_WIN32) || defined(__WIN32__)
+    // @TODO: Commands are started via a single command line on Windows, which would need to be split up again
+    if (!err[0] && !plan_is_simple(argv)) snprintf(err, sizeof(err), "Pipelines, chains and variable assignments are not supported on Windows yet");
+#endif
+    ail_da_free(&word);
+    if (err[0]) {
+        log_err("Invalid command '%s': %s", cmd, err);
+        return false;
+    }
+    return true;
+}
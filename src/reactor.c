@@ -0,0 +1,315 @@
+#include "header.h"
+
+// The reactor waits for everything the main loop needs to react to at once:
+// key presses, new changes, signals, the debounce timer and the output and exits of child processes
+// On Linux it is built on epoll, with signalfd, timerfd and pidfds (see subproc.c) so that nothing needs to be polled periodically
+// Other POSIX systems use poll and a self-pipe for signals, while Windows waits on the registered handles
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <windows.h>
+#elif defined(__linux__)
+#   include <sys/epoll.h>
+#   include <sys/signalfd.h>
+#   include <sys/timerfd.h>
+#   include <signal.h>
+#   include <unistd.h>
+#else
+#   include <poll.h>
+#   include <signal.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+typedef enum ReactorKind {
+    REACTOR_INPUT,   // Stdin became readable
+    REACTOR_CHANGES, // The watcher reported new changes
+    REACTOR_CONTROL, // Commands were written into the control fifo
+    REACTOR_SIGNAL,  // A signal was received, the id is the signal's number
+    REACTOR_TIMER,   // The timer set with reactor_set_timer ran out
+    REACTOR_OUTPUT,  // A child process wrote output, the id is its pid
+    REACTOR_EXIT,    // A child process exited, the id is its pid
+    REACTOR_NOTIFY,  // A server sent a notification, the id is the server's index
+    REACTOR_JOBSERVER, // A token was returned to the jobserver's fifo (see jobserver.c)
+    REACTOR_ZYGOTE,    // The zygote reported started or exited processes (see zygote.c)
+    REACTOR_WORKER,    // A worker's stdin can take more data, the id is the worker's index (see worker.c)
+} ReactorKind;
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   define REACTOR_SIGHUP   1  // Never reported on Windows
+#   define REACTOR_SIGWINCH 28 // Never reported on Windows
+#else
+#   define REACTOR_SIGHUP   SIGHUP
+#   define REACTOR_SIGWINCH SIGWINCH // The terminal was resized
+#endif
+
+typedef struct ReactorEvent {
+    ReactorKind kind;
+    u32         id;
+} ReactorEvent;
+
+internal void reactor_init(void);
+internal b32  reactor_add(TermHandle handle, ReactorKind kind, u32 id);
+internal void reactor_remove(TermHandle handle);
+internal void reactor_set_timer(i32 timeout_ms);
+internal u32  reactor_wait(i32 timeout_ms, ReactorEvent *events, u32 max_events);
+
+global b32 reactor_initialized;
+global u64 reactor_deadline_ms; // Used instead of timerfd, 0 if the timer isn't set
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+AIL_DA_INIT(HANDLE);
+AIL_DA_INIT(ReactorEvent);
+global AIL_DA(HANDLE)       reactor_handles;
+global AIL_DA(ReactorEvent) reactor_events;
+global HANDLE               reactor_signal_event;
+
+internal BOOL WINAPI reactor_ctrl_handler(DWORD type)
+{
+    if (type != CTRL_C_EVENT && type != CTRL_BREAK_EVENT && type != CTRL_CLOSE_EVENT) return FALSE;
+    SetEvent(reactor_signal_event);
+    return TRUE;
+}
+
+internal void reactor_init(void)
+{
+    reactor_handles      = ail_da_new_t(HANDLE);
+    reactor_events       = ail_da_new_t(ReactorEvent);
+    reactor_signal_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+    reactor_initialized  = true;
+    reactor_add(reactor_signal_event, REACTOR_SIGNAL, 2); // SIGINT
+    SetConsoleCtrlHandler(reactor_ctrl_handler, TRUE);
+}
+
+internal b32 reactor_add(TermHandle handle, ReactorKind kind, u32 id)
+{
+    if (!reactor_initialized || reactor_handles.len == MAXIMUM_WAIT_OBJECTS) return false;
+    ail_da_push(&reactor_handles, handle);
+    ail_da_push(&reactor_events, ((ReactorEvent){ kind, id }));
+    return true;
+}
+
+internal void reactor_remove(TermHandle handle)
+{
+    for (u32 i = 0; i < reactor_handles.len; i++) {
+        if (reactor_handles.data[i] != handle) continue;
+        reactor_handles.data[i] = reactor_handles.data[--reactor_handles.len];
+        reactor_events.data[i]  = reactor_events.data[--reactor_events.len];
+        return;
+    }
+}
+
+internal void reactor_set_timer(i32 timeout_ms)
+{
+    reactor_deadline_ms = timeout_ms < 0 ? 0 : timer_now_ms() + timeout_ms;
+}
+
+// @Note: Only a single event is reported at once on Windows
+internal u32 reactor_wait(i32 timeout_ms, ReactorEvent *events, u32 max_events)
+{
+    if (!max_events) return 0;
+    if (reactor_deadline_ms) {
+        u64 now  = timer_now_ms();
+        i32 left = now >= reactor_deadline_ms ? 0 : (i32)(reactor_deadline_ms - now);
+        if (timeout_ms < 0 || left < timeout_ms) timeout_ms = left;
+    }
+    DWORD res = WaitForMultipleObjects(reactor_handles.len, reactor_handles.data, FALSE, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+    if (res >= WAIT_OBJECT_0 && res < WAIT_OBJECT_0 + reactor_handles.len) {
+        events[0] = reactor_events.data[res - WAIT_OBJECT_0];
+        if (events[0].kind == REACTOR_SIGNAL) ResetEvent(reactor_signal_event);
+        return 1;
+    }
+    if (reactor_deadline_ms && timer_now_ms() >= reactor_deadline_ms) {
+        reactor_deadline_ms = 0;
+        events[0] = (ReactorEvent){ REACTOR_TIMER, 0 };
+        return 1;
+    }
+    return 0;
+}
+
+
+#elif defined(__linux__)
+////////////////////////
+// Linux Implementation
+////////////////////////
+
+global int reactor_epoll  = -1;
+global int reactor_signal = -1;
+global int reactor_timer  = -1;
+
+// @Note: SIGINT, SIGTERM, SIGHUP and SIGWINCH are blocked, so that they're only received via the signalfd
+// Child processes need to unblock them again (see subproc_start_internal)
+internal void reactor_init(void)
+{
+    reactor_epoll = epoll_create1(EPOLL_CLOEXEC);
+    AIL_ASSERT(reactor_epoll >= 0);
+    reactor_initialized = true;
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+    reactor_signal = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (reactor_signal >= 0) reactor_add(reactor_signal, REACTOR_SIGNAL, 0);
+    else sigprocmask(SIG_UNBLOCK, &set, NULL);
+
+    reactor_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (reactor_timer >= 0) reactor_add(reactor_timer, REACTOR_TIMER, 0);
+}
+
+// @Note: Fails for files that can't be waited on, i.e. regular files or /dev/null as stdin
+internal b32 reactor_add(TermHandle handle, ReactorKind kind, u32 id)
+{
+    if (!reactor_initialized) return false;
+    struct epoll_event ev = { .events = kind == REACTOR_WORKER ? EPOLLOUT : EPOLLIN, .data.u64 = ((u64)kind << 32) | id };
+    return epoll_ctl(reactor_epoll, EPOLL_CTL_ADD, handle, &ev) == 0;
+}
+
+internal void reactor_remove(TermHandle handle)
+{
+    if (reactor_initialized) epoll_ctl(reactor_epoll, EPOLL_CTL_DEL, handle, NULL);
+}
+
+internal void reactor_set_timer(i32 timeout_ms)
+{
+    if (reactor_timer < 0) {
+        reactor_deadline_ms = timeout_ms < 0 ? 0 : timer_now_ms() + timeout_ms;
+        return;
+    }
+    // @Note: A zero it_value disarms the timer, so an immediate timeout is rounded up to a nanosecond
+    struct itimerspec spec = {0};
+    if (timeout_ms >= 0) {
+        spec.it_value.tv_sec  = timeout_ms/1000;
+        spec.it_value.tv_nsec = (timeout_ms%1000)*1000000L + (timeout_ms ? 0 : 1);
+    }
+    timerfd_settime(reactor_timer, 0, &spec, NULL);
+}
+
+internal u32 reactor_wait(i32 timeout_ms, ReactorEvent *events, u32 max_events)
+{
+    if (reactor_deadline_ms) {
+        u64 now  = timer_now_ms();
+        i32 left = now >= reactor_deadline_ms ? 0 : (i32)(reactor_deadline_ms - now);
+        if (timeout_ms < 0 || left < timeout_ms) timeout_ms = left;
+    }
+    struct epoll_event evs[64];
+    int n = epoll_wait(reactor_epoll, evs, (int)AIL_MIN(max_events, AIL_ARRLEN(evs)), timeout_ms);
+    u32 count = 0;
+    for (int i = 0; i < n; i++) {
+        ReactorEvent ev = { (ReactorKind)(evs[i].data.u64 >> 32), (u32)evs[i].data.u64 };
+        if (ev.kind == REACTOR_SIGNAL) {
+            struct signalfd_siginfo info;
+            if (read(reactor_signal, &info, sizeof(info)) != sizeof(info)) continue;
+            ev.id = info.ssi_signo;
+        } else if (ev.kind == REACTOR_TIMER) {
+            u64 expirations;
+            if (read(reactor_timer, &expirations, sizeof(expirations)) < 0) continue;
+        }
+        events[count++] = ev;
+    }
+    if (reactor_deadline_ms && count < max_events && timer_now_ms() >= reactor_deadline_ms) {
+        reactor_deadline_ms = 0;
+        events[count++] = (ReactorEvent){ REACTOR_TIMER, 0 };
+    }
+    return count;
+}
+
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+typedef struct pollfd ReactorPollFd;
+AIL_DA_INIT(ReactorPollFd);
+AIL_DA_INIT(ReactorEvent);
+global AIL_DA(ReactorPollFd) reactor_pollfds;
+global AIL_DA(ReactorEvent)  reactor_events;
+global int                   reactor_signal_pipe[2] = { -1, -1 };
+
+internal void reactor_signal_handler(int sig)
+{
+    int saved = errno;
+    u8 c = (u8)sig;
+    if (write(reactor_signal_pipe[1], &c, 1) < 0) {} // A full pipe is already signaled
+    errno = saved;
+}
+
+internal void reactor_init(void)
+{
+    reactor_pollfds     = ail_da_new_t(ReactorPollFd);
+    reactor_events      = ail_da_new_t(ReactorEvent);
+    reactor_initialized = true;
+    if (pipe(reactor_signal_pipe) < 0) return;
+    for (u32 i = 0; i < AIL_ARRLEN(reactor_signal_pipe); i++) {
+        fcntl(reactor_signal_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(reactor_signal_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    reactor_add(reactor_signal_pipe[0], REACTOR_SIGNAL, 0);
+    struct sigaction sa = {0};
+    sa.sa_handler = reactor_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP,  &sa, NULL);
+    sigaction(SIGWINCH, &sa, NULL);
+}
+
+internal b32 reactor_add(TermHandle handle, ReactorKind kind, u32 id)
+{
+    if (!reactor_initialized) return false;
+    ail_da_push(&reactor_pollfds, ((ReactorPollFd){ .fd = handle, .events = kind == REACTOR_WORKER ? POLLOUT : POLLIN }));
+    ail_da_push(&reactor_events, ((ReactorEvent){ kind, id }));
+    return true;
+}
+
+internal void reactor_remove(TermHandle handle)
+{
+    for (u32 i = 0; i < reactor_pollfds.len; i++) {
+        if (reactor_pollfds.data[i].fd != handle) continue;
+        reactor_pollfds.data[i] = reactor_pollfds.data[--reactor_pollfds.len];
+        reactor_events.data[i]  = reactor_events.data[--reactor_events.len];
+        return;
+    }
+}
+
+internal void reactor_set_timer(i32 timeout_ms)
+{
+    reactor_deadline_ms = timeout_ms < 0 ? 0 : timer_now_ms() + timeout_ms;
+}
+
+internal u32 reactor_wait(i32 timeout_ms, ReactorEvent *events, u32 max_events)
+{
+    if (reactor_deadline_ms) {
+        u64 now  = timer_now_ms();
+        i32 left = now >= reactor_deadline_ms ? 0 : (i32)(reactor_deadline_ms - now);
+        if (timeout_ms < 0 || left < timeout_ms) timeout_ms = left;
+    }
+    u32 count = 0;
+    if (poll(reactor_pollfds.data, reactor_pollfds.len, timeout_ms) > 0) {
+        for (u32 i = 0; i < reactor_pollfds.len && count < max_events; i++) {
+            if (!reactor_pollfds.data[i].revents) continue;
+            ReactorEvent ev = reactor_events.data[i];
+            if (ev.kind == REACTOR_SIGNAL) {
+                u8 sig;
+                if (read(reactor_signal_pipe[0], &sig, 1) != 1) continue;
+                ev.id = sig;
+            }
+            events[count++] = ev;
+        }
+    }
+    if (reactor_deadline_ms && count < max_events && timer_now_ms() >= reactor_deadline_ms) {
+        reactor_deadline_ms = 0;
+        events[count++] = (ReactorEvent){ REACTOR_TIMER, 0 };
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,204 @@
+#include "header.h"
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <windows.h>
+#   include <io.h>
+#   include <fcntl.h>
+#   define runlog_open(path)            _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644)
+#   define runlog_write_fd(fd, buf, n)  _write(fd, buf, (unsigned)(n))
+#   define runlog_close(fd)             _close(fd)
+#else
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   define runlog_open(path)            open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+#   define runlog_write_fd(fd, buf, n)  write(fd, buf, n)
+#   define runlog_close(fd)             close(fd)
+#endif
+#include <time.h>
+
+#define RUNLOG_PREFIX "watch-exec-"
+#define RUNLOG_SUFFIX ".log"
+
+// Every triggered run writes the output of its commands into its own log file in `runlog_dir`
+// Log files are split into several parts once they grow larger than `runlog_max_size` and only the newest `runlog_keep` files are kept
+global char *runlog_dir;
+global u64   runlog_max_size;
+global u32   runlog_keep;
+global int   runlog_fd = -1;
+global u64   runlog_size;
+global u32   runlog_run;
+global u32   runlog_part;
+global char  runlog_name[64];
+#if defined(__linux__)
+global int   runlog_pipe[2] = { -1, -1 }; // Intermediate pipe, that tee() copies the children's output into, to splice it into the log file
+#endif
+
+internal void runlog_init(char *dir, u64 max_size, u32 keep)
+{
+    runlog_dir      = dir;
+    runlog_max_size = max_size;
+    runlog_keep     = keep;
+    if (!dir) return;
+#if defined(_WIN32) || defined(__WIN32__)
+    if (!CreateDirectoryA(dir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) log_warn("Could not create log directory '%s'", dir);
+#else
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) log_warn("Could not create log directory '%s': %s", dir, strerror(errno));
+#endif
+#if defined(__linux__)
+    if (pipe(runlog_pipe) == 0) {
+        fcntl(runlog_pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(runlog_pipe[1], F_SETFD, FD_CLOEXEC);
+    } else runlog_pipe[0] = runlog_pipe[1] = -1;
+#endif
+}
+
+internal int runlog_cmp_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Deletes the oldest log files, so that at most `runlog_keep` of them remain
+// @Note: The names start with the date and time of their run, so sorting them by name sorts them by age
+internal void runlog_prune(void)
+{
+    if (!runlog_keep) return;
+    AIL_DA(str) names = ail_da_new_t(str);
+#if defined(_WIN32) || defined(__WIN32__)
+    char pattern[1100];
+    snprintf(pattern, sizeof(pattern), "%s\\" RUNLOG_PREFIX "*" RUNLOG_SUFFIX, runlog_dir);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find != INVALID_HANDLE_VALUE) {
+        do ail_da_push(&names, _strdup(data.cFileName)); while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+#else
+    DIR *dir = opendir(runlog_dir);
+    if (dir) {
+        struct dirent *entry;
+        u64 prefix_len = strlen(RUNLOG_PREFIX), suffix_len = strlen(RUNLOG_SUFFIX);
+        while ((entry = readdir(dir))) {
+            u64 len = strlen(entry->d_name);
+            if (len > prefix_len + suffix_len && !strncmp(entry->d_name, RUNLOG_PREFIX, prefix_len) && !strcmp(entry->d_name + len - suffix_len, RUNLOG_SUFFIX)) {
+                ail_da_push(&names, strdup(entry->d_name));
+            }
+        }
+        closedir(dir);
+    }
+#endif
+    qsort(names.data, names.len, sizeof(str), runlog_cmp_names);
+    char path[1100];
+    for (u32 i = 0; i < names.len; i++) {
+        if (i + runlog_keep < names.len) {
+            snprintf(path, sizeof(path), "%s/%s", runlog_dir, names.data[i]);
+            remove(path);
+        }
+        free(names.data[i]);
+    }
+    ail_da_free(&names);
+}
+
+internal void runlog_open_part(void)
+{
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/%s.%03u" RUNLOG_SUFFIX, runlog_dir, runlog_name, runlog_part);
+    runlog_fd   = runlog_open(path);
+    runlog_size = 0;
+    if (runlog_fd < 0) log_err("Could not create log file '%s': %s", path, strerror(errno));
+    runlog_prune();
+}
+
+internal void runlog_start_run(void)
+{
+    if (!runlog_dir) return;
+    time_t now = time(NULL);
+    char date[32];
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime(&now));
+    snprintf(runlog_name, sizeof(runlog_name), RUNLOG_PREFIX "%s-%04u", date, runlog_run++ % 10000);
+    runlog_part = 0;
+    runlog_open_part();
+}
+
+internal void runlog_end_run(void)
+{
+    if (runlog_fd >= 0) runlog_close(runlog_fd);
+    runlog_fd = -1;
+}
+
+// Continues the log in a new file once the current one grew too large
+internal void runlog_account(u64 len)
+{
+    runlog_size += len;
+    if (runlog_max_size && runlog_size >= runlog_max_size) {
+        runlog_close(runlog_fd);
+        runlog_part++;
+        runlog_open_part();
+    }
+}
+
+internal void runlog_write(const char *data, u64 len)
+{
+    if (runlog_fd < 0) return;
+    while (len) {
+        i64 n = runlog_write_fd(runlog_fd, data, len);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            log_err("Could not write to log file: %s", strerror(errno));
+            runlog_end_run();
+            return;
+        }
+        data += n;
+        len  -= n;
+        runlog_account(n);
+        if (runlog_fd < 0) return;
+    }
+}
+
+AIL_PRINTF_FORMAT(1, 2)
+internal void runlog_printf(char *format, ...)
+{
+    if (runlog_fd < 0) return;
+    char buf[1024];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n > 0) runlog_write(buf, AIL_MIN((u64)n, sizeof(buf) - 1));
+}
+
+// Copies up to `max_len` bytes from the start of the pipe into the log file without consuming them and without copying them through userspace
+// Returns the amount of copied bytes (which the caller needs to read from the pipe afterwards) or a negative number if it isn't supported
+internal i64 runlog_tee(int pipe_fd, u64 max_len)
+{
+#if defined(__linux__)
+    if (runlog_fd < 0 || runlog_pipe[0] < 0) return -1;
+    ssize_t n = tee(pipe_fd, runlog_pipe[1], max_len, SPLICE_F_NONBLOCK);
+    if (n <= 0) return (n == 0 || errno == EAGAIN) ? 0 : -1;
+    for (ssize_t left = n; left > 0; ) {
+        ssize_t moved = -1;
+        if (runlog_fd >= 0) {
+            moved = splice(runlog_pipe[0], NULL, runlog_fd, NULL, left, SPLICE_F_MOVE);
+            if (moved < 0 && errno == EINTR) continue;
+        }
+        if (moved <= 0) {
+            if (runlog_fd >= 0) {
+                log_err("Could not write to log file: %s", strerror(errno));
+                runlog_end_run();
+            }
+            // Drop what is still stuck in the intermediate pipe, so it doesn't end up in the next log file
+            char buf[4096];
+            while (left > 0 && (moved = read(runlog_pipe[0], buf, AIL_MIN((u64)left, sizeof(buf)))) > 0) left -= moved;
+            break;
+        }
+        left -= moved;
+        runlog_account(moved);
+    }
+    return n;
+#else
+    AIL_UNUSED(pipe_fd);
+    AIL_UNUSED(max_len);
+    return -1;
+#endif
+}
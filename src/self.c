@@ -0,0 +1,157 @@
+#include "header.h"
+
+// Changes to files that watch-exec's own commands wrote (generated code, formatter output, build artifacts, ...) are
+// dropped, so that the commands don't trigger themselves over and over again, unless --allow-self-trigger is given
+// On Linux, all commands run with watch-exec-trace.so preloaded, which records the paths they write (see trace.c)
+// A change is attributed to the commands, if its file was written by a command that was still running when the change
+// was reported or that finished at most SELF_GRACE_MS before
+// Without the library, all changes reported while a run was active are attributed to it instead. This is only done
+// with --no-restart, since changes during a run are exactly the ones that restart it otherwise
+// @Note: Workers, servers and statically linked programs aren't traced, so their writes still trigger runs
+
+#ifndef SELF_GRACE_MS
+#   define SELF_GRACE_MS 500 // Time after a command finished, in which the watcher may still report its writes
+#endif
+
+// Path that a command wrote
+typedef struct SelfWrite {
+    u64 hash;     // 0 for empty slots
+    u64 until_ms; // Changes reported later aren't attributed to the command anymore (UINT64_MAX while it's running)
+} SelfWrite;
+
+// Time during which a run was active
+typedef struct SelfWindow {
+    u64 start_ms;
+    u64 end_ms; // UINT64_MAX while the run is active
+} SelfWindow;
+AIL_DA_INIT(SelfWindow);
+
+global b32                self_enabled;
+global b32                self_precise; // Whether the writes of the commands are recorded
+global SelfWrite         *self_writes;  // Open addressing hash map by the hash of the resolved path
+global u32                self_writes_cap;
+global u32                self_writes_len;
+global AIL_DA(SelfWindow) self_windows;
+
+internal void self_init(b32 precise, b32 restart)
+{
+    self_precise = precise;
+    self_enabled = precise || !restart;
+    self_windows = ail_da_new_t(SelfWindow);
+}
+
+internal SelfWrite *self_write_slot(u64 hash)
+{
+    if (2*(self_writes_len + 1) > self_writes_cap) {
+        u32 old_cap = self_writes_cap;
+        SelfWrite *old = self_writes;
+        self_writes_cap = old_cap ? 2*old_cap : 1024;
+        self_writes     = AIL_CALL_ALLOC(ail_default_allocator, sizeof(SelfWrite)*self_writes_cap);
+        memset(self_writes, 0, sizeof(SelfWrite)*self_writes_cap);
+        self_writes_len = 0;
+        for (u32 i = 0; i < old_cap; i++) {
+            if (old[i].hash) *self_write_slot(old[i].hash) = old[i];
+        }
+        if (old) AIL_CALL_FREE(ail_default_allocator, old);
+    }
+    u32 mask = self_writes_cap - 1;
+    for (u32 i = (u32)hash & mask;; i = (i + 1) & mask) {
+        if (self_writes[i].hash == hash) return &self_writes[i];
+        if (!self_writes[i].hash) {
+            self_writes[i].hash = hash;
+            self_writes_len++;
+            return &self_writes[i];
+        }
+    }
+}
+
+internal u64 self_path_hash(const char *path)
+{
+    char norm[CHANGES_PATH_LEN];
+    if (!changes_resolve(path, norm, sizeof(norm))) return 0;
+    u64 hash = history_hash(0xcbf29ce484222325ull, norm, strlen(norm));
+    return hash ? hash : 1;
+}
+
+// Records that a command wrote the file, which is either still running or just finished
+internal void self_add_write(const char *path, b32 running)
+{
+    u64 hash = self_path_hash(path);
+    if (!hash) return;
+    self_write_slot(hash)->until_ms = running ? UINT64_MAX : timer_now_ms() + SELF_GRACE_MS;
+}
+
+internal void self_run_begin(void)
+{
+    if (self_enabled && !self_precise) ail_da_push(&self_windows, ((SelfWindow){ .start_ms = timer_now_ms(), .end_ms = UINT64_MAX }));
+}
+
+internal void self_run_end(void)
+{
+    if (self_windows.len) self_windows.data[self_windows.len - 1].end_ms = timer_now_ms();
+}
+
+internal b32 self_written(Change *change)
+{
+    if (self_precise) {
+        for (u32 k = 0; k < 2; k++) {
+            const char *path = k ? change->old_path : change->path;
+            u64 hash = path ? self_path_hash(path) : 0;
+            if (!hash || !self_writes_cap) continue;
+            u32 mask = self_writes_cap - 1;
+            for (u32 i = (u32)hash & mask; self_writes[i].hash; i = (i + 1) & mask) {
+                if (self_writes[i].hash == hash) {
+                    if (change->ms <= self_writes[i].until_ms) return true;
+                    break;
+                }
+            }
+        }
+        return false;
+    }
+    for (u32 i = 0; i < self_windows.len; i++) {
+        SelfWindow *window = &self_windows.data[i];
+        u64 end = window->end_ms == UINT64_MAX ? UINT64_MAX : window->end_ms + SELF_GRACE_MS;
+        if (change->ms >= window->start_ms && change->ms <= end) return true;
+    }
+    return false;
+}
+
+// Drops the changes of the batch, that the commands made themselves, and returns whether any groups still need to run
+// @Note: All changes reported so far are in the batch, so writes and runs that can't be attributed anymore are forgotten afterwards
+internal b32 self_filter(Batch *batch)
+{
+    if (!self_enabled) return batch->rules != 0;
+    changes_resolve_reset();
+    u32 n = 0, dropped = 0;
+    batch->rules = 0;
+    for (u32 i = 0; i < batch->changes.len; i++) {
+        Change *change = &batch->changes.data[i];
+        if (self_written(change)) {
+            runlog_printf("### Ignoring %s, since it was written by the commands\n", change->path);
+            changes_free(change);
+            dropped++;
+        } else {
+            batch->changes.data[n++] = *change;
+            batch->rules |= change->rules;
+        }
+    }
+    batch->changes.len = n;
+    if (dropped) log_info("Ignoring %u change%s made by the commands themselves", dropped, dropped == 1 ? "" : "s");
+
+    u64 now = timer_now_ms();
+    u32 kept = 0;
+    for (u32 i = 0; i < self_windows.len; i++) {
+        SelfWindow window = self_windows.data[i];
+        if (window.end_ms == UINT64_MAX || window.end_ms + SELF_GRACE_MS >= now) self_windows.data[kept++] = window;
+    }
+    self_windows.len = kept;
+    b32 expired = true;
+    for (u32 i = 0; i < self_writes_cap && expired; i++) {
+        expired = !self_writes[i].hash || self_writes[i].until_ms < now;
+    }
+    if (expired && self_writes_len) {
+        memset(self_writes, 0, sizeof(SelfWrite)*self_writes_cap);
+        self_writes_len = 0;
+    }
+    return batch->rules != 0;
+}
@@ -0,0 +1,422 @@
+#include "header.h"
+
+// Commands given with --server keep running after their run (i.e. development servers)
+// When a run restarts a server, the new instance is started while the previous one keeps serving
+// and the previous one is only stopped once the new one reported that it is ready, so that no request is dropped
+// Readiness is reported like for systemd services: by sending a datagram containing "READY=1" to the socket in NOTIFY_SOCKET
+// Instances that don't report it within --ready-timeout count as ready anyways, since most servers don't support it
+// With --listen, watch-exec binds the listening socket itself and passes it to every instance as fd 3 (see sd_listen_fds),
+// so that connections are queued in the socket while no instance is accepting them
+
+#if defined(_WIN32) || defined(__WIN32__)
+#else
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#   include <netdb.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#ifndef SERVER_NOTIFY_LEN
+#   define SERVER_NOTIFY_LEN 4096
+#endif
+
+typedef struct ServerStopping {
+    SubProc proc;
+    u64     deadline_ms; // Time after which the instance is killed
+    b32     forced;
+} ServerStopping;
+AIL_DA_INIT(ServerStopping);
+
+typedef struct Server {
+    Cmd    *cmd;
+    int     listen_fd; // -1 if the server binds its own sockets
+    int     notify_fd;
+    char    notify_path[1100];
+    SubProc current;   // Instance that is serving right now
+    b32     has_current;
+    SubProc next;      // Instance that was started, but isn't ready yet
+    b32     has_next;
+    u64     ready_deadline_ms; // Time at which the next instance counts as ready without reporting it (0 to wait for it forever)
+    i32     start_res; // Result of the last started instance: 0 if it became ready, its exit code if it failed before
+    AIL_DA(ServerStopping) stopping;
+} Server;
+AIL_DA_INIT(Server);
+
+global AIL_DA(Server) servers;
+global u32            server_kill_grace_ms;
+
+internal Server *server_find(Cmd *cmd)
+{
+    for (u32 i = 0; i < servers.len; i++) {
+        if (servers.data[i].cmd == cmd) return &servers.data[i];
+    }
+    return NULL;
+}
+
+// Returns whether the instance of the server that was started last became ready or failed, storing 0 or its exit code respectively
+internal b32 server_started(Cmd *cmd, i32 *exit_code)
+{
+    Server *s = server_find(cmd);
+    if (!s) {
+        *exit_code = 1;
+        return true;
+    }
+    if (s->has_next) return false;
+    *exit_code = s->start_res;
+    return true;
+}
+
+internal void server_stop(Server *s, SubProc proc)
+{
+    subproc_kill(&proc, false);
+    ail_da_push(&s->stopping, ((ServerStopping){ .proc = proc, .deadline_ms = timer_now_ms() + server_kill_grace_ms }));
+}
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+// @TODO: Processes are still run synchronously on Windows, so they can't be kept running in the background
+internal b32 server_init(RuleList *rules, u32 kill_grace_ms)
+{
+    AIL_UNUSED(kill_grace_ms);
+    for (u32 r = 0; r < rules->len; r++) {
+        for (u32 i = 0; i < rules->data[r].cmds.len; i++) {
+            if (!rules->data[r].cmds.data[i].server) continue;
+            log_err("Running '%s' as a server is not supported on Windows yet", rules->data[r].cmds.data[i].str);
+            return false;
+        }
+    }
+    return true;
+}
+
+internal b32 server_start(Cmd *cmd, AIL_DA(str) *argv)
+{
+    AIL_UNUSED(cmd);
+    AIL_UNUSED(argv);
+    return false;
+}
+
+internal void server_cancel(Cmd *cmd)
+{
+    AIL_UNUSED(cmd);
+}
+
+internal void server_handle(ReactorEvent ev)
+{
+    AIL_UNUSED(ev);
+}
+
+internal void server_update(void)
+{
+}
+
+internal i32 server_poll_interval(void)
+{
+    return -1;
+}
+
+internal void server_stop_all(void)
+{
+}
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+// Binds a listening TCP socket to an address of the form '[<host>:]<port>', where IPv6 hosts are put in brackets
+internal int server_bind(const char *addr)
+{
+    char host[256] = {0};
+    const char *port = addr;
+    const char *colon = strrchr(addr, ':');
+    if (colon) {
+        const char *start = addr, *end = colon;
+        if (*start == '[' && end > start && end[-1] == ']') {
+            start++;
+            end--;
+        }
+        snprintf(host, sizeof(host), "%.*s", (int)(end - start), start);
+        port = colon + 1;
+    }
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+    struct addrinfo *infos;
+    int err = getaddrinfo(host[0] ? host : NULL, port, &hints, &infos);
+    if (err) {
+        log_err("Could not resolve the address '%s': %s", addr, gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *info = infos; info && fd < 0; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd < 0) continue;
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (bind(fd, info->ai_addr, info->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0) {
+            err = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(infos);
+    if (fd < 0) {
+        log_err("Could not listen on '%s': %s", addr, strerror(err));
+        return -1;
+    }
+    // @Note: The socket is moved above fd 3, since dup2 onto the same fd wouldn't clear FD_CLOEXEC for the child
+    int moved = fcntl(fd, F_DUPFD_CLOEXEC, 4);
+    close(fd);
+    return moved;
+}
+
+internal int server_notify_socket(const char *path)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        log_err("The path of the notification socket '%s' is too long", path);
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    unlink(path);
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        log_err("Could not create the notification socket '%s': %s", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+#if defined(__linux__)
+    // @Note: The credentials of the sender tell which instance a notification came from
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on));
+#endif
+    return fd;
+}
+
+// Creates the notification sockets of all servers and binds the sockets they listen on
+internal b32 server_init(RuleList *rules, u32 kill_grace_ms)
+{
+    server_kill_grace_ms = kill_grace_ms;
+    servers = ail_da_new_t(Server);
+    for (u32 r = 0; r < rules->len; r++) {
+        for (u32 i = 0; i < rules->data[r].cmds.len; i++) {
+            Cmd *cmd = &rules->data[r].cmds.data[i];
+            if (!cmd->server) continue;
+            Server s = { .cmd = cmd, .listen_fd = -1, .stopping = ail_da_new_t(ServerStopping) };
+            snprintf(s.notify_path, sizeof(s.notify_path), "%s/notify-%u.sock", changes_tmp_base, servers.len);
+            s.notify_fd = server_notify_socket(s.notify_path);
+            if (s.notify_fd < 0) return false;
+            if (cmd->listen) {
+                s.listen_fd = server_bind(cmd->listen);
+                if (s.listen_fd < 0) return false;
+            }
+            reactor_add(s.notify_fd, REACTOR_NOTIFY, servers.len);
+            ail_da_push(&servers, s);
+        }
+    }
+    return true;
+}
+
+// Starts a new instance of the server, which replaces the current one once it is ready
+internal b32 server_start(Cmd *cmd, AIL_DA(str) *argv)
+{
+    Server *s = server_find(cmd);
+    if (!s) return false;
+    if (s->has_next) {
+        server_stop(s, s->next);
+        s->has_next = false;
+    }
+    SubProcOpts opts = { .listen_fds = &s->listen_fd, .n_listen_fds = s->listen_fd >= 0 };
+    subproc_set_env("NOTIFY_SOCKET", s->notify_path);
+    b32 ok = subproc_start(&s->next, argv, cmd->str, opts, ail_default_allocator);
+    subproc_set_env("NOTIFY_SOCKET", NULL);
+    if (!ok) return false;
+    s->has_next = true;
+    s->ready_deadline_ms = cmd->ready_timeout ? timer_now_ms() + cmd->ready_timeout : 0;
+    return true;
+}
+
+// Stops the instance, that was started for a run that was cancelled, while the current instance keeps serving
+internal void server_cancel(Cmd *cmd)
+{
+    Server *s = server_find(cmd);
+    if (!s || !s->has_next) return;
+    server_stop(s, s->next);
+    s->has_next  = false;
+    s->start_res = 1;
+}
+
+// Replaces the current instance with the next one
+internal void server_promote(Server *s)
+{
+    if (s->has_current) {
+        log_info("'%s' is ready, stopping its previous instance...", s->cmd->str);
+        server_stop(s, s->current);
+    }
+    s->current     = s->next;
+    s->has_current = true;
+    s->has_next    = false;
+    s->start_res   = 0;
+}
+
+// Returns whether the notification was sent by a process of the next instance
+// @Note: Without the sender's credentials (on other systems than Linux), all notifications are attributed to it
+internal b32 server_from_next(Server *s, struct msghdr *msg)
+{
+#if defined(__linux__)
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_CREDENTIALS) continue;
+        struct ucred cred;
+        memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+        // Each instance runs in its own process group, whose id is the pid of the instance
+        return cred.pid == s->next.pid || getpgid(cred.pid) == s->next.pid;
+    }
+    return false;
+#else
+    AIL_UNUSED(s);
+    AIL_UNUSED(msg);
+    return true;
+#endif
+}
+
+internal void server_read_notify(Server *s)
+{
+    char data[SERVER_NOTIFY_LEN + 1];
+    union { struct cmsghdr align; char data[256]; } ctrl;
+    for (;;) {
+        struct iovec  iov = { .iov_base = data, .iov_len = SERVER_NOTIFY_LEN };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.data, .msg_controllen = sizeof(ctrl.data) };
+        ssize_t n = recvmsg(s->notify_fd, &msg, 0);
+        if (n < 0) break;
+        data[n] = 0;
+        b32 ready = false;
+        AIL_SV lines = ail_sv_from_parts(data, n);
+        while (lines.len) ready |= ail_sv_eq(ail_sv_trim(ail_sv_split_next_char(&lines, '\n', true)), SV_LIT_T("READY=1"));
+        // @Note: Notifications of the current or stopping instances (i.e. after they reloaded themselves) are ignored
+        if (ready && s->has_next && server_from_next(s, &msg)) server_promote(s);
+    }
+}
+
+// Checks whether any instance of the server exited
+internal void server_reap(Server *s)
+{
+    if (s->has_next && subproc_reap(&s->next)) {
+        s->start_res = s->next.res.exitCode ? s->next.res.exitCode : 1;
+        s->has_next  = false;
+        log_warn("'%s' exited with code %d before it was ready", s->cmd->str, s->next.res.exitCode);
+    }
+    if (s->has_current && subproc_reap(&s->current)) {
+        s->has_current = false;
+        log_warn("'%s' exited with code %d", s->cmd->str, s->current.res.exitCode);
+    }
+    for (u32 i = 0; i < s->stopping.len; ) {
+        if (subproc_reap(&s->stopping.data[i].proc)) s->stopping.data[i] = s->stopping.data[--s->stopping.len];
+        else i++;
+    }
+}
+
+internal void server_handle(ReactorEvent ev)
+{
+    if (ev.kind == REACTOR_NOTIFY) {
+        if (ev.id < servers.len) server_read_notify(&servers.data[ev.id]);
+        return;
+    }
+    if (ev.kind != REACTOR_OUTPUT && ev.kind != REACTOR_EXIT) return;
+    for (u32 i = 0; i < servers.len; i++) {
+        Server *s = &servers.data[i];
+        if (ev.kind == REACTOR_OUTPUT) {
+            if (s->has_next    && (u32)s->next.pid    == ev.id) subproc_handle_output(&s->next);
+            if (s->has_current && (u32)s->current.pid == ev.id) subproc_handle_output(&s->current);
+            for (u32 j = 0; j < s->stopping.len; j++) {
+                if ((u32)s->stopping.data[j].proc.pid == ev.id) subproc_handle_output(&s->stopping.data[j].proc);
+            }
+        }
+        server_reap(s);
+    }
+}
+
+// Kills the instances, that didn't stop during the grace period, and checks whether instances, whose exit isn't reported by the reactor, exited
+internal void server_update(void)
+{
+    u64 now = timer_now_ms();
+    for (u32 i = 0; i < servers.len; i++) {
+        Server *s = &servers.data[i];
+        for (u32 j = 0; j < s->stopping.len; j++) {
+            ServerStopping *stop = &s->stopping.data[j];
+            if (stop->forced || now < stop->deadline_ms) continue;
+            log_warn("Killing the previous instance of '%s', that is still running after %ums", s->cmd->str, server_kill_grace_ms);
+            subproc_kill(&stop->proc, true);
+            stop->forced = true;
+        }
+        server_reap(s);
+        if (s->has_next && s->ready_deadline_ms && now >= s->ready_deadline_ms) {
+            log_info("'%s' didn't report that it's ready within %ums, so it counts as ready", s->cmd->str, s->cmd->ready_timeout);
+            server_promote(s);
+        }
+    }
+}
+
+// Returns after how many milliseconds server_update needs to be called again or -1 if the reactor reports everything
+internal i32 server_poll_interval(void)
+{
+    i32 timeout_ms = -1;
+    u64 now = timer_now_ms();
+    for (u32 i = 0; i < servers.len; i++) {
+        Server *s = &servers.data[i];
+        for (u32 j = 0; j < s->stopping.len; j++) {
+            ServerStopping *stop = &s->stopping.data[j];
+            i32 interval = subproc_poll_interval(&stop->proc);
+            if (!stop->forced) {
+                i32 left = now >= stop->deadline_ms ? 0 : (i32)(stop->deadline_ms - now);
+                if (interval < 0 || left < interval) interval = left;
+            }
+            if (interval >= 0 && (timeout_ms < 0 || interval < timeout_ms)) timeout_ms = interval;
+        }
+        // @Note: Instances that are serving are only checked once their output was closed
+        if (s->has_next) {
+            i32 interval = subproc_poll_interval(&s->next);
+            if (s->ready_deadline_ms) {
+                i32 left = now >= s->ready_deadline_ms ? 0 : (i32)(s->ready_deadline_ms - now);
+                if (interval < 0 || left < interval) interval = left;
+            }
+            if (interval >= 0 && (timeout_ms < 0 || interval < timeout_ms)) timeout_ms = interval;
+        }
+        if (s->has_current && s->current.out_fd < 0) {
+            i32 interval = subproc_poll_interval(&s->current);
+            if (interval >= 0 && (timeout_ms < 0 || interval < timeout_ms)) timeout_ms = interval;
+        }
+    }
+    return timeout_ms;
+}
+
+// Stops all instances of all servers, killing them if they're still running after the grace period
+internal void server_stop_all(void)
+{
+    for (u32 i = 0; i < servers.len; i++) {
+        Server *s = &servers.data[i];
+        if (s->has_current) server_stop(s, s->current);
+        if (s->has_next)    server_stop(s, s->next);
+        s->has_current = s->has_next = false;
+        while (s->stopping.len) {
+            ServerStopping *stop = &s->stopping.data[0];
+            u64 now = timer_now_ms();
+            if (!stop->forced && now >= stop->deadline_ms) {
+                subproc_kill(&stop->proc, true);
+                stop->forced = true;
+            }
+            if (subproc_wait_any(&stop->proc, 1, stop->forced ? -1 : (i32)(stop->deadline_ms - now)) >= 0) {
+                s->stopping.data[0] = s->stopping.data[--s->stopping.len];
+            }
+        }
+        reactor_remove(s->notify_fd);
+        close(s->notify_fd);
+        unlink(s->notify_path);
+    }
+}
+
+#endif
@@ -14,21 +14,125 @@
 #   include <sys/stat.h>
 #   include <termios.h>
 #   include <unistd.h>
+#   include <fcntl.h>
+#   include <spawn.h>
+#   include <poll.h>
+#   include <signal.h>
+#   include <sys/syscall.h>
+#   include <sys/ioctl.h>
 #	include <stdio.h>
+    extern char **environ;
+#   if !defined(POSIX_SPAWN_SETSID)
+#       define POSIX_SPAWN_SETSID 0 // Only used with a pseudo-terminal, which is only supported on Linux
+#   endif
 #endif // _WIN32
 
+#ifndef SUBPROC_LOG_CMD_LEN
+#   define SUBPROC_LOG_CMD_LEN 256
+#endif
+
+#ifndef SUBPROC_LABEL_LEN
+#   define SUBPROC_LABEL_LEN 40 // Maximum length of the command shown in front of its output lines when the log is structured
+#endif
+
+#ifndef SUBPROC_MARKER
+#   define SUBPROC_MARKER "WATCH_EXEC_DONE" // Start of the line, with which workers report that they finished a batch (see worker.c)
+#endif
+
+#ifndef SUBPROC_CAPTURE_MAX
+#   define SUBPROC_CAPTURE_MAX (1 << 20) // Captured output is dropped once it grows larger than this
+#endif
+
+#ifndef SUBPROC_SPAWN_FDS
+#   define SUBPROC_SPAWN_FDS 8 // Maximum amount of fds passed to a child: stdin, stdout, stderr and the sockets of a server
+#endif
+
+#ifndef SUBPROC_RING_SIZE
+#   define SUBPROC_RING_SIZE 4096 // Size of the buffer for each child's output, must be a power of two
+#endif
+AIL_STATIC_ASSERT((SUBPROC_RING_SIZE & (SUBPROC_RING_SIZE - 1)) == 0);
+
+typedef void SubProcMarkerFn(void *user, i32 code);
+
+// Output of a child process that wasn't printed yet, because the line isn't complete yet
+// The positions only ever grow and are wrapped around when indexing into the buffer
+typedef struct SubProcRing {
+    char buf[SUBPROC_RING_SIZE];
+    u32  head;    // Position of the first byte that wasn't printed yet
+    u32  tail;    // Position after the last byte that was read
+    u32  scanned; // Position up to which the buffer was searched for newlines already
+    u32  line;    // Position after the last newline
+    AnsiFilter  filter;
+    const char *label;    // Command that is shown in front of each line when the log is structured
+    b32         mid_line; // Whether the last printed output didn't end with a newline
+    SubProcMarkerFn *on_marker;   // If set, lines starting with SUBPROC_MARKER are passed to it instead of being printed
+    void            *marker_user;
+} SubProcRing;
+
 typedef struct SubProcRes {
     i32 exitCode;
     b32 finished;
 } SubProcRes;
 
+typedef struct SubProcOpts {
+    char *stdin_path; // File whose content is provided to the child as stdin (optional)
+    b32   pipe_stdin; // Connect the child's stdin to a pipe instead, whose write end is stored in proc->in_fd
+    b32   capture;    // Keep a copy of the output in proc->capture
+    int  *listen_fds; // Sockets that are passed to the child as fd 3 and following, announced via LISTEN_FDS and LISTEN_PID
+    u32   n_listen_fds;
+    str  *launcher;   // Arguments that are put in front of the command, so that it is started by them (see limits.c)
+    u32   n_launcher;
+} SubProcOpts;
+
+// A child process that was started, but not necessarily waited for yet
+typedef struct SubProc {
+    SubProcRes res; // Only valid once the process was returned by subproc_wait_any
+    AIL_DA(char) capture; // Output of the child if opts.capture was set, NULL if it was too long (needs to be freed by the caller)
+    u64 start_ms;
+    u64 output_ms; // Time at which the child last printed anything (or was started)
+#if defined(_WIN32) || defined(__WIN32__)
+    b32 done;
+#else
+    pid_t        pid;     // First process that was started, which identifies the child in the reactor's events
+    int          in_fd;   // Write end of the pipe connected to the child's stdin if opts.pipe_stdin was set, -1 otherwise
+    int          out_fd;  // Read end of the pipe connected to the child's stdout and stderr, -1 once it was closed
+    int          exit_fd; // pidfd that becomes readable once exit_pid exited, -1 if it isn't supported
+    pid_t        exit_pid;
+    b32          pty;     // Whether out_fd is the master of a pseudo-terminal instead of a pipe (see subproc_open_pty)
+    SubProcRing *out;
+    // The plan's pipelines are started one after another (see plan.c)
+    pid_t        pids[PLAN_PIPELINE_MAX];   // Processes of the running pipeline, 0 once they were reaped
+    pid_t        groups[PLAN_PIPELINE_MAX]; // Their process groups, which may outlive them
+    u32          n_pids;
+    i32          code;       // Exit code of the last pipeline
+    str         *plan;
+    u32          plan_len;
+    u32          plan_next;  // Index of the operator in front of the next pipeline
+    SubProcOpts  opts;
+    int          child_in;   // Read end of the stdin pipe, which is kept open for the following pipelines
+    int          child_out;  // Write end of the output pipe, kept open until the last pipeline started, or the pseudo-terminal's slave, kept until the end
+    char         pty_name[64];
+#endif
+} SubProc;
+
 
 // Forward declarations of functions, that all platforms need to implement
-internal SubProcRes subproc_exec_internal(AIL_DA(str) *argv, char *arg_str, AIL_Allocator allocator);
+internal b32  subproc_start_internal(SubProc *proc, AIL_DA(str) *argv, char *arg_str, SubProcOpts opts, AIL_Allocator allocator);
+internal i32  subproc_wait_any(SubProc *procs, u32 n, i32 timeout_ms);
+internal b32  subproc_reap(SubProc *proc);
+internal void subproc_handle_output(SubProc *proc);
+internal i32  subproc_poll_interval(SubProc *proc);
+internal void subproc_kill(SubProc *proc, b32 force);
+internal u32  subproc_core_count(void);
+internal char *subproc_resolve(const char *name);
+internal void subproc_set_env(const char *name, const char *value);
 internal void subproc_init(void);
+internal b32  subproc_pty_init(void);
+internal void subproc_resize_ptys(void);
 
 
 global TermState subproc_term_state;
+global b32       subproc_pty; // Run children in a pseudo-terminal, so that they behave like they would in an interactive shell
 
 
 internal void subproc_init(void)
@@ -42,46 +146,88 @@ internal void subproc_deinit(void)
 	term_set_state(subproc_term_state);
 }
 
-internal SubProcRes subproc_exec(AIL_DA(str) *argv, char *arg_str, AIL_Allocator allocator)
+// Starts the command without waiting for it to finish
+// Returns false if the process couldn't be created, in which case the result is already stored in proc->res
+internal b32 subproc_start(SubProc *proc, AIL_DA(str) *argv, char *arg_str, SubProcOpts opts, AIL_Allocator allocator)
 {
+    memset(proc, 0, sizeof(*proc));
     if (!argv->len) {
         log_err("Cannot run empty command");
-        return (SubProcRes){0};
+        return false;
     }
-    log_info("Running '%s'...", arg_str);
-    return subproc_exec_internal(argv, arg_str, allocator);
+    if (strlen(arg_str) > SUBPROC_LOG_CMD_LEN) log_info("Running '%.*s...'...", SUBPROC_LOG_CMD_LEN, arg_str);
+    else log_info("Running '%s'...", arg_str);
+    runlog_printf("### Running '%s'\n", arg_str);
+    proc->start_ms = proc->output_ms = timer_now_ms();
+    return subproc_start_internal(proc, argv, arg_str, opts, allocator);
 }
 
-internal void subproc_print_output(AIL_Str out_str)
+internal SubProcRes subproc_exec(AIL_DA(str) *argv, char *arg_str, SubProcOpts opts, AIL_Allocator allocator)
 {
-    if (out_str.len == 1 && out_str.str[0] == '\n') out_str.len = 0;
-    AIL_SV out = ail_sv_from_str(out_str);
+    SubProc proc;
+    if (subproc_start(&proc, argv, arg_str, opts, allocator)) subproc_wait_any(&proc, 1, -1);
+    return proc.res;
+}
 
-    // @Note: Certain ANSI escape codes should not be forwarded to the console to prevent weird artifacts
-    // Currently these codes are specifically some erase functions
-    // For a full list of existing ansi escape codes, see this handy cheatsheet: https://gist.github.com/ConnerWill/d4b6c776b509add763e17f9f113fd25b
-    AIL_SV forbidden_seqs[] = {
-        SV_LIT("\x1b[H"),  // Moves cursor to position 0,0
-        SV_LIT("\x1b[1J"), // Eares from cursor to beginning of screen
-        SV_LIT("\x1b[2J"), // Eares entire screen
-    };
-    // @Note: Certain ANSI escape codes may change the console state (i.e. changing color mode)
-    // thus we need to save the previous state and restore it after printing is done
-    TermState state = term_current_state;
-    while (out.len) {
-        AIL_SV_Find_Of_Res res = ail_sv_find_of(out, forbidden_seqs, AIL_ARRLEN(forbidden_seqs));
-        if (res.sv_idx < 0) {
-            printf("%s", out.str);
-            break;
-        } else {
-            char c = out.str[res.sv_idx];
-            *((char *)(out.str + res.sv_idx)) = 0;
-            printf("%s", out.str);
-            *((char *)(out.str + res.sv_idx)) = c;
-            out = ail_sv_offset(out, res.sv_idx + forbidden_seqs[res.needle_idx].len);
+// Joins the arguments into a single command line, quoting arguments that contain whitespace
+// The sentinels of a plan are skipped, except for the operators, which are shown as is
+internal char *subproc_join_argv(AIL_DA(str) *argv, AIL_Allocator allocator)
+{
+    AIL_DA(char) res = ail_da_new_with_alloc(char, SUBPROC_PIPE_SIZE, allocator);
+    for (u32 i = 0; i < argv->len; i++) {
+        char *arg = argv->data[i];
+        if (arg == plan_env) continue;
+        b32 quote = !arg[0] || strpbrk(arg, " \t\n") != NULL;
+        if (res.len) ail_da_push(&res, ' ');
+        if (quote) ail_da_push(&res, '"');
+        ail_da_pushn(&res, arg, strlen(arg));
+        if (quote) ail_da_push(&res, '"');
+    }
+    ail_da_push(&res, 0);
+    return res.data;
+}
+
+// Prints the output of a child process without the ANSI escape codes that would mess up the console
+// @Note: Certain ANSI escape codes may change the console state (i.e. changing color mode),
+// thus the caller needs to save the previous state and restore it after the process finished
+// Prints output of a child, prefixing every line with a timestamp and the command when the log is structured
+internal void subproc_print_chunk(AnsiFilter *filter, b32 *mid_line, const char *label, const char *data, u64 len)
+{
+    if (!log_structured) {
+        filter_write(filter, data, len);
+        return;
+    }
+    while (len) {
+        if (!*mid_line) {
+            char ts[32];
+            log_timestamp(ts, sizeof(ts));
+            printf("%s %-5s [%.*s] ", ts, "OUT", SUBPROC_LABEL_LEN, label);
         }
+        const char *nl = memchr(data, '\n', len);
+        u64 n = nl ? (u64)(nl - data) + 1 : len;
+        filter_write(filter, data, n);
+        *mid_line = !nl;
+        data += n;
+        len  -= n;
     }
-    term_set_state(state);
+}
+
+internal void subproc_finish_output(AnsiFilter *filter, b32 *mid_line)
+{
+    filter_finish(filter);
+    if (*mid_line) {
+        fputs("\n", stdout);
+        fflush(stdout);
+        *mid_line = false;
+    }
+}
+
+internal void subproc_print_output(AIL_SV out, const char *label)
+{
+    AnsiFilter filter = {0};
+    b32 mid_line = false;
+    subproc_print_chunk(&filter, &mid_line, label, out.str, out.len);
+    subproc_finish_output(&filter, &mid_line);
 }
 
 
@@ -90,12 +236,87 @@ internal void subproc_print_output(AIL_Str out_str)
 // Windows Implementation
 //////////////////////////
 
+internal SubProcRes subproc_exec_internal(AIL_DA(str) *argv, char *arg_str, SubProcOpts opts, AIL_Allocator allocator);
+
+internal void subproc_set_env(const char *name, const char *value)
+{
+    SetEnvironmentVariableA(name, value);
+}
+
+// CreateProcess searches the executable itself
+internal char *subproc_resolve(const char *name)
+{
+    return (char *)name;
+}
+
+internal u32 subproc_core_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
+// @TODO: Child processes are still run to completion when they are started, so several processes never run at the same time on Windows
+internal b32 subproc_start_internal(SubProc *proc, AIL_DA(str) *argv, char *arg_str, SubProcOpts opts, AIL_Allocator allocator)
+{
+    proc->res  = subproc_exec_internal(argv, arg_str, opts, allocator);
+    proc->done = true;
+    return true;
+}
+
+// @Note: Processes are run synchronously when they're started on Windows, so there is never anything to wait for
+internal b32 subproc_reap(SubProc *proc)
+{
+    b32 done = proc->done;
+    proc->done = false;
+    return done;
+}
+
+internal i32 subproc_wait_any(SubProc *procs, u32 n, i32 timeout_ms)
+{
+    AIL_UNUSED(timeout_ms);
+    for (u32 i = 0; i < n; i++) {
+        if (subproc_reap(&procs[i])) return i;
+    }
+    return -1;
+}
+
+internal void subproc_handle_output(SubProc *proc)
+{
+    AIL_UNUSED(proc);
+}
+
+internal i32 subproc_poll_interval(SubProc *proc)
+{
+    AIL_UNUSED(proc);
+    return 0;
+}
+
+// @Note: Children always run in a pseudoconsole on Windows
+internal b32 subproc_pty_init(void)
+{
+    return true;
+}
+
+internal void subproc_resize_ptys(void)
+{
+}
+
+// @TODO: Processes can't be cancelled on Windows yet, since they already finished when subproc_start returns
+internal void subproc_kill(SubProc *proc, b32 force)
+{
+    AIL_UNUSED(proc);
+    AIL_UNUSED(force);
+}
+
 // Code mostly adapted from the following documentation (with lots of experimentation until it worked properly):
 // - https://learn.microsoft.com/en-us/windows/console/creating-a-pseudoconsole-session
 // - https://learn.microsoft.com/en-us/windows/win32/ProcThread/creating-a-child-process-with-redirected-input-and-output
-internal SubProcRes subproc_exec_internal(AIL_DA(str) *argv, char *arg_str, AIL_Allocator allocator)
+internal SubProcRes subproc_exec_internal(AIL_DA(str) *argv, char *arg_str, SubProcOpts opts, AIL_Allocator allocator)
 {
     AIL_UNUSED(argv);
+    // @TODO: Provide the content of opts.stdin_path via the pseudo console's input pipe
+    if (opts.stdin_path) log_warn("Providing changed files via stdin is not supported on Windows yet");
     SubProcRes res = {
         .exitCode = 0,
         .finished = false,
@@ -197,10 +418,14 @@ internal SubProcRes subproc_exec_internal(AIL_DA(str) *argv, char *arg_str, AIL_
         if (nBytesRead < n) break;
         ail_da_resize(&buf, buf.len + SUBPROC_PIPE_SIZE);
     }
-    ail_da_push(&buf, 0);
-    buf.len--;
     res.finished = true;
-    subproc_print_output(ail_str_from_da_nil_term(buf));
+    // @Note: Skip the newline that we wrote ourselves if the process had no output
+    if (buf.len > 1 || (buf.len == 1 && buf.data[0] != '\n')) {
+        TermState state = term_current_state;
+        runlog_write(buf.data, buf.len);
+        subproc_print_output(ail_sv_from_parts(buf.data, buf.len), arg_str);
+        term_set_state(state);
+    }
 
 done:
     if (pipe_in_read)        CloseHandle(pipe_in_read);
@@ -220,59 +445,665 @@ done:
 // POSIX Implementation
 ////////////////////////
 
-SubProcRes subproc_exec_internal(AIL_DA(str) *argv, char *arg_str, AIL_Allocator allocator)
+// Everything needed to start a single process, either by watch-exec itself or by the zygote (see zygote.c)
+typedef struct SubProcSpawn {
+    char       *exe;      // NULL to search argv[0] in PATH
+    char      **argv;     // NULL-terminated
+    char      **env;      // NULL-terminated
+    const char *in_path;  // Opened as stdin if fds[0] is -1
+    const char *pty_name; // Opened as stderr in a new session instead of duplicating fds[2], if set
+    int         fds[SUBPROC_SPAWN_FDS]; // Duplicated onto the fd with the same index, fds[1] may be -1 to duplicate stderr
+    u32         n_fds;
+} SubProcSpawn;
+
+// Implemented in zygote.c, which starts the processes instead of watch-exec itself with --zygote
+internal int   zygote_spawn(SubProcSpawn *spawn, pid_t *pid);
+internal pid_t zygote_waitpid(pid_t pid, int *wstatus);
+internal int   zygote_exit_fd(pid_t pid);
+internal void  zygote_handle(void);
+
+internal void subproc_set_env(const char *name, const char *value)
 {
-    AIL_UNUSED(arg_str);
-    SubProcRes res = { 0 };
-    int pipefd[2] = {0};
-    if (pipe(pipefd) < 0) {
-    	memset(pipefd, 0, sizeof(pipefd));
-        log_err("Could not establish pipe to child process: %s", strerror(errno));
-        goto done;
+    if (value) setenv(name, value, 1);
+    else       unsetenv(name);
+}
+
+internal u32 subproc_core_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (u32)n : 1;
+}
+
+typedef struct SubProcExe {
+    char *name;
+    char *path; // NULL if the executable couldn't be found
+} SubProcExe;
+AIL_DA_INIT(SubProcExe);
+
+global AIL_DA(str)        subproc_path_dirs;
+global AIL_DA(SubProcExe) subproc_exes;
+
+// Returns the full path of the executable, searching the directories in PATH only the first time a name is resolved
+// Returns NULL if the executable couldn't be found
+internal char *subproc_resolve(const char *name)
+{
+    if (strchr(name, '/')) return (char *)name;
+    for (u32 i = 0; i < subproc_exes.len; i++) {
+        if (!strcmp(subproc_exes.data[i].name, name)) return subproc_exes.data[i].path;
+    }
+    if (!subproc_path_dirs.data) {
+        subproc_path_dirs = ail_da_new_t(str);
+        subproc_exes      = ail_da_new_t(SubProcExe);
+        char *path = getenv("PATH");
+        if (!path) path = "/usr/local/bin:/bin:/usr/bin";
+        AIL_SV dirs = ail_sv_from_cstr(path);
+        while (dirs.len) {
+            AIL_SV dir = ail_sv_split_next_char(&dirs, ':', false);
+            ail_da_push(&subproc_path_dirs, dir.len ? ail_sv_to_cstr(dir) : ".");
+        }
     }
+    SubProcExe exe = { .name = strdup(name), .path = NULL };
+    char buf[4096];
+    for (u32 i = 0; i < subproc_path_dirs.len && !exe.path; i++) {
+        snprintf(buf, sizeof(buf), "%s/%s", subproc_path_dirs.data[i], name);
+        struct stat st;
+        if (!access(buf, X_OK) && !stat(buf, &st) && S_ISREG(st.st_mode)) exe.path = strdup(buf);
+    }
+    ail_da_push(&subproc_exes, exe);
+    return exe.path;
+}
 
-    AIL_DA(char) da = ail_da_new_with_alloc(char, SUBPROC_PIPE_SIZE, allocator);
-    char buf[SUBPROC_PIPE_SIZE] = {0};
-    pid_t cpid = fork();
-    if (cpid < 0) {
-        log_err("Could not create child process");
-        goto done;
-    } else if (cpid == 0) { // Run by child
-        ail_da_push(argv, NULL);
-        close(pipefd[0]);
-        execvp(argv->data[0], (char* const*) argv->data);
-        while (read(STDOUT_FILENO, buf, SUBPROC_PIPE_SIZE) != EOF) {
-            u64 len = strlen(buf);
-            ail_da_pushn(&da, buf, len);
-            memset(buf, 0, len);
+#if defined(__linux__)
+AIL_DA_INIT(int);
+global AIL_DA(int) subproc_pty_fds; // Masters of the pseudo-terminals of all running children
+#endif
+
+internal b32 subproc_pty_init(void)
+{
+#if defined(__linux__)
+    subproc_pty_fds = ail_da_new_t(int);
+    return true;
+#else
+    // @TODO: Needs POSIX_SPAWN_SETSID, which macOS only supports since 10.15, and a different way to acquire the controlling terminal
+    log_err("Running commands in a pseudo-terminal is only supported on Linux");
+    return false;
+#endif
+}
+
+internal struct winsize subproc_pty_size(void)
+{
+    struct winsize ws = {0};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || !ws.ws_col || !ws.ws_row) ws = (struct winsize){ .ws_row = 24, .ws_col = 80 };
+    return ws;
+}
+
+// Passes the terminal's new size on to all pseudo-terminals, which send SIGWINCH to the children
+internal void subproc_resize_ptys(void)
+{
+#if defined(__linux__)
+    struct winsize ws = subproc_pty_size();
+    for (u32 i = 0; i < subproc_pty_fds.len; i++) ioctl(subproc_pty_fds.data[i], TIOCSWINSZ, &ws);
+#endif
+}
+
+// Opens a pseudo-terminal with the size of watch-exec's terminal, whose slave is opened by the child as its controlling terminal
+// Like a pipe, the master is fds[0] and the slave fds[1], which keeps the pseudo-terminal open until the child was reaped
+// @Note: Output processing is turned off, so that newlines aren't turned into "\r\n"
+internal b32 subproc_open_pty(int fds[2], char *name, u32 name_len)
+{
+#if defined(__linux__)
+    fds[0] = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fds[0] < 0 || grantpt(fds[0]) < 0 || unlockpt(fds[0]) < 0 || ptsname_r(fds[0], name, name_len) != 0) {
+        if (fds[0] >= 0) close(fds[0]);
+        return false;
+    }
+    struct winsize ws = subproc_pty_size();
+    ioctl(fds[0], TIOCSWINSZ, &ws);
+    fds[1] = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fds[1] < 0) {
+        close(fds[0]);
+        return false;
+    }
+    struct termios attrs;
+    if (!tcgetattr(fds[1], &attrs)) {
+        attrs.c_oflag &= ~(tcflag_t)OPOST;
+        attrs.c_lflag &= ~(tcflag_t)ECHO;
+        tcsetattr(fds[1], TCSANOW, &attrs);
+    }
+    ail_da_push(&subproc_pty_fds, fds[0]);
+    return true;
+#else
+    AIL_UNUSED(fds);
+    AIL_UNUSED(name);
+    AIL_UNUSED(name_len);
+    return false;
+#endif
+}
+
+internal void subproc_close_out_fd(SubProc *proc)
+{
+#if defined(__linux__)
+    for (u32 i = 0; proc->pty && i < subproc_pty_fds.len; i++) {
+        if (subproc_pty_fds.data[i] == proc->out_fd) subproc_pty_fds.data[i--] = subproc_pty_fds.data[--subproc_pty_fds.len];
+    }
+#endif
+    reactor_remove(proc->out_fd);
+    close(proc->out_fd);
+    proc->out_fd = -1;
+}
+
+// @Note: posix_spawn doesn't copy the parent's page tables like fork does (glibc uses clone with CLONE_VM|CLONE_VFORK),
+// so starting a process stays cheap, no matter how much memory watch-exec uses
+// Returns a pidfd for the process or -1 if they aren't supported
+internal int subproc_pidfd_open(pid_t pid)
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    int fd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (fd >= 0) fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+#else
+    AIL_UNUSED(pid);
+    return -1;
+#endif
+}
+
+// Builds the environment of a command, in which the variables assigned in front of it replace the inherited ones
+// Returns environ itself if the command doesn't assign any, otherwise the result needs to be freed by the caller
+internal char **subproc_build_env(str *args, u32 from, u32 to)
+{
+    u32 n_assigns = 0, n_env = 0;
+    for (u32 i = from; i < to; i++) n_assigns += args[i] == plan_env;
+    if (!n_assigns) return environ;
+    while (environ[n_env]) n_env++;
+    char **env = AIL_CALL_ALLOC(ail_default_allocator, sizeof(char *)*(n_env + n_assigns + 1));
+    u32 n = 0;
+    for (u32 i = 0; i < n_env; i++) {
+        b32 replaced = false;
+        for (u32 j = from; j + 1 < to && !replaced; j++) {
+            if (args[j] != plan_env) continue;
+            u64 len = strchr(args[j + 1], '=') - args[j + 1] + 1;
+            replaced = !strncmp(environ[i], args[j + 1], len);
+        }
+        if (!replaced) env[n++] = environ[i];
+    }
+    for (u32 i = from; i + 1 < to; i++) {
+        if (args[i] == plan_env) env[n++] = args[i + 1];
+    }
+    env[n] = NULL;
+    return env;
+}
+
+// Starts the process right away and returns 0 or the error reported by posix_spawn
+internal int subproc_spawn_direct(SubProcSpawn *spawn, pid_t *pid)
+{
+    // @Note: Each child gets its own process group, so that everything it started can be stopped together when the run is cancelled
+    // Since that group isn't in the terminal's foreground, the child can't read from the terminal and gets /dev/null as stdin instead
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (spawn->fds[0] >= 0) posix_spawn_file_actions_adddup2(&actions, spawn->fds[0], STDIN_FILENO);
+    else posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, spawn->in_path, O_RDONLY, 0);
+    // @Note: With a pseudo-terminal, the child starts a new session instead, in which opening the slave makes it the controlling terminal
+    if (spawn->pty_name) posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, spawn->pty_name, O_RDWR, 0);
+    else                 posix_spawn_file_actions_adddup2(&actions, spawn->fds[2], STDERR_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, spawn->fds[1] >= 0 ? spawn->fds[1] : STDERR_FILENO, STDOUT_FILENO);
+    for (u32 i = 3; i < spawn->n_fds; i++) posix_spawn_file_actions_adddup2(&actions, spawn->fds[i], i);
+    // @Note: The reactor blocks or handles some signals itself, which the child shouldn't inherit
+    sigset_t no_signals, default_signals;
+    sigemptyset(&no_signals);
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGINT);
+    sigaddset(&default_signals, SIGTERM);
+    sigaddset(&default_signals, SIGHUP);
+    sigaddset(&default_signals, SIGPIPE);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, (spawn->pty_name ? POSIX_SPAWN_SETSID : POSIX_SPAWN_SETPGROUP) | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+    int err = spawn->exe ? posix_spawn(pid, spawn->exe, &actions, &attr, spawn->argv, spawn->env)
+                         : posix_spawnp(pid, spawn->argv[0], &actions, &attr, spawn->argv, spawn->env);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return err;
+}
+
+// Starts the command [from, to) of the plan with the given stdin and stdout (-1 for the defaults, i.e. the output pipe)
+// Returns 0 if it couldn't be started, which is already reported then
+internal pid_t subproc_spawn(SubProc *proc, u32 from, u32 to, int in, int out)
+{
+    SubProcOpts *opts = &proc->opts;
+    AIL_ASSERT(3 + opts->n_listen_fds <= SUBPROC_SPAWN_FDS);
+    // @Note: LISTEN_PID needs to be the pid of the command itself, which posix_spawn only returns afterwards,
+    // so the command is started via a shell, that sets it to its own pid before replacing itself with the command
+    AIL_DA(str) argv = ail_da_new_t(str);
+    char script[96];
+    ail_da_pushn(&argv, opts->launcher, opts->n_launcher);
+    if (opts->n_listen_fds) {
+        snprintf(script, sizeof(script), "export LISTEN_PID=$$ LISTEN_FDS=%u; exec \"$0\" \"$@\"", opts->n_listen_fds);
+        ail_da_push(&argv, "/bin/sh");
+        ail_da_push(&argv, "-c");
+        ail_da_push(&argv, script);
+    }
+    for (u32 i = from; i < to; i++) {
+        if (proc->plan[i] == plan_env) i++;
+        else ail_da_push(&argv, proc->plan[i]);
+    }
+    ail_da_push(&argv, NULL); // The arguments need to be NULL-terminated
+    // @Note: Executables that didn't exist yet when they were first resolved are searched by posix_spawnp instead
+    // Only the last command of a pipeline starts a session, since a session leader exiting early would hang up the commands after it
+    SubProcSpawn spawn = {
+        .exe      = subproc_resolve(argv.data[0]),
+        .argv     = argv.data,
+        .env      = subproc_build_env(proc->plan, from, to),
+        .in_path  = opts->stdin_path ? opts->stdin_path : "/dev/null",
+        .pty_name = proc->pty && out < 0 ? proc->pty_name : NULL,
+        .fds      = { in, out, proc->child_out },
+        .n_fds    = 3 + opts->n_listen_fds,
+    };
+    for (u32 i = 0; i < opts->n_listen_fds; i++) spawn.fds[3 + i] = opts->listen_fds[i];
+    pid_t pid = 0;
+    int err = zygote_spawn(&spawn, &pid);
+    if (err < 0) err = subproc_spawn_direct(&spawn, &pid);
+    if (err) {
+        log_err("Could not execute '%s': %s", argv.data[0], strerror(err));
+        pid = 0;
+    }
+    if (spawn.env != environ) AIL_CALL_FREE(ail_default_allocator, spawn.env);
+    ail_da_free(&argv);
+    return pid;
+}
+
+// @Note: The slave of a pseudo-terminal is kept open until the plan is done, unless `all` is set, since the master would
+// report the end of the output as soon as the child closed its side while exiting, and closing the master then hangs up the child
+internal void subproc_close_child_fds(SubProc *proc, b32 all)
+{
+    if (proc->child_in >= 0) close(proc->child_in);
+    proc->child_in = -1;
+    if (proc->child_out >= 0 && (all || !proc->pty)) {
+        close(proc->child_out);
+        proc->child_out = -1;
+    }
+}
+
+// Watches one of the processes of the pipeline, that are still running, for exiting, so that the reactor reports it
+internal void subproc_watch_exit(SubProc *proc)
+{
+    if (proc->exit_fd >= 0) {
+        reactor_remove(proc->exit_fd);
+        close(proc->exit_fd);
+        proc->exit_fd = -1;
+    }
+    for (u32 i = proc->n_pids; i-- > 0; ) {
+        if (!proc->pids[i]) continue;
+        proc->exit_pid = proc->pids[i];
+        // @Note: Only the zygote can wait for the processes it started, so it reports their exits itself
+        if (zygote_exit_fd(proc->exit_pid) >= 0) return;
+        proc->exit_fd  = subproc_pidfd_open(proc->exit_pid);
+        if (proc->exit_fd >= 0 && !reactor_add(proc->exit_fd, REACTOR_EXIT, (u32)proc->pid)) {
+            close(proc->exit_fd);
+            proc->exit_fd = -1;
+        }
+        return;
+    }
+}
+
+// Starts the pipeline [from, to) of the plan, in which the output of each command is connected to the input of the next one
+// Returns false if none of its commands could be started, in which case its exit code is 127 like in a shell
+internal b32 subproc_start_pipeline(SubProc *proc, u32 from, u32 to)
+{
+    b32 started = false;
+    int in = proc->child_in;
+    proc->n_pids = 0;
+    proc->code   = 127;
+    for (u32 i = from, end; i < to; i = end + 1) {
+        end = plan_find_end(proc->plan, i, to, false);
+        int pipefd[2] = { -1, -1 };
+        if (end < to) {
+            if (pipe(pipefd) < 0) {
+                log_err("Could not establish pipe between the commands: %s", strerror(errno));
+                // @Note: The commands after it count as not started, so that the pipeline's exit code doesn't depend on the earlier ones
+                proc->pids[proc->n_pids] = proc->groups[proc->n_pids] = 0;
+                proc->n_pids++;
+                break;
+            }
+            fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+            fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+        }
+        pid_t pid = subproc_spawn(proc, i, end, in, pipefd[1]);
+        if (in >= 0 && in != proc->child_in) close(in);
+        if (pipefd[1] >= 0) close(pipefd[1]);
+        in = pipefd[0];
+        proc->pids[proc->n_pids] = proc->groups[proc->n_pids] = pid;
+        proc->n_pids++;
+        if (pid && !proc->pid) proc->pid = pid;
+        started |= pid != 0;
+    }
+    if (in >= 0 && in != proc->child_in) close(in);
+    return started;
+}
+
+// Starts the next pipeline of the plan, that runs according to its operator and the exit code of the previous one
+// Returns false once the rest of the plan doesn't run
+internal b32 subproc_start_next(SubProc *proc)
+{
+    while (proc->plan_next < proc->plan_len) {
+        u32 from = proc->plan_next;
+        b32 run  = true;
+        // @Note: Like in a shell, skipped pipelines keep the exit code, i.e. 'a && b || c' runs c if a failed
+        if (from) {
+            char *op = proc->plan[from++];
+            run = op == plan_seq || (op == plan_and) == (proc->code == 0);
+        }
+        proc->plan_next = plan_find_end(proc->plan, from, proc->plan_len, true);
+        if (run && subproc_start_pipeline(proc, from, proc->plan_next)) {
+            // @Note: Otherwise the end of the output would only be noticed once the last pipeline was reaped
+            if (proc->plan_next == proc->plan_len) subproc_close_child_fds(proc, false);
+            subproc_watch_exit(proc);
+            return true;
+        }
+    }
+    subproc_close_child_fds(proc, false);
+    return false;
+}
+
+// Copies the plan into a single allocation, since the jobs it belongs to are freed while workers keep running
+// @Note: The operators and assignment markers are compared by address, so they aren't copied
+internal str *subproc_copy_plan(AIL_DA(str) *argv)
+{
+    u64 size = sizeof(str)*argv->len;
+    for (u32 i = 0; i < argv->len; i++) {
+        if (!plan_is_op(argv->data[i]) && argv->data[i] != plan_env) size += strlen(argv->data[i]) + 1;
+    }
+    str  *plan = AIL_CALL_ALLOC(ail_default_allocator, size);
+    char *next = (char *)(plan + argv->len);
+    for (u32 i = 0; i < argv->len; i++) {
+        if (plan_is_op(argv->data[i]) || argv->data[i] == plan_env) {
+            plan[i] = argv->data[i];
+        } else {
+            u64 len = strlen(argv->data[i]) + 1;
+            memcpy(next, argv->data[i], len);
+            plan[i] = next;
+            next   += len;
+        }
+    }
+    return plan;
+}
+
+internal void subproc_free_plan(SubProc *proc)
+{
+    if (proc->plan) AIL_CALL_FREE(ail_default_allocator, proc->plan);
+    proc->plan      = NULL;
+    proc->plan_len  = 0;
+    proc->plan_next = 0;
+}
+
+internal b32 subproc_start_internal(SubProc *proc, AIL_DA(str) *argv, char *arg_str, SubProcOpts opts, AIL_Allocator allocator)
+{
+    proc->in_fd = proc->out_fd = proc->exit_fd = proc->child_in = proc->child_out = -1;
+    int pipefd[2], in_pipefd[2] = { -1, -1 };
+    if (subproc_pty) {
+        if (!subproc_open_pty(pipefd, proc->pty_name, sizeof(proc->pty_name))) {
+            log_err("Could not open a pseudo-terminal for the child process: %s", strerror(errno));
+            return false;
         }
-        write(pipefd[1], da.data, da.len);
-        close(pipefd[1]); // Required for reader to see EOF
-    } else { // Run by parent
+    } else if (pipe(pipefd) < 0) {
+        log_err("Could not establish pipe to child process: %s", strerror(errno));
+        return false;
+    }
+    if (opts.pipe_stdin && pipe(in_pipefd) < 0) {
+        log_err("Could not establish pipe to child process: %s", strerror(errno));
+        close(pipefd[0]);
         close(pipefd[1]);
-        while (read(pipefd[0], buf, SUBPROC_PIPE_SIZE) != EOF) {
-            u64 len = strlen(buf);
-            if (!len) break;
-            ail_da_pushn(&da, buf, len);
-            memset(buf, 0, len);
+        return false;
+    }
+    // @Note: Otherwise other children started at the same time would keep the pipe open and we'd never see its end
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+    if (opts.pipe_stdin) {
+        fcntl(in_pipefd[0], F_SETFD, FD_CLOEXEC);
+        fcntl(in_pipefd[1], F_SETFD, FD_CLOEXEC);
+    }
+    proc->out_fd    = pipefd[0];
+    proc->child_out = pipefd[1];
+    proc->in_fd     = in_pipefd[1];
+    proc->child_in  = in_pipefd[0];
+    proc->pty       = subproc_pty;
+    proc->opts      = opts;
+    proc->plan      = subproc_copy_plan(argv);
+    proc->plan_len  = argv->len;
+    if (!subproc_start_next(proc)) {
+        subproc_close_child_fds(proc, true);
+        subproc_close_out_fd(proc);
+        if (proc->in_fd >= 0) close(proc->in_fd);
+        proc->in_fd = -1;
+        subproc_free_plan(proc);
+        return false;
+    }
+    if (opts.capture) proc->capture = ail_da_new_t(char);
+    proc->out = AIL_CALL_ALLOC(allocator, sizeof(SubProcRing));
+    memset(proc->out, 0, sizeof(SubProcRing));
+    proc->out->label = arg_str;
+    reactor_add(proc->out_fd, REACTOR_OUTPUT, (u32)proc->pid);
+    return true;
+}
+
+internal void subproc_ring_print_range(SubProcRing *ring, u32 from, u32 to)
+{
+    const u32 mask = SUBPROC_RING_SIZE - 1;
+    u32 len = to - from;
+    if (!len) return;
+    u32 start = from & mask;
+    u32 first = AIL_MIN(len, SUBPROC_RING_SIZE - start);
+    subproc_print_chunk(&ring->filter, &ring->mid_line, ring->label, ring->buf + start, first);
+    if (first < len) subproc_print_chunk(&ring->filter, &ring->mid_line, ring->label, ring->buf, len - first);
+}
+
+// Checks whether the complete line [from, to) is a marker, i.e. SUBPROC_MARKER optionally followed by an exit code
+internal b32 subproc_ring_marker(SubProcRing *ring, u32 from, u32 to, i32 *code)
+{
+    const u32 mask = SUBPROC_RING_SIZE - 1;
+    const u32 marker_len = sizeof(SUBPROC_MARKER) - 1;
+    char line[64];
+    u32 len = to - from;
+    if (len <= marker_len || len >= sizeof(line)) return false;
+    for (u32 i = 0; i < len; i++) line[i] = ring->buf[(from + i) & mask];
+    line[len] = 0;
+    if (memcmp(line, SUBPROC_MARKER, marker_len)) return false;
+    char *end;
+    long n = strtol(line + marker_len, &end, 10);
+    while (*end == '\r' || *end == '\n' || *end == ' ') end++;
+    if (*end) return false;
+    *code = (i32)n;
+    return true;
+}
+
+// Prints all complete lines in the buffer or everything if `flush` is set or the buffer is full
+internal void subproc_ring_print(SubProcRing *ring, b32 flush)
+{
+    const u32 mask = SUBPROC_RING_SIZE - 1;
+    for (; ring->scanned != ring->tail; ring->scanned++) {
+        if (ring->buf[ring->scanned & mask] == '\n') ring->line = ring->scanned + 1;
+    }
+    u32 end = (flush || ring->tail - ring->head == SUBPROC_RING_SIZE) ? ring->tail : ring->line;
+    if (!ring->on_marker) {
+        subproc_ring_print_range(ring, ring->head, end);
+    } else {
+        // @Note: Markers are only recognized on their own line, so lines are handled one by one
+        for (u32 from = ring->head; from != end; ) {
+            u32 to = from;
+            while (to != end && ring->buf[to & mask] != '\n') to++;
+            if (to != end) to++;
+            i32 code;
+            if (!ring->mid_line && ring->buf[(to - 1) & mask] == '\n' && subproc_ring_marker(ring, from, to, &code)) ring->on_marker(ring->marker_user, code);
+            else subproc_ring_print_range(ring, from, to);
+            from = to;
+        }
+    }
+    ring->head = end;
+    if (ring->line - ring->head > SUBPROC_RING_SIZE) ring->line = ring->head; // The last newline was flushed already
+}
+
+// Reads the currently available output of the child (but at most `max_reads` times the buffer size) and prints all complete lines
+// Returns false once the pipe was closed by the child
+internal b32 subproc_read_output(SubProc *proc, u32 max_reads)
+{
+    const u32 mask = SUBPROC_RING_SIZE - 1;
+    SubProcRing *ring = proc->out;
+    for (u32 i = 0; i < max_reads; i++) {
+        if (ring->tail - ring->head == SUBPROC_RING_SIZE) subproc_ring_print(ring, true);
+        u32 start = ring->tail & mask;
+        u32 avail = AIL_MIN(SUBPROC_RING_SIZE - (ring->tail - ring->head), SUBPROC_RING_SIZE - start);
+        // With a log file, the output is first duplicated into it inside the kernel and then exactly the duplicated bytes are read for the terminal
+        i64 teed = runlog_tee(proc->out_fd, avail);
+        if (teed > 0) avail = (u32)teed;
+        ssize_t n = read(proc->out_fd, ring->buf + start, avail);
+        if (n > 0) {
+            proc->output_ms = timer_now_ms();
+            if (teed <= 0) runlog_write(ring->buf + start, n);
+            if (proc->capture.data) {
+                if (proc->capture.len + n <= SUBPROC_CAPTURE_MAX) ail_da_pushn(&proc->capture, ring->buf + start, n);
+                else ail_da_free(&proc->capture);
+            }
+            ring->tail += (u32)n;
+            subproc_ring_print(ring, false);
+        } else if (n == 0) {
+            return false;
+        } else if (errno != EINTR) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
         }
+    }
+    return true;
+}
+
+internal void subproc_close_output(SubProc *proc)
+{
+    if (proc->in_fd >= 0) {
+        close(proc->in_fd);
+        proc->in_fd = -1;
+    }
+    if (proc->out_fd >= 0) {
+        // Read whatever is left, which is usually the final output of a process that just exited
+        // @Note: The amount is limited, since the pipe might be kept open by a still running child of the process
+        subproc_read_output(proc, 256);
+        subproc_close_out_fd(proc);
+    }
+    if (proc->exit_fd >= 0) {
+        reactor_remove(proc->exit_fd);
+        close(proc->exit_fd);
+        proc->exit_fd = -1;
+    }
+    subproc_close_child_fds(proc, true);
+    subproc_free_plan(proc);
+    if (proc->out) {
+        subproc_ring_print(proc->out, true);
+        subproc_finish_output(&proc->out->filter, &proc->out->mid_line);
+        AIL_CALL_FREE(ail_default_allocator, proc->out);
+        proc->out = NULL;
+    }
+}
+
+typedef struct pollfd SubProcPollFd;
+AIL_DA_INIT(SubProcPollFd);
+global AIL_DA(SubProcPollFd) subproc_pollfds;
+
+// Checks whether the processes of the running pipeline exited and starts the next one of the plan if so
+// Once the plan is done, its result is stored and the rest of its output is forwarded
+internal b32 subproc_reap(SubProc *proc)
+{
+    b32 running = false, watched = false;
+    for (u32 i = 0; i < proc->n_pids; i++) {
+        if (!proc->pids[i]) continue;
         int wstatus = 0;
-        if (waitpid(cpid, &wstatus, 0) < 0) {
-            log_err("Failed to wait for child process to exit");
-            goto done;
+        pid_t pid = zygote_waitpid(proc->pids[i], &wstatus);
+        if (pid < 0) {
+            if (errno == EINTR) return false;
+            log_err("Failed to wait for child process to exit: %s", strerror(errno));
+            subproc_close_output(proc);
+            return true;
+        }
+        if (pid != proc->pids[i]) {
+            running = true;
+            continue;
         }
-        if (WIFEXITED(wstatus)) res.exitCode = WEXITSTATUS(wstatus);
+        watched |= pid == proc->exit_pid;
+        proc->pids[i] = 0;
+        if (i + 1 < proc->n_pids) continue;
+        if (WIFEXITED(wstatus))        proc->code = WEXITSTATUS(wstatus);
+        else if (WIFSIGNALED(wstatus)) proc->code = 128 + WTERMSIG(wstatus);
+    }
+    if (running) {
+        if (watched) subproc_watch_exit(proc);
+        return false;
+    }
+    if (subproc_start_next(proc)) return false;
+    proc->res.exitCode = proc->code;
+    proc->res.finished = true;
+    // @Note: Escape codes printed by the child may have changed the console's state
+    subproc_close_output(proc);
+    term_set_state(term_current_state);
+    return true;
+}
+
+// Forwards the output that is available right now and stops waiting for more once the child closed its end of the pipe
+internal void subproc_handle_output(SubProc *proc)
+{
+    if (proc->out_fd < 0) return;
+    // @Note: Only a limited amount is read at once, so that a single chatty process can't hold up the others
+    if (!subproc_read_output(proc, 16)) subproc_close_out_fd(proc);
+}
 
-        ail_da_push(&da, 0);
-        da.len--;
-        res.finished = true;
-        subproc_print_output(ail_str_from_da_nil_term(da));
+// Returns after how many milliseconds the process should be checked for having exited or -1 if its exit is reported by the reactor
+// @Note: Without a pidfd, processes are only checked for having exited after waking up, so we don't sleep long while any of them closed its output already
+// Processes whose output is kept open by their own children are noticed by the longer timeout
+internal i32 subproc_poll_interval(SubProc *proc)
+{
+    if (proc->exit_fd >= 0 || zygote_exit_fd(proc->exit_pid) >= 0) return -1;
+    return proc->out_fd < 0 ? 5 : 100;
+}
 
-done:
-        if (pipefd[0]) close(pipefd[0]);
-        if (da.data)   ail_da_free(&da);
+// Forwards the output of all processes while waiting until one of them finished and returns its index
+// Returns -1 if none finished before the timeout (negative for none) passed
+internal i32 subproc_wait_any(SubProc *procs, u32 n, i32 timeout_ms)
+{
+    if (!subproc_pollfds.data) subproc_pollfds = ail_da_new_t(SubProcPollFd);
+    u64 deadline = timeout_ms < 0 ? 0 : timer_now_ms() + timeout_ms;
+    for (;;) {
+        i32 poll_ms = -1;
+        int zygote_fd = -1;
+        subproc_pollfds.len = 0;
+        for (u32 i = 0; i < n; i++) {
+            if (subproc_reap(&procs[i])) return i;
+            i32 interval = subproc_poll_interval(&procs[i]);
+            if (interval >= 0 && (poll_ms < 0 || interval < poll_ms)) poll_ms = interval;
+            if (procs[i].out_fd  >= 0) ail_da_push(&subproc_pollfds, ((SubProcPollFd){ .fd = procs[i].out_fd,  .events = POLLIN }));
+            if (procs[i].exit_fd >= 0) ail_da_push(&subproc_pollfds, ((SubProcPollFd){ .fd = procs[i].exit_fd, .events = POLLIN }));
+            if (zygote_fd < 0) zygote_fd = zygote_exit_fd(procs[i].exit_pid);
+        }
+        // @Note: Exits reported by the zygote are received by subproc_reap, so its socket comes last
+        if (zygote_fd >= 0) ail_da_push(&subproc_pollfds, ((SubProcPollFd){ .fd = zygote_fd, .events = POLLIN }));
+        if (timeout_ms >= 0) {
+            u64 now = timer_now_ms();
+            if (now >= deadline) return -1;
+            if (poll_ms < 0 || deadline - now < (u64)poll_ms) poll_ms = (i32)(deadline - now);
+        }
+        if (poll(subproc_pollfds.data, subproc_pollfds.len, poll_ms) <= 0) continue;
+        for (u32 i = 0, j = 0; i < n; i++) {
+            if (procs[i].out_fd >= 0 && subproc_pollfds.data[j++].revents) subproc_handle_output(&procs[i]);
+            if (procs[i].exit_fd >= 0) j++; // Exits are handled by subproc_reap
+        }
+    }
+}
+
+// Asks the processes of the running pipeline and all processes they started to stop or kills them if `force` is set
+// The rest of the plan doesn't run anymore afterwards
+internal void subproc_kill(SubProc *proc, b32 force)
+{
+    proc->plan_next = proc->plan_len;
+    for (u32 i = 0; i < proc->n_pids; i++) {
+        if (proc->groups[i]) kill(-proc->groups[i], force ? SIGKILL : SIGTERM);
     }
-    return res;
 }
 #endif
 
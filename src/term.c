@@ -2,10 +2,13 @@
 
 #if defined(_WIN32) || defined(__WIN32__)
 #	include <windows.h>
+#	include <conio.h>
 	typedef HANDLE TermHandle;
 	typedef struct TermState { DWORD in, out, err; } TermState;
 #else
 #   include <termios.h>
+#   include <poll.h>
+#   include <unistd.h>
 	typedef int TermHandle;
 	typedef struct termios TermState;
 #endif
@@ -24,15 +27,18 @@ typedef enum AIL_FLAG_ENUM TermMode {
 global TermHandles term_handles;
 global TermState   term_initial_state;
 global TermState   term_current_state;
+global b32         term_input_closed;
+global b32         term_available; // False if stdin isn't a terminal or watch-exec is running headless, in which case the terminal's state is never changed
 
 // Forward declarations of functions that are implemented per platform
 internal TermHandles term_get_handles(void);
 internal TermMode    term_state_get_mode(TermState state);
 internal TermState   term_state_set_mode(TermState state, TermMode mode);
 internal void        term_set_state(TermState state);
-internal TermState   _term_get_state(void);
+internal b32         _term_get_state(TermState *state);
+internal int         term_get_char_timeout(i32 timeout_ms, TermHandle wake);
 
-internal void term_init(void);
+internal void term_init(b32 headless);
 internal void term_deinit(void);
 internal TermMode term_get_mode(void);
 internal TermState term_state_add_mode(TermState state, TermMode mode);
@@ -43,10 +49,10 @@ internal void term_sub_mode(TermMode mode);
 internal int term_get_char(void);
 
 
-internal void term_init(void)
+internal void term_init(b32 headless)
 {
 	term_handles       = term_get_handles();
-	term_initial_state = _term_get_state();
+	term_available     = !headless && _term_get_state(&term_initial_state);
 	term_current_state = term_initial_state;
 }
 
@@ -111,13 +117,12 @@ internal TermHandles term_get_handles(void)
 	return res;
 }
 
-internal TermState _term_get_state(void)
+// Returns false if any of the handles isn't connected to a console
+internal b32 _term_get_state(TermState *state)
 {
-	TermState state;
-	AIL_ASSERT(GetConsoleMode(term_handles.in,  &state.in));
-	AIL_ASSERT(GetConsoleMode(term_handles.out, &state.out));
-	AIL_ASSERT(GetConsoleMode(term_handles.err, &state.err));
-	return state;
+	return GetConsoleMode(term_handles.in,  &state->in)  &&
+	       GetConsoleMode(term_handles.out, &state->out) &&
+	       GetConsoleMode(term_handles.err, &state->err);
 }
 
 internal TermMode term_state_get_mode(TermState state)
@@ -161,6 +166,8 @@ internal TermState term_state_set_mode(TermState state, TermMode mode)
 
 internal void term_set_state(TermState state)
 {
+	term_current_state = state;
+	if (!term_available) return;
 	if (!SetConsoleMode(term_handles.in,  state.in)) {
 		printf("Error in setting console mode for STDIN (handle: %p, state: %lu): %lu\n", term_handles.in, state.in, GetLastError());
 	}
@@ -170,10 +177,23 @@ internal void term_set_state(TermState state)
 	if (!SetConsoleMode(term_handles.err, state.err)) {
 		printf("Error in setting console mode for STDERR (handle: %p, state: %lu): %lu\n", term_handles.err, state.err, GetLastError());
 	}
-	term_current_state = state;
 }
 
 
+// Returns the next character from stdin or -1 if no character was entered within the timeout or the `wake` handle was signaled
+// A negative timeout waits indefinitely
+internal int term_get_char_timeout(i32 timeout_ms, TermHandle wake)
+{
+	HANDLE handles[] = { term_handles.in, wake };
+	if (WaitForMultipleObjects(AIL_ARRLEN(handles), handles, FALSE, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms) != WAIT_OBJECT_0) return -1;
+	if (!_kbhit()) {
+		// @Note: The handle is also signaled by non-key events (i.e. focus or mouse events), which would never be consumed otherwise
+		FlushConsoleInputBuffer(term_handles.in);
+		return -1;
+	}
+	return _getch();
+}
+
 #else
 ////////////////////////
 // POSIX Implementation
@@ -188,11 +208,10 @@ internal TermHandles term_get_handles(void)
 	};
 }
 
-internal TermState _term_get_state(void)
+// Returns false if stdin isn't a terminal
+internal b32 _term_get_state(TermState *state)
 {
-	TermState state;
-	AIL_ASSERT(!tcgetattr(term_handles.in, &state));
-	return state;
+	return !tcgetattr(term_handles.in, state);
 }
 
 internal TermMode term_state_get_mode(TermState state)
@@ -224,9 +243,27 @@ internal TermState term_state_set_mode(TermState state, TermMode mode)
 
 internal void term_set_state(TermState state)
 {
-	// @TODO: Maybe use TCSADRAIN instead of TCSANOW?
-	AIL_ASSERT(!tcsetattr(term_handles.in, TCSANOW, &state));
 	term_current_state = state;
+	// @TODO: Maybe use TCSADRAIN instead of TCSANOW?
+	if (term_available) tcsetattr(term_handles.in, TCSANOW, &state);
+}
+
+// Returns the next character from stdin or -1 if no character was entered within the timeout or the `wake` handle became readable
+// A negative timeout waits indefinitely
+internal int term_get_char_timeout(i32 timeout_ms, TermHandle wake)
+{
+	// @Note: Once stdin is closed, it would be reported as readable forever, so we only wait for the wake handle instead
+	struct pollfd pfds[] = {
+		{ .fd = wake,                                    .events = POLLIN },
+		{ .fd = term_input_closed ? -1 : term_handles.in, .events = POLLIN },
+	};
+	if (poll(pfds, AIL_ARRLEN(pfds), timeout_ms) <= 0 || !(pfds[1].revents & (POLLIN | POLLHUP))) return -1;
+	char c;
+	if (read(term_handles.in, &c, 1) != 1) {
+		term_input_closed = true;
+		return -1;
+	}
+	return c;
 }
 
 #endif
@@ -0,0 +1,265 @@
+#include "header.h"
+
+// Two ways of holding back runs, so that watch-exec doesn't make a busy machine even slower:
+// With --max-pressure, runs triggered by changes are deferred while the pressure stall information (PSI) of the CPU,
+// memory or I/O is above the given share. Changes are still collected meanwhile, so that all of them end up in a
+// single run once the pressure dropped or the run was deferred for --max-defer milliseconds
+// With --min-interval, a command starts at most once per interval. Triggers during the interval either start it once
+// the interval is over, with all changes collected until then (trailing edge), or are dropped (leading edge only)
+// @Note: Rerunning manually always runs all commands right away
+
+#ifndef THROTTLE_POLL_MS
+#   define THROTTLE_POLL_MS 1000 // Interval in which the pressure is sampled again while a run is deferred
+#endif
+
+typedef struct ThrottlePressure {
+    const char *name;
+    f64 max;       // Maximum share of time in percent, that tasks may be stalled for (0 if it isn't limited)
+    f64 value;     // Share at the last sample
+    u64 total_us;  // Total time that tasks were stalled for at the last sample
+    u64 sample_ms; // Time of the last sample (0 before the first one)
+} ThrottlePressure;
+
+// State of a command with a minimum interval
+typedef struct ThrottleCmd {
+    Cmd  *cmd;
+    u64   last_ms; // Time at which the command was last started (0 if it never was)
+    u64   prev_ms; // last_ms before that, which is restored if the command was cancelled
+    u64   due_ms;  // Time at which the pending changes run
+    Batch pending; // Changes of the command's group that triggered it during the interval
+    b32   taken;   // Whether the pending changes were taken into the current run
+} ThrottleCmd;
+AIL_DA_INIT(ThrottleCmd);
+
+global ThrottlePressure   throttle_pressure[] = { { .name = "cpu" }, { .name = "memory" }, { .name = "io" } };
+global b32                throttle_pressure_limited;
+global ThrottlePressure  *throttle_exceeded;      // Resource whose pressure was too high at the last sample
+global u64                throttle_next_sample_ms;
+global u64                throttle_defer_start_ms; // 0 if no run is deferred
+global u32                throttle_max_defer_ms;   // 0 to defer runs for as long as the pressure stays too high
+global AIL_DA(ThrottleCmd) throttle_cmds;
+global b32                throttle_only;           // Whether only the commands whose pending changes were taken run
+
+// Parses '<cpu|memory|io>=<percent>[%]'
+internal b32 throttle_parse_pressure(const char *s)
+{
+    for (u32 i = 0; i < AIL_ARRLEN(throttle_pressure); i++) {
+        u64 len = strlen(throttle_pressure[i].name);
+        if (strncmp(s, throttle_pressure[i].name, len) || s[len] != '=') continue;
+        char *end = NULL;
+        f64 max = strtod(s + len + 1, &end);
+        if (end == s + len + 1 || (*end && strcmp(end, "%")) || max <= 0 || max > 100) return false;
+        throttle_pressure[i].max  = max;
+        throttle_pressure_limited = true;
+        return true;
+    }
+    return false;
+}
+
+// Parses the milliseconds and the optional edge ('leading' or 'trailing') given to --min-interval
+internal b32 throttle_parse_interval(Cmd *cmd, StrList *vals)
+{
+    cmd->min_interval = 0;
+    cmd->edges        = THROTTLE_LEADING | THROTTLE_TRAILING;
+    u32 n = 0;
+    for (u32 i = 0; i < vals->len; i++) {
+        AIL_SV parts = ail_sv_from_cstr(vals->data[i]);
+        while (parts.len) {
+            char *part = ail_sv_to_cstr(ail_sv_split_next_char(&parts, ',', true));
+            if (n == 0) {
+                char *end = NULL;
+                unsigned long ms = strtoul(part, &end, 10);
+                if (end == part || *end || !ms || ms > UINT32_MAX) return false;
+                cmd->min_interval = (u32)ms;
+            } else if (n == 1 && !strcmp(part, "leading")) {
+                cmd->edges = THROTTLE_LEADING;
+            } else if (n == 1 && !strcmp(part, "trailing")) {
+                cmd->edges = THROTTLE_TRAILING;
+            } else return false;
+            n++;
+        }
+    }
+    return n > 0;
+}
+
+internal b32 throttle_read_pressure(ThrottlePressure *p, f64 *avg10, u64 *total_us)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/pressure/%s", p->name);
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    unsigned long long total = 0;
+    b32 ok = fscanf(f, "some avg10=%lf avg60=%*f avg300=%*f total=%llu", avg10, &total) == 2;
+    fclose(f);
+    *total_us = total;
+    return ok;
+}
+
+// Checks that the pressure of all limited resources can be read
+internal b32 throttle_init(u32 max_defer_ms)
+{
+    throttle_max_defer_ms = max_defer_ms;
+    throttle_cmds = ail_da_new_t(ThrottleCmd);
+    for (u32 i = 0; i < AIL_ARRLEN(throttle_pressure); i++) {
+        ThrottlePressure *p = &throttle_pressure[i];
+        f64 avg10;
+        u64 total_us;
+        if (p->max && !throttle_read_pressure(p, &avg10, &total_us)) {
+            log_err("Could not read '/proc/pressure/%s', which --max-pressure needs (Linux 4.20 or newer with PSI enabled)", p->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Samples the pressure, which is the share of time since the last sample that tasks were stalled for
+// @Note: The kernel's average over the last 10s is used when there is no recent sample, since it decays too slowly to notice that the pressure dropped right away
+internal void throttle_sample(u64 now)
+{
+    throttle_exceeded = NULL;
+    for (u32 i = 0; i < AIL_ARRLEN(throttle_pressure); i++) {
+        ThrottlePressure *p = &throttle_pressure[i];
+        f64 avg10;
+        u64 total_us;
+        if (!p->max || !throttle_read_pressure(p, &avg10, &total_us)) continue;
+        b32 recent = p->sample_ms && now > p->sample_ms && now - p->sample_ms <= 2*THROTTLE_POLL_MS;
+        p->value     = recent ? (f64)(total_us - p->total_us)/(f64)(10*(now - p->sample_ms)) : avg10;
+        p->total_us  = total_us;
+        p->sample_ms = now;
+        if (p->value > p->max && !throttle_exceeded) throttle_exceeded = p;
+    }
+}
+
+// Returns whether a run triggered by changes may start now or should be deferred due to the pressure
+internal b32 throttle_admit(void)
+{
+    if (!throttle_pressure_limited) return true;
+    u64 now = timer_now_ms();
+    if (now >= throttle_next_sample_ms) {
+        throttle_sample(now);
+        throttle_next_sample_ms = now + THROTTLE_POLL_MS;
+    }
+    ThrottlePressure *p = throttle_exceeded;
+    if (!p) {
+        if (throttle_defer_start_ms) log_info("Running the deferred commands after %.1fs, since the pressure dropped", (f64)(now - throttle_defer_start_ms)/1e3);
+        throttle_defer_start_ms = 0;
+        return true;
+    }
+    if (!throttle_defer_start_ms) {
+        throttle_defer_start_ms = now;
+        log_info("Deferring the run, since the %s pressure is at %.0f%% (more than %.0f%%)...", p->name, p->value, p->max);
+    } else if (throttle_max_defer_ms && now - throttle_defer_start_ms >= throttle_max_defer_ms) {
+        log_warn("Running anyways after deferring the run for %.1fs, although the %s pressure is at %.0f%%", (f64)(now - throttle_defer_start_ms)/1e3, p->name, p->value);
+        throttle_defer_start_ms = 0;
+        return true;
+    }
+    return false;
+}
+
+internal ThrottleCmd *throttle_find(Cmd *cmd)
+{
+    if (!cmd->min_interval) return NULL;
+    for (u32 i = 0; i < throttle_cmds.len; i++) {
+        if (throttle_cmds.data[i].cmd == cmd) return &throttle_cmds.data[i];
+    }
+    ail_da_push(&throttle_cmds, ((ThrottleCmd){ .cmd = cmd }));
+    return &throttle_cmds.data[throttle_cmds.len - 1];
+}
+
+internal char *throttle_strdup(const char *s)
+{
+    u64 len = strlen(s);
+    char *res = AIL_CALL_ALLOC(ail_default_allocator, len + 1);
+    memcpy(res, s, len + 1);
+    return res;
+}
+
+// Returns whether the main loop needs to start a run for pending changes, whose interval is over
+internal b32 throttle_due(void)
+{
+    u64 now = timer_now_ms();
+    for (u32 i = 0; i < throttle_cmds.len; i++) {
+        if (throttle_cmds.data[i].pending.rules && throttle_cmds.data[i].due_ms <= now) return true;
+    }
+    return false;
+}
+
+// Returns the time until the main loop needs to check again, given the time until the reported changes settled down
+internal i32 throttle_wait_time(i32 left, b32 active)
+{
+    u64 now = timer_now_ms();
+    // @Note: Pending changes don't interrupt a run, but are taken into the next one
+    for (u32 i = 0; i < throttle_cmds.len && !active; i++) {
+        ThrottleCmd *t = &throttle_cmds.data[i];
+        if (!t->pending.rules) continue;
+        i32 due = t->due_ms > now ? (i32)(t->due_ms - now) : 0;
+        if (left < 0 || due < left) left = due;
+    }
+    if (left == 0 && throttle_defer_start_ms) {
+        u64 until = throttle_next_sample_ms;
+        if (throttle_max_defer_ms && throttle_defer_start_ms + throttle_max_defer_ms < until) until = throttle_defer_start_ms + throttle_max_defer_ms;
+        left = until > now ? (i32)(until - now) : 0;
+    }
+    return left;
+}
+
+// Moves the pending changes of all commands whose interval is over into the batch that is about to run
+internal void throttle_take(Batch *batch)
+{
+    u64 now = timer_now_ms();
+    for (u32 i = 0; i < throttle_cmds.len; i++) {
+        ThrottleCmd *t = &throttle_cmds.data[i];
+        t->taken = t->pending.rules && t->due_ms <= now;
+        if (t->taken) changes_combine(batch, &t->pending);
+    }
+}
+
+// Returns whether the command is held back in the group's run, in which case its changes are kept for later if needed
+// @Note: Other commands of the group get the pending changes of a command as well, if they run together with it
+internal b32 throttle_skip(Cmd *cmd, Batch *batch, u32 rule)
+{
+    ThrottleCmd *t = throttle_find(cmd);
+    b32 taken = t && t->taken;
+    if (t) t->taken = false;
+    if (throttle_only && !taken) {
+        log_info("Skipping '%s', since only the deferred commands run", cmd->str);
+        return true;
+    }
+    if (!t) return false;
+    u64 now = timer_now_ms();
+    b32 manual = true;
+    for (u32 i = 0; i < batch->changes.len && manual; i++) manual = !(batch->changes.data[i].rules & (1ull << rule));
+    b32 recent = t->last_ms && now < t->last_ms + cmd->min_interval;
+    if (taken || manual || (!recent && (cmd->edges & THROTTLE_LEADING))) {
+        t->prev_ms = t->last_ms;
+        t->last_ms = now;
+        return false;
+    }
+    if (!(cmd->edges & THROTTLE_TRAILING)) {
+        log_info("Skipping '%s', since it ran less than %.1fs ago", cmd->str, cmd->min_interval/1e3);
+        return true;
+    }
+    if (!t->pending.rules) {
+        t->pending = (Batch){ .changes = ail_da_new_t(Change) };
+        t->due_ms  = (recent ? t->last_ms : now) + cmd->min_interval;
+    }
+    Batch copy = { .changes = ail_da_new_t(Change), .rules = 1ull << rule };
+    for (u32 i = 0; i < batch->changes.len; i++) {
+        Change change = batch->changes.data[i];
+        if (!(change.rules & (1ull << rule))) continue;
+        change.rules    = 1ull << rule;
+        change.path     = throttle_strdup(change.path);
+        change.old_path = change.old_path ? throttle_strdup(change.old_path) : NULL;
+        ail_da_push(&copy.changes, change);
+    }
+    changes_combine(&t->pending, &copy);
+    log_info("Deferring '%s' for %.1fs, since it runs at most every %.1fs", cmd->str, (f64)(t->due_ms - now)/1e3, cmd->min_interval/1e3);
+    return true;
+}
+
+// Lets a command, that was cancelled before it finished, start again right away
+internal void throttle_cancelled(Cmd *cmd)
+{
+    ThrottleCmd *t = throttle_find(cmd);
+    if (t && t->last_ms) t->last_ms = t->prev_ms;
+}
@@ -0,0 +1,44 @@
+#include "header.h"
+
+#if defined(_WIN32) || defined(__WIN32__)
+#   include <windows.h>
+#else
+#   include <time.h>
+#endif
+
+// Forward declarations of functions that are implemented per platform
+internal u64 timer_now_ns(void);
+
+internal u64 timer_now_ms(void)
+{
+    return timer_now_ns() / 1000000;
+}
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+internal u64 timer_now_ns(void)
+{
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (u64)((f64)count.QuadPart * 1e9 / (f64)freq.QuadPart);
+}
+
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+internal u64 timer_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec*1000000000 + (u64)ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include "header.h"
+
+// Commands given with --trace run with watch-exec-trace.so preloaded (see trace_preload.c), which records the paths
+// of all files that the command tried to read, including ones that didn't exist, and all directories it listed
+// After the command succeeded, the recorded paths below the watched directories become its read-set
+// A later run only starts the command again if one of the changed files is in its read-set or, for created, deleted
+// and renamed files, if their directory was listed. Otherwise it's skipped like a command that succeeded
+// @Note: Commands without a read-set (first run, failed or cancelled last time) always run
+// Unless --allow-self-trigger is given, all other commands run with the library preloaded as well, but only their writes
+// are recorded, so that changes made by them can be ignored (see self.c)
+
+#if defined(_WIN32) || defined(__WIN32__)
+#else
+#   include <unistd.h>
+#   include <limits.h>
+#endif
+
+#ifndef TRACE_LINE_LEN
+#   define TRACE_LINE_LEN 8200 // Longer lines than the library writes are ignored
+#endif
+#ifndef TRACE_LIB_NAME
+#   define TRACE_LIB_NAME "watch-exec-trace.so"
+#endif
+
+// Hashes of the paths that a command read the last time it succeeded
+typedef struct TraceSet {
+    Cmd *cmd;
+    b32  known; // Whether the command succeeded since it last failed or was cancelled
+    u64 *slots; // Open addressing hash set, 0 for empty slots
+    u32  cap;
+    u32  len;
+} TraceSet;
+AIL_DA_INIT(TraceSet);
+
+global AIL_DA(TraceSet) trace_sets;
+global char  trace_lib[1024];
+global char  trace_preload[TRACE_LINE_LEN];  // Value of LD_PRELOAD for traced commands
+global char *trace_orig_preload;             // Value of LD_PRELOAD for all other commands
+global u32   trace_next_id = 1;
+
+internal u64 trace_hash(char kind, const char *path, u64 len)
+{
+    u64 hash = history_hash(0xcbf29ce484222325ull, &kind, 1);
+    hash = history_hash(hash, path, len);
+    return hash ? hash : 1;
+}
+
+internal TraceSet *trace_set_find(Cmd *cmd)
+{
+    if (!trace_sets.data) trace_sets = ail_da_new_t(TraceSet);
+    for (u32 i = 0; i < trace_sets.len; i++) {
+        if (trace_sets.data[i].cmd == cmd) return &trace_sets.data[i];
+    }
+    ail_da_push(&trace_sets, ((TraceSet){ .cmd = cmd }));
+    return &trace_sets.data[trace_sets.len - 1];
+}
+
+internal void trace_set_add(TraceSet *set, u64 hash)
+{
+    if (2*(set->len + 1) > set->cap) {
+        u32  old_cap = set->cap;
+        u64 *old     = set->slots;
+        set->cap   = old_cap ? 2*old_cap : 256;
+        set->slots = AIL_CALL_ALLOC(ail_default_allocator, sizeof(u64)*set->cap);
+        memset(set->slots, 0, sizeof(u64)*set->cap);
+        set->len = 0;
+        for (u32 i = 0; i < old_cap; i++) {
+            if (old[i]) trace_set_add(set, old[i]);
+        }
+        if (old) AIL_CALL_FREE(ail_default_allocator, old);
+    }
+    u32 mask = set->cap - 1;
+    for (u32 i = (u32)hash & mask;; i = (i + 1) & mask) {
+        if (set->slots[i] == hash) return;
+        if (!set->slots[i]) {
+            set->slots[i] = hash;
+            set->len++;
+            return;
+        }
+    }
+}
+
+internal b32 trace_set_has(TraceSet *set, u64 hash)
+{
+    if (!set->cap) return false;
+    u32 mask = set->cap - 1;
+    for (u32 i = (u32)hash & mask; set->slots[i]; i = (i + 1) & mask) {
+        if (set->slots[i] == hash) return true;
+    }
+    return false;
+}
+
+internal void trace_file_path(char *buf, u32 buf_len, u32 id)
+{
+    snprintf(buf, buf_len, "%s/trace-%u.txt", changes_tmp_base, id);
+}
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+// @TODO: Could be implemented with Detours or by reading ETW file events
+internal b32 trace_init(const char *program, const char *lib, b32 required)
+{
+    AIL_UNUSED(program);
+    AIL_UNUSED(lib);
+    if (required) log_err("Tracing the files read by commands is not supported on Windows yet");
+    return false;
+}
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+// Finds the preloaded library, which is expected next to the executable unless `lib` is given
+// Errors are only reported if the library is `required`
+internal b32 trace_init(const char *program, const char *lib, b32 required)
+{
+#if !defined(__linux__)
+    AIL_UNUSED(program);
+    AIL_UNUSED(lib);
+    // @TODO: macOS only allows interposing functions with DYLD_INSERT_LIBRARIES for binaries outside of the system's directories
+    if (required) log_err("Tracing the files read by commands is only supported on Linux");
+    return false;
+#else
+    if (lib) snprintf(trace_lib, sizeof(trace_lib), "%s", lib);
+    else {
+        char exe[1024];
+        ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (n > 0) exe[n] = 0;
+        else snprintf(exe, sizeof(exe), "%s", program);
+        char *slash = strrchr(exe, '/');
+        if (slash) snprintf(trace_lib, sizeof(trace_lib), "%.*s/%s", (int)(slash - exe), exe, TRACE_LIB_NAME);
+        else       snprintf(trace_lib, sizeof(trace_lib), "./%s", TRACE_LIB_NAME);
+    }
+    char abs_lib[PATH_MAX];
+    if (!realpath(trace_lib, abs_lib) || access(abs_lib, R_OK) < 0) {
+        if (required) log_err("Could not find '%s', that's needed for --trace (it's built by build-linux.sh)", trace_lib);
+        return false;
+    }
+    trace_orig_preload = getenv("LD_PRELOAD");
+    if (trace_orig_preload && trace_orig_preload[0]) snprintf(trace_preload, sizeof(trace_preload), "%s:%s", abs_lib, trace_orig_preload);
+    else                                             snprintf(trace_preload, sizeof(trace_preload), "%s", abs_lib);
+    return true;
+#endif
+}
+
+#endif
+
+// Provides the trace file with the returned id to the next started process, which only records its writes unless `reads`
+// trace_end needs to be called right after starting it, so that other commands aren't traced
+internal u32 trace_begin(b32 reads)
+{
+    char path[1100];
+    u32 id = trace_next_id++;
+    trace_file_path(path, sizeof(path), id);
+    remove(path);
+    subproc_set_env("LD_PRELOAD", trace_preload);
+    subproc_set_env("WATCH_EXEC_TRACE", path);
+    subproc_set_env("WATCH_EXEC_TRACE_KINDS", reads ? (self_precise ? "fdw" : "fd") : "w");
+    return id;
+}
+
+internal void trace_end(void)
+{
+    subproc_set_env("LD_PRELOAD", trace_orig_preload);
+    subproc_set_env("WATCH_EXEC_TRACE", NULL);
+    subproc_set_env("WATCH_EXEC_TRACE_KINDS", NULL);
+}
+
+// Reads the recorded paths into the read-set, if it's given, and passes the written paths on to self.c
+internal b32 trace_read(u32 id, TraceSet *set, b32 running)
+{
+    char path[1100];
+    trace_file_path(path, sizeof(path), id);
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    char line[TRACE_LINE_LEN], norm[TRACE_LINE_LEN];
+    b32 partial = false;
+    while (fgets(line, sizeof(line), f)) {
+        u64 len = strlen(line);
+        b32 skip = partial;
+        partial = line[len - 1] != '\n';
+        if (skip || partial || len < 3 || line[1] != ' ') continue;
+        line[len - 1] = 0;
+        if (line[0] == 'w') self_add_write(line + 2, running);
+        else if (set && changes_resolve(line + 2, norm, sizeof(norm))) trace_set_add(set, trace_hash(line[0], norm, strlen(norm)));
+    }
+    fclose(f);
+    return true;
+}
+
+// Records the writes of a command that is still running
+internal void trace_peek(u32 id)
+{
+    changes_resolve_reset();
+    trace_read(id, NULL, true);
+}
+
+// Reads the paths recorded by the finished command into its read-set, if it succeeded and is traced
+internal void trace_collect(Cmd *cmd, u32 id, b32 succeeded)
+{
+    char path[1100];
+    trace_file_path(path, sizeof(path), id);
+    changes_resolve_reset(); // Directories might have been moved since the last command finished
+    if (!cmd->traced) {
+        trace_read(id, NULL, false);
+        remove(path);
+        return;
+    }
+    TraceSet *set = trace_set_find(cmd);
+    set->known = false;
+    set->len   = 0;
+    if (set->slots) memset(set->slots, 0, sizeof(u64)*set->cap);
+    if (trace_read(id, succeeded ? set : NULL, false) && succeeded) {
+        set->known = true;
+        runlog_printf("### '%s' read %u files in the watched directories\n", cmd->str, set->len);
+    } else if (succeeded) {
+        // @Note: Happens if the command didn't read anything or the library couldn't be loaded (i.e. for static binaries)
+        log_warn("No files were recorded for '%s', so it'll run for every change", cmd->str);
+    }
+    remove(path);
+}
+
+internal b32 trace_affected_by(TraceSet *set, const char *path, b32 listing)
+{
+    char norm[TRACE_LINE_LEN];
+    // @Note: The watcher reports paths relative to the watched directories as given, which are resolved the same way as the recorded ones
+    // Paths that can't be resolved anymore (i.e. inside of deleted directories) are treated as read
+    if (!changes_resolve(path, norm, sizeof(norm))) return true;
+    if (trace_set_has(set, trace_hash('f', norm, strlen(norm)))) return true;
+    if (!listing) return false;
+    char *slash = strrchr(norm, '/');
+    return slash && trace_set_has(set, trace_hash('d', norm, slash == norm ? 1 : (u64)(slash - norm)));
+}
+
+// Returns whether the command may read any of the group's changed files
+internal b32 trace_affected(Cmd *cmd, Batch *batch, u32 rule)
+{
+    TraceSet *set = trace_set_find(cmd);
+    if (!set->known) return true;
+    changes_resolve_reset();
+    b32 changed = false;
+    for (u32 i = 0; i < batch->changes.len; i++) {
+        Change *change = &batch->changes.data[i];
+        if (!(change->rules & (1ull << rule))) continue;
+        changed = true;
+        b32 listing = change->action != DMON_ACTION_MODIFY;
+        if (trace_affected_by(set, change->path, listing)) return true;
+        if (change->old_path && trace_affected_by(set, change->old_path, listing)) return true;
+    }
+    // @Note: Rerunning manually always runs all commands
+    return !changed;
+}
@@ -0,0 +1,333 @@
+// Shared library that is preloaded into commands given with --trace and, unless --allow-self-trigger is given,
+// into all other commands (see trace.c and self.c)
+// It appends every path that the command tries to read or writes to the file in WATCH_EXEC_TRACE, one per line:
+//   - 'f <path>': A file that was opened for reading, stat'ed or checked for access (successfully or not)
+//   - 'd <path>': A directory that was opened to list its entries
+//   - 'w <path>': A file or directory that was opened for writing, created, deleted or renamed
+// Only the kinds listed in WATCH_EXEC_TRACE_KINDS are recorded (default: 'fd')
+// The paths are made absolute but not normalized, which is left to watch-exec
+// Each process only reports every path once and child processes inherit the preloaded library
+// @Note: Only calls going through the dynamic linker are seen, so statically linked programs and programs doing
+// system calls themselves (i.e. written in Go) aren't traced
+// Build with: clang -shared -fPIC -o watch-exec-trace.so src/trace_preload.c -ldl
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRACE_EXPORT __attribute__((visibility("default")))
+#define TRACE_SEEN_CAP 8192 // Must be a power of two
+
+static int      trace_fd = -2; // -2 until the trace file was opened, -1 if the process isn't traced
+static char     trace_kinds[8] = "fd";
+static uint64_t trace_seen[TRACE_SEEN_CAP];
+static uint32_t trace_seen_len;
+
+// @Note: ISO C doesn't allow casting the object pointer returned by dlsym to a function pointer
+static void *trace_next(const char *name)
+{
+    void *fn = dlsym(RTLD_NEXT, name);
+    if (!fn) errno = ENOSYS;
+    return fn;
+}
+#define TRACE_REAL(ret, params, name, fail) ret (*real)params; { void *p = trace_next(#name); if (!p) return fail; memcpy(&real, &p, sizeof(p)); }
+
+static int trace_open_file(void)
+{
+    if (trace_fd != -2) return trace_fd;
+    const char *path  = getenv("WATCH_EXEC_TRACE");
+    const char *kinds = getenv("WATCH_EXEC_TRACE_KINDS");
+    if (kinds) snprintf(trace_kinds, sizeof(trace_kinds), "%s", kinds);
+    int (*real)(const char *, int, ...) = NULL;
+    void *p = dlsym(RTLD_NEXT, "open");
+    memcpy(&real, &p, sizeof(p));
+    trace_fd = (path && path[0] && real) ? real(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600) : -1;
+    if (trace_fd < 0) trace_fd = -1;
+    return trace_fd;
+}
+
+// Returns whether the path wasn't seen before by this process
+static int trace_first_time(char kind, const char *path, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ull ^ (unsigned char)kind;
+    for (size_t i = 0; i < len; i++) hash = (hash ^ (unsigned char)path[i])*0x100000001b3ull;
+    if (!hash) hash = 1;
+    // @Note: Races between threads only lead to duplicate lines, which watch-exec ignores anyways
+    if (2*trace_seen_len > TRACE_SEEN_CAP) return 1;
+    for (uint32_t i = (uint32_t)hash & (TRACE_SEEN_CAP - 1);; i = (i + 1) & (TRACE_SEEN_CAP - 1)) {
+        uint64_t cur = __atomic_load_n(&trace_seen[i], __ATOMIC_RELAXED);
+        if (cur == hash) return 0;
+        if (!cur && __atomic_compare_exchange_n(&trace_seen[i], &cur, hash, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add(&trace_seen_len, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+        if (cur == hash) return 0;
+    }
+}
+
+static void trace_record(char kind, int dirfd, const char *path)
+{
+    if (!path || !path[0]) return;
+    int fd = trace_open_file();
+    if (fd < 0 || !strchr(trace_kinds, kind)) return;
+    int saved_errno = errno;
+    char line[2*PATH_MAX + 4];
+    size_t len = 2;
+    line[0] = kind;
+    line[1] = ' ';
+    if (path[0] != '/') {
+        char dir[64];
+        ssize_t n = -1;
+        if (dirfd == AT_FDCWD) {
+            if (getcwd(line + len, PATH_MAX)) n = (ssize_t)strlen(line + len);
+        } else {
+            snprintf(dir, sizeof(dir), "/proc/self/fd/%d", dirfd);
+            n = readlink(dir, line + len, PATH_MAX);
+        }
+        if (n <= 0) goto done;
+        len += (size_t)n;
+        line[len++] = '/';
+    }
+    size_t path_len = strlen(path);
+    if (path_len >= PATH_MAX || memchr(path, '\n', path_len)) goto done;
+    memcpy(line + len, path, path_len);
+    len += path_len;
+    if (trace_first_time(kind, line + 2, len - 2)) {
+        line[len++] = '\n';
+        // @Note: Appending a short line with a single write keeps the lines of concurrent processes apart
+        ssize_t written = write(fd, line, len);
+        (void)written;
+    }
+done:
+    errno = saved_errno;
+}
+
+static int trace_is_read(int flags)
+{
+    return (flags & O_ACCMODE) != O_WRONLY;
+}
+
+static char trace_open_kind(int flags)
+{
+    return (flags & O_DIRECTORY) ? 'd' : 'f';
+}
+
+static int trace_is_write(int flags)
+{
+    return (flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC));
+}
+
+static int trace_has_mode(int flags)
+{
+#ifdef O_TMPFILE
+    if ((flags & O_TMPFILE) == O_TMPFILE) return 1;
+#endif
+    return (flags & O_CREAT) != 0;
+}
+
+#define TRACE_OPEN(name)                                                                 \
+    TRACE_EXPORT int name(const char *path, int flags, ...)                              \
+    {                                                                                    \
+        mode_t mode = 0;                                                                 \
+        if (trace_has_mode(flags)) {                                                     \
+            va_list args;                                                                \
+            va_start(args, flags);                                                       \
+            mode = va_arg(args, mode_t);                                                 \
+            va_end(args);                                                                \
+        }                                                                                \
+        TRACE_REAL(int, (const char *, int, ...), name, -1);                             \
+        if (trace_is_read(flags)) trace_record(trace_open_kind(flags), AT_FDCWD, path);  \
+        if (trace_is_write(flags)) trace_record('w', AT_FDCWD, path);                    \
+        return real(path, flags, mode);                                                  \
+    }
+#define TRACE_OPENAT(name)                                                               \
+    TRACE_EXPORT int name(int dirfd, const char *path, int flags, ...)                   \
+    {                                                                                    \
+        mode_t mode = 0;                                                                 \
+        if (trace_has_mode(flags)) {                                                     \
+            va_list args;                                                                \
+            va_start(args, flags);                                                       \
+            mode = va_arg(args, mode_t);                                                 \
+            va_end(args);                                                                \
+        }                                                                                \
+        TRACE_REAL(int, (int, const char *, int, ...), name, -1);                        \
+        if (trace_is_read(flags)) trace_record(trace_open_kind(flags), dirfd, path);     \
+        if (trace_is_write(flags)) trace_record('w', dirfd, path);                       \
+        return real(dirfd, path, flags, mode);                                           \
+    }
+// Used instead of open and openat by programs built with _FORTIFY_SOURCE
+#define TRACE_OPEN_2(name)                                                               \
+    TRACE_EXPORT int name(const char *path, int flags)                                   \
+    {                                                                                    \
+        TRACE_REAL(int, (const char *, int), name, -1);                                  \
+        if (trace_is_read(flags)) trace_record(trace_open_kind(flags), AT_FDCWD, path);  \
+        if (trace_is_write(flags)) trace_record('w', AT_FDCWD, path);                    \
+        return real(path, flags);                                                        \
+    }
+#define TRACE_OPENAT_2(name)                                                             \
+    TRACE_EXPORT int name(int dirfd, const char *path, int flags)                        \
+    {                                                                                    \
+        TRACE_REAL(int, (int, const char *, int), name, -1);                             \
+        if (trace_is_read(flags)) trace_record(trace_open_kind(flags), dirfd, path);     \
+        if (trace_is_write(flags)) trace_record('w', dirfd, path);                       \
+        return real(dirfd, path, flags);                                                 \
+    }
+#define TRACE_STAT(name, type)                                                           \
+    TRACE_EXPORT int name(const char *path, type *st)                                    \
+    {                                                                                    \
+        TRACE_REAL(int, (const char *, type *), name, -1);                               \
+        trace_record('f', AT_FDCWD, path);                                               \
+        return real(path, st);                                                           \
+    }
+#define TRACE_STATAT(name, type)                                                         \
+    TRACE_EXPORT int name(int dirfd, const char *path, type *st, int flags)              \
+    {                                                                                    \
+        TRACE_REAL(int, (int, const char *, type *, int), name, -1);                     \
+        if (!(flags & AT_EMPTY_PATH) || path[0]) trace_record('f', dirfd, path);         \
+        return real(dirfd, path, st, flags);                                             \
+    }
+
+TRACE_OPEN(open)
+TRACE_OPEN(open64)
+TRACE_OPENAT(openat)
+TRACE_OPENAT(openat64)
+TRACE_OPEN_2(__open_2)
+TRACE_OPEN_2(__open64_2)
+TRACE_OPENAT_2(__openat_2)
+TRACE_OPENAT_2(__openat64_2)
+TRACE_STAT(stat, struct stat)
+TRACE_STAT(lstat, struct stat)
+TRACE_STAT(stat64, struct stat64)
+TRACE_STAT(lstat64, struct stat64)
+TRACE_STATAT(fstatat, struct stat)
+TRACE_STATAT(fstatat64, struct stat64)
+
+TRACE_EXPORT int statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *st)
+{
+    TRACE_REAL(int, (int, const char *, int, unsigned int, struct statx *), statx, -1);
+    if (!(flags & AT_EMPTY_PATH) || path[0]) trace_record('f', dirfd, path);
+    return real(dirfd, path, flags, mask, st);
+}
+
+TRACE_EXPORT int access(const char *path, int mode)
+{
+    TRACE_REAL(int, (const char *, int), access, -1);
+    trace_record('f', AT_FDCWD, path);
+    return real(path, mode);
+}
+
+TRACE_EXPORT int faccessat(int dirfd, const char *path, int mode, int flags)
+{
+    TRACE_REAL(int, (int, const char *, int, int), faccessat, -1);
+    trace_record('f', dirfd, path);
+    return real(dirfd, path, mode, flags);
+}
+
+#define TRACE_FOPEN(name)                                                                \
+    TRACE_EXPORT FILE *name(const char *path, const char *mode)                          \
+    {                                                                                    \
+        TRACE_REAL(FILE *, (const char *, const char *), name, NULL);                    \
+        if (mode[0] == 'r' || strchr(mode, '+')) trace_record('f', AT_FDCWD, path);      \
+        if (mode[0] != 'r' || strchr(mode, '+')) trace_record('w', AT_FDCWD, path);      \
+        return real(path, mode);                                                         \
+    }
+
+TRACE_FOPEN(fopen)
+TRACE_FOPEN(fopen64)
+
+TRACE_EXPORT DIR *opendir(const char *path)
+{
+    TRACE_REAL(DIR *, (const char *), opendir, NULL);
+    trace_record('d', AT_FDCWD, path);
+    return real(path);
+}
+
+TRACE_EXPORT int creat(const char *path, mode_t mode)
+{
+    TRACE_REAL(int, (const char *, mode_t), creat, -1);
+    trace_record('w', AT_FDCWD, path);
+    return real(path, mode);
+}
+
+TRACE_EXPORT int creat64(const char *path, mode_t mode)
+{
+    TRACE_REAL(int, (const char *, mode_t), creat64, -1);
+    trace_record('w', AT_FDCWD, path);
+    return real(path, mode);
+}
+
+TRACE_EXPORT int truncate(const char *path, off_t length)
+{
+    TRACE_REAL(int, (const char *, off_t), truncate, -1);
+    trace_record('w', AT_FDCWD, path);
+    return real(path, length);
+}
+
+TRACE_EXPORT int mkdir(const char *path, mode_t mode)
+{
+    TRACE_REAL(int, (const char *, mode_t), mkdir, -1);
+    trace_record('w', AT_FDCWD, path);
+    return real(path, mode);
+}
+
+TRACE_EXPORT int mkdirat(int dirfd, const char *path, mode_t mode)
+{
+    TRACE_REAL(int, (int, const char *, mode_t), mkdirat, -1);
+    trace_record('w', dirfd, path);
+    return real(dirfd, path, mode);
+}
+
+TRACE_EXPORT int rmdir(const char *path)
+{
+    TRACE_REAL(int, (const char *), rmdir, -1);
+    trace_record('w', AT_FDCWD, path);
+    return real(path);
+}
+
+TRACE_EXPORT int unlink(const char *path)
+{
+    TRACE_REAL(int, (const char *), unlink, -1);
+    trace_record('w', AT_FDCWD, path);
+    return real(path);
+}
+
+TRACE_EXPORT int unlinkat(int dirfd, const char *path, int flags)
+{
+    TRACE_REAL(int, (int, const char *, int), unlinkat, -1);
+    trace_record('w', dirfd, path);
+    return real(dirfd, path, flags);
+}
+
+TRACE_EXPORT int rename(const char *old_path, const char *new_path)
+{
+    TRACE_REAL(int, (const char *, const char *), rename, -1);
+    trace_record('w', AT_FDCWD, old_path);
+    trace_record('w', AT_FDCWD, new_path);
+    return real(old_path, new_path);
+}
+
+TRACE_EXPORT int renameat(int old_dirfd, const char *old_path, int new_dirfd, const char *new_path)
+{
+    TRACE_REAL(int, (int, const char *, int, const char *), renameat, -1);
+    trace_record('w', old_dirfd, old_path);
+    trace_record('w', new_dirfd, new_path);
+    return real(old_dirfd, old_path, new_dirfd, new_path);
+}
+
+TRACE_EXPORT int renameat2(int old_dirfd, const char *old_path, int new_dirfd, const char *new_path, unsigned int flags)
+{
+    TRACE_REAL(int, (int, const char *, int, const char *, unsigned int), renameat2, -1);
+    trace_record('w', old_dirfd, old_path);
+    trace_record('w', new_dirfd, new_path);
+    return real(old_dirfd, old_path, new_dirfd, new_path, flags);
+}
@@ -0,0 +1,274 @@
+#include "header.h"
+
+// Commands given with --worker are started once and kept running across runs, so that tools with a slow startup
+// (type checkers, test runners, ...) only need to do the incremental work for each change
+// Each batch of changed files is written to the worker's stdin (see WorkerProto) and the worker reports that it finished
+// the batch by printing a line containing SUBPROC_MARKER, optionally followed by an exit code (i.e. "WATCH_EXEC_DONE 1")
+// Batches are handled in order, so a batch sent while the worker is still busy with a cancelled one simply waits for it
+// A worker that exited is started again for the next batch
+// The batches are written without blocking, whatever doesn't fit into the pipe is sent once the reactor reports that it can take more
+
+#if defined(_WIN32) || defined(__WIN32__)
+#else
+#   include <fcntl.h>
+#   include <signal.h>
+#   include <unistd.h>
+#endif
+
+typedef struct Worker {
+    Cmd    *cmd;
+    SubProc proc;
+    b32     alive;
+    u32     sent;      // Amount of batches sent to the worker
+    u32     done;      // Amount of batches the worker finished
+    i32     exit_code; // Exit code of the last finished batch
+    AIL_DA(char) pending; // Part of the sent batches, that didn't fit into the pipe yet
+    int     pending_fd;   // stdin while it's registered with the reactor to send `pending`, -1 otherwise
+} Worker;
+AIL_DA_INIT(Worker);
+
+global AIL_DA(Worker) workers;
+
+internal Worker *worker_find(Cmd *cmd)
+{
+    if (!workers.data) workers = ail_da_new_t(Worker);
+    for (u32 i = 0; i < workers.len; i++) {
+        if (workers.data[i].cmd == cmd) return &workers.data[i];
+    }
+    ail_da_push(&workers, ((Worker){ .cmd = cmd, .pending = ail_da_new_t(char), .pending_fd = -1 }));
+    return &workers.data[workers.len - 1];
+}
+
+// Returns whether the batch with the given number was finished and if so, stores its exit code
+internal b32 worker_batch_done(Cmd *cmd, u32 batch, i32 *exit_code)
+{
+    Worker *w = worker_find(cmd);
+    if (w->done <= batch) return false;
+    // @Note: Batches of cancelled runs are finished before, so only the last batch's exit code is ever asked for
+    *exit_code = w->exit_code;
+    return true;
+}
+
+internal void worker_on_marker(void *user, i32 code)
+{
+    Worker *w = &workers.data[(uintptr_t)user]; // @Note: An index is used, since the list may grow while the worker is running
+    if (w->done == w->sent) {
+        log_warn("Worker '%s' finished a batch, that it never received", w->cmd->str);
+        return;
+    }
+    w->done++;
+    w->exit_code = code;
+    runlog_printf("### Worker '%s' finished a batch with code %d\n", w->cmd->str, code);
+}
+
+// Drops the part of the batches, that wasn't sent yet
+internal void worker_drop_pending(Worker *w)
+{
+    if (w->pending_fd >= 0) reactor_remove(w->pending_fd);
+    w->pending_fd  = -1;
+    w->pending.len = 0;
+}
+
+// All batches that the worker didn't finish yet fail once it exited
+internal void worker_exited(Worker *w)
+{
+    worker_drop_pending(w);
+    i32 code = w->proc.res.finished ? w->proc.res.exitCode : -1;
+    if (w->done < w->sent) log_warn("Worker '%s' exited with code %d before finishing its batch", w->cmd->str, code);
+    else                   log_warn("Worker '%s' exited with code %d", w->cmd->str, code);
+    if (w->done < w->sent) {
+        w->done = w->sent;
+        w->exit_code = code ? code : 1;
+    }
+    w->alive = false;
+}
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+// @TODO: Processes are still run synchronously on Windows, so they can't be kept running in the background
+internal b32 worker_send(Cmd *cmd, AIL_DA(str) *argv, AIL_DA(str) *files, u32 *batch)
+{
+    AIL_UNUSED(argv);
+    AIL_UNUSED(files);
+    AIL_UNUSED(batch);
+    log_err("Running '%s' as a worker is not supported on Windows yet", cmd->str);
+    return false;
+}
+
+internal void worker_handle(ReactorEvent ev)
+{
+    AIL_UNUSED(ev);
+}
+
+internal void worker_update(void)
+{
+}
+
+internal i32 worker_poll_interval(void)
+{
+    return -1;
+}
+
+internal void worker_stop_all(u32 grace_ms)
+{
+    AIL_UNUSED(grace_ms);
+}
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+internal b32 worker_start(Worker *w, AIL_DA(str) *argv)
+{
+    // @Note: Writing to a worker that just exited would otherwise kill watch-exec (children get the default action back, see subproc.c)
+    signal(SIGPIPE, SIG_IGN);
+    if (!subproc_start(&w->proc, argv, w->cmd->str, (SubProcOpts){ .pipe_stdin = true }, ail_default_allocator)) return false;
+    fcntl(w->proc.in_fd, F_SETFL, O_NONBLOCK);
+    w->proc.out->on_marker   = worker_on_marker;
+    w->proc.out->marker_user = (void *)(uintptr_t)(w - workers.data);
+    w->alive = true;
+    w->sent  = w->done;
+    return true;
+}
+
+// Writes as much of the pending data as fits into the pipe and waits for the rest to fit, if anything is left
+internal b32 worker_flush(Worker *w)
+{
+    u64 off = 0;
+    while (off < w->pending.len) {
+        ssize_t n = write(w->proc.in_fd, w->pending.data + off, w->pending.len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            log_err("Could not send the changed files to worker '%s': %s", w->cmd->str, strerror(errno));
+            worker_drop_pending(w);
+            return false;
+        }
+        off += (u64)n;
+    }
+    memmove(w->pending.data, w->pending.data + off, w->pending.len - off);
+    w->pending.len -= off;
+    if (!w->pending.len && w->pending_fd >= 0) {
+        reactor_remove(w->pending_fd);
+        w->pending_fd = -1;
+    } else if (w->pending.len && w->pending_fd < 0) {
+        if (!reactor_add(w->proc.in_fd, REACTOR_WORKER, (u32)(w - workers.data))) {
+            log_err("Could not wait until worker '%s' can receive the rest of the changed files", w->cmd->str);
+            w->pending.len = 0;
+            return false;
+        }
+        w->pending_fd = w->proc.in_fd;
+    }
+    return true;
+}
+
+internal b32 worker_write(Worker *w, const char *data, u64 len)
+{
+    ail_da_pushn(&w->pending, data, len);
+    // @Note: Data that waits for the pipe has to be sent first, so that the batches stay in order
+    return w->pending_fd >= 0 || worker_flush(w);
+}
+
+// Sends the changed files to the worker for the command, starting it with `argv` if it isn't running yet
+// Stores the number of the batch, that is passed to worker_batch_done to find out whether the worker finished it
+internal b32 worker_send(Cmd *cmd, AIL_DA(str) *argv, AIL_DA(str) *files, u32 *batch)
+{
+    Worker *w = worker_find(cmd);
+    if (!w->alive && !worker_start(w, argv)) return false;
+    AIL_DA(char) buf = ail_da_new_t(char);
+    char sep = cmd->worker == WORKER_LENGTH ? 0 : '\n';
+    for (u32 i = 0; i < files->len; i++) {
+        ail_da_pushn(&buf, files->data[i], strlen(files->data[i]));
+        ail_da_push(&buf, sep);
+    }
+    char header[32];
+    b32 ok;
+    if (cmd->worker == WORKER_LENGTH) {
+        int n = snprintf(header, sizeof(header), "%u\n", buf.len);
+        ok = worker_write(w, header, n) && worker_write(w, buf.data, buf.len);
+    } else {
+        ail_da_push(&buf, '\n');
+        ok = worker_write(w, buf.data, buf.len);
+    }
+    ail_da_free(&buf);
+    if (!ok) return false;
+    log_info("Sent %u changed files to worker '%s'...", files->len, cmd->str);
+    *batch = w->sent++;
+    return true;
+}
+
+// Forwards the output of a worker, that the reactor reported, sends the rest of its batches and notices when it exited
+internal void worker_handle(ReactorEvent ev)
+{
+    if (ev.kind == REACTOR_WORKER) {
+        if (ev.id < workers.len && workers.data[ev.id].pending_fd >= 0) worker_flush(&workers.data[ev.id]);
+        return;
+    }
+    if (ev.kind != REACTOR_OUTPUT && ev.kind != REACTOR_EXIT) return;
+    for (u32 i = 0; i < workers.len; i++) {
+        Worker *w = &workers.data[i];
+        if (!w->alive || (u32)w->proc.pid != ev.id) continue;
+        if (ev.kind == REACTOR_OUTPUT) subproc_handle_output(&w->proc);
+        if (subproc_reap(&w->proc)) worker_exited(w);
+    }
+}
+
+// Checks whether workers, whose exit isn't reported by the reactor, exited
+internal void worker_update(void)
+{
+    for (u32 i = 0; i < workers.len; i++) {
+        Worker *w = &workers.data[i];
+        if (w->alive && w->proc.exit_fd < 0 && subproc_reap(&w->proc)) worker_exited(w);
+    }
+}
+
+// Returns after how many milliseconds worker_update needs to be called again or -1 if the reactor reports everything
+// Idle workers are only checked once their output was closed
+internal i32 worker_poll_interval(void)
+{
+    i32 timeout_ms = -1;
+    for (u32 i = 0; i < workers.len; i++) {
+        Worker *w = &workers.data[i];
+        if (!w->alive || (w->done == w->sent && w->proc.out_fd >= 0)) continue;
+        i32 interval = subproc_poll_interval(&w->proc);
+        if (interval >= 0 && (timeout_ms < 0 || interval < timeout_ms)) timeout_ms = interval;
+    }
+    return timeout_ms;
+}
+
+// Closes the workers' stdin, so they can stop by themselves, asks the ones still running after the grace period to stop
+// and kills them if they're still running after another grace period
+internal void worker_stop_all(u32 grace_ms)
+{
+    SubProc procs[BUFFER_LEN*4];
+    u32 n = 0;
+    for (u32 i = 0; i < workers.len && n < AIL_ARRLEN(procs); i++) {
+        Worker *w = &workers.data[i];
+        if (!w->alive) continue;
+        worker_drop_pending(w);
+        close(w->proc.in_fd);
+        w->proc.in_fd = -1;
+        w->proc.out->on_marker = NULL;
+        w->alive = false;
+        procs[n++] = w->proc;
+    }
+    u64 deadline = timer_now_ms() + grace_ms;
+    u32 signals  = 0; // Amount of signals sent so far, the first one lets them stop gracefully
+    while (n) {
+        u64 now = timer_now_ms();
+        if (signals < 2 && now >= deadline) {
+            for (u32 i = 0; i < n; i++) subproc_kill(&procs[i], signals == 1);
+            deadline = now + grace_ms;
+            signals++;
+        }
+        i32 idx = subproc_wait_any(procs, n, signals == 2 ? -1 : (i32)(deadline - now));
+        if (idx >= 0) procs[idx] = procs[--n];
+    }
+}
+
+#endif
@@ -0,0 +1,381 @@
+#include "header.h"
+
+// With --zygote, a helper process is forked right at startup, while watch-exec is still small, and starts all commands
+// instead of watch-exec itself. The arguments, environment and fds of each process are sent to it over a socket, after
+// which it replies with the pid and later reports the process's exit, since only the zygote can wait for its children
+// That keeps the latency of starting commands independent of how much memory watch-exec used up in the meantime
+// (i.e. for its history, cache or the output of commands), which can be compared with --bench-spawn
+// @Note: Requests that don't fit into a single message are started directly, as are all commands once the zygote is gone
+
+#if defined(_WIN32) || defined(__WIN32__)
+#else
+#   include <sys/socket.h>
+#   include <sys/uio.h>
+#endif
+
+#ifndef ZYGOTE_MSG_MAX
+#   define ZYGOTE_MSG_MAX (64 << 10) // Maximum size of a request, larger ones are started directly
+#endif
+
+global b32 zygote_enabled;
+
+
+#if defined(_WIN32) || defined(__WIN32__)
+//////////////////////////
+// Windows Implementation
+//////////////////////////
+
+// @TODO: Windows can't fork, but a helper process could still create the processes via PROC_THREAD_ATTRIBUTE_PARENT_PROCESS
+internal b32 zygote_init(void)
+{
+    log_err("Starting commands via a zygote is not supported on Windows yet");
+    return false;
+}
+
+internal void zygote_watch(void)
+{
+}
+
+internal void zygote_handle(void)
+{
+}
+
+#else
+////////////////////////
+// POSIX Implementation
+////////////////////////
+
+#if !defined(MSG_NOSIGNAL)
+#   define MSG_NOSIGNAL 0 // Writing to a closed socket raises SIGPIPE then, which isn't ignored either way
+#endif
+#if !defined(MSG_CMSG_CLOEXEC)
+#   define MSG_CMSG_CLOEXEC 0
+#endif
+
+typedef enum ZygoteReply {
+    ZYGOTE_SPAWNED, // value is 0 or the error reported by posix_spawn
+    ZYGOTE_EXITED,  // value is the status reported by waitpid
+} ZygoteReply;
+
+typedef struct ZygoteMsg {
+    u32 kind;
+    i32 pid;
+    i32 value;
+} ZygoteMsg;
+
+// Followed by the NUL-terminated exe, in_path, pty_name, arguments and environment, where an empty exe or pty_name means NULL
+// The fds whose bit is set in `passed` are sent along in their order
+typedef struct ZygoteReq {
+    u32 n_args;
+    u32 n_env;
+    u32 n_fds;
+    u32 passed;
+} ZygoteReq;
+
+typedef struct ZygoteChild {
+    pid_t pid;
+    int   wstatus;
+    b32   exited;
+} ZygoteChild;
+AIL_DA_INIT(ZygoteChild);
+
+global AIL_DA(ZygoteChild) zygote_children; // Processes started by the zygote, which weren't reaped yet
+global int   zygote_sock = -1;
+global pid_t zygote_pid;
+global char  zygote_buf[ZYGOTE_MSG_MAX];
+global int   zygote_wake[2] = { -1, -1 };   // Self-pipe of the zygote, that is written to on SIGCHLD
+global char *zygote_args[ZYGOTE_MSG_MAX/2]; // Arguments and environment of a request received by the zygote
+
+internal b32 zygote_put(u64 *len, const char *s)
+{
+    u64 n = strlen(s ? s : "") + 1;
+    if (*len + n > sizeof(zygote_buf)) return false;
+    memcpy(zygote_buf + *len, s ? s : "", n);
+    *len += n;
+    return true;
+}
+
+internal char *zygote_get(char **pos, char *end)
+{
+    char *s = *pos;
+    char *nul = s < end ? memchr(s, 0, end - s) : NULL;
+    if (!nul) return NULL;
+    *pos = nul + 1;
+    return s;
+}
+
+internal b32 zygote_send(int sock, ZygoteMsg msg)
+{
+    ssize_t n;
+    do n = send(sock, &msg, sizeof(msg), MSG_NOSIGNAL); while (n < 0 && errno == EINTR);
+    return n == sizeof(msg);
+}
+
+internal void zygote_on_child(int sig)
+{
+    AIL_UNUSED(sig);
+    int saved = errno;
+    if (write(zygote_wake[1], "", 1) < 0) {} // A full pipe is already signaled
+    errno = saved;
+}
+
+// Starts the process described by the request, whose fds are closed afterwards
+internal void zygote_serve_request(int sock, char *data, u64 len, int *fds, u32 n_fds)
+{
+    ZygoteReq req;
+    SubProcSpawn spawn = {0};
+    char **args = zygote_args;
+    b32 valid = len >= sizeof(req);
+    if (valid) {
+        memcpy(&req, data, sizeof(req));
+        valid = req.n_fds <= SUBPROC_SPAWN_FDS && req.n_args + req.n_env + 2 <= AIL_ARRLEN(zygote_args);
+    }
+    char *pos = data + sizeof(req), *end = data + len;
+    if (valid) {
+        spawn.exe      = zygote_get(&pos, end);
+        spawn.in_path  = zygote_get(&pos, end);
+        spawn.pty_name = zygote_get(&pos, end);
+        valid = spawn.exe && spawn.in_path && spawn.pty_name;
+    }
+    // The environment starts after the NULL terminating the arguments
+    for (u32 i = 0; valid && i < req.n_args + req.n_env; i++) valid = (args[i + (i >= req.n_args)] = zygote_get(&pos, end)) != NULL;
+    u32 used = 0;
+    for (u32 i = 0; valid && i < req.n_fds; i++) {
+        spawn.fds[i] = -1;
+        if (!(req.passed & (1u << i))) continue;
+        valid = used < n_fds;
+        if (valid) spawn.fds[i] = fds[used++];
+    }
+    ZygoteMsg reply = { .kind = ZYGOTE_SPAWNED, .value = EINVAL };
+    if (valid && used == n_fds) {
+        args[req.n_args] = NULL;
+        args[req.n_args + 1 + req.n_env] = NULL;
+        if (!spawn.exe[0])      spawn.exe = NULL;
+        if (!spawn.pty_name[0]) spawn.pty_name = NULL;
+        spawn.argv  = args;
+        spawn.env   = &args[req.n_args + 1];
+        spawn.n_fds = req.n_fds;
+        pid_t pid = 0;
+        reply.value = subproc_spawn_direct(&spawn, &pid);
+        reply.pid   = reply.value ? 0 : pid;
+    }
+    for (u32 i = 0; i < n_fds; i++) close(fds[i]);
+    zygote_send(sock, reply);
+}
+
+// Runs in the zygote until watch-exec closes its end of the socket
+internal void zygote_serve(int sock)
+{
+    // @Note: Ctrl+C is meant for watch-exec, which stops the commands itself, so the zygote needs to outlive it
+    signal(SIGINT, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+    if (pipe(zygote_wake) < 0) _exit(1);
+    for (u32 i = 0; i < AIL_ARRLEN(zygote_wake); i++) {
+        fcntl(zygote_wake[i], F_SETFL, O_NONBLOCK);
+        fcntl(zygote_wake[i], F_SETFD, FD_CLOEXEC);
+    }
+    struct sigaction sa = {0};
+    sa.sa_handler = zygote_on_child;
+    sa.sa_flags   = SA_NOCLDSTOP | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    char *data = zygote_buf;
+    for (;;) {
+        struct pollfd pfds[2] = { { .fd = sock, .events = POLLIN }, { .fd = zygote_wake[0], .events = POLLIN } };
+        if (poll(pfds, AIL_ARRLEN(pfds), -1) < 0) continue;
+        if (pfds[1].revents) {
+            char c;
+            while (read(zygote_wake[0], &c, 1) == 1) {}
+            int wstatus;
+            pid_t pid;
+            while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) zygote_send(sock, (ZygoteMsg){ .kind = ZYGOTE_EXITED, .pid = pid, .value = wstatus });
+        }
+        if (!pfds[0].revents) continue;
+        union { struct cmsghdr align; char data[CMSG_SPACE(sizeof(int)*SUBPROC_SPAWN_FDS)]; } ctrl;
+        struct iovec  iov = { .iov_base = data, .iov_len = sizeof(zygote_buf) };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.data, .msg_controllen = sizeof(ctrl.data) };
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) _exit(0);
+        int fds[SUBPROC_SPAWN_FDS];
+        u32 n_fds = 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            u32 count = (u32)((cmsg->cmsg_len - CMSG_LEN(0))/sizeof(int));
+            for (u32 i = 0; i < count; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i*sizeof(int), sizeof(int));
+                // @Note: The fds are moved above the ones they are duplicated onto, so that duplicating one can't replace another
+                // one that is still needed and dup2 onto the same fd doesn't keep FD_CLOEXEC set for the child
+                if (fd < SUBPROC_SPAWN_FDS) {
+                    int moved = fcntl(fd, F_DUPFD_CLOEXEC, SUBPROC_SPAWN_FDS);
+                    close(fd);
+                    fd = moved;
+                }
+                if (n_fds < AIL_ARRLEN(fds)) fds[n_fds++] = fd;
+                else close(fd);
+            }
+        }
+        zygote_serve_request(sock, data, (u64)n, fds, n_fds);
+    }
+}
+
+// Forks the zygote, which needs to happen before anything else is started or opened
+internal b32 zygote_init(void)
+{
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, socks) < 0) {
+        log_err("Could not create the zygote's socket: %s", strerror(errno));
+        return false;
+    }
+    for (u32 i = 0; i < AIL_ARRLEN(socks); i++) fcntl(socks[i], F_SETFD, FD_CLOEXEC);
+    fflush(stdout);
+    fflush(stderr);
+    zygote_pid = fork();
+    if (zygote_pid < 0) {
+        log_err("Could not start the zygote: %s", strerror(errno));
+        close(socks[0]);
+        close(socks[1]);
+        return false;
+    }
+    if (zygote_pid == 0) {
+        close(socks[0]);
+        zygote_serve(socks[1]);
+        _exit(0);
+    }
+    close(socks[1]);
+    zygote_sock     = socks[0];
+    zygote_children = ail_da_new_t(ZygoteChild);
+    zygote_enabled  = true;
+    return true;
+}
+
+// Lets the reactor report the zygote's messages, which needs to be called after reactor_init
+internal void zygote_watch(void)
+{
+    if (zygote_enabled) reactor_add(zygote_sock, REACTOR_ZYGOTE, 0);
+}
+
+// Falls back to starting commands directly, after the zygote exited unexpectedly
+internal void zygote_lost(void)
+{
+    log_warn("The zygote exited unexpectedly, so commands are started directly from now on");
+    zygote_enabled = false;
+    reactor_remove(zygote_sock);
+    close(zygote_sock);
+    zygote_sock = -1;
+    kill(zygote_pid, SIGKILL);
+    waitpid(zygote_pid, NULL, 0);
+}
+
+// Receives the next message and records it, if it reports an exit
+// Returns false if there is none or the zygote is gone
+internal b32 zygote_receive(ZygoteMsg *msg, b32 block)
+{
+    if (!zygote_enabled) return false;
+    ssize_t n;
+    do n = recv(zygote_sock, msg, sizeof(*msg), block ? 0 : MSG_DONTWAIT); while (n < 0 && errno == EINTR);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+    if (n != sizeof(*msg)) {
+        zygote_lost();
+        return false;
+    }
+    if (msg->kind != ZYGOTE_EXITED) return true;
+    for (u32 i = 0; i < zygote_children.len; i++) {
+        ZygoteChild *child = &zygote_children.data[i];
+        if (child->pid != msg->pid) continue;
+        child->wstatus = msg->value;
+        child->exited  = true;
+    }
+    return true;
+}
+
+// Records all exits that were reported so far
+internal void zygote_handle(void)
+{
+    ZygoteMsg msg;
+    while (zygote_receive(&msg, false)) {}
+}
+
+// Lets the zygote start the process
+// Returns 0 or the error reported by posix_spawn, or -1 if the process needs to be started directly instead
+internal int zygote_spawn(SubProcSpawn *spawn, pid_t *pid)
+{
+    if (!zygote_enabled) return -1;
+    ZygoteReq req = { .n_fds = spawn->n_fds };
+    u64 len = sizeof(req);
+    b32 fits = zygote_put(&len, spawn->exe) && zygote_put(&len, spawn->in_path) && zygote_put(&len, spawn->pty_name);
+    for (; fits && spawn->argv[req.n_args]; req.n_args++) fits = zygote_put(&len, spawn->argv[req.n_args]);
+    for (; fits && spawn->env[req.n_env];   req.n_env++)  fits = zygote_put(&len, spawn->env[req.n_env]);
+    if (!fits) return -1;
+    int fds[SUBPROC_SPAWN_FDS];
+    u32 n_fds = 0;
+    for (u32 i = 0; i < spawn->n_fds; i++) {
+        if (spawn->fds[i] < 0) continue;
+        req.passed |= 1u << i;
+        fds[n_fds++] = spawn->fds[i];
+    }
+    memcpy(zygote_buf, &req, sizeof(req));
+
+    union { struct cmsghdr align; char data[CMSG_SPACE(sizeof(int)*SUBPROC_SPAWN_FDS)]; } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct iovec  iov = { .iov_base = zygote_buf, .iov_len = len };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if (n_fds) {
+        msg.msg_control    = ctrl.data;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int)*n_fds);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(int)*n_fds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int)*n_fds);
+    }
+    ssize_t sent;
+    do sent = sendmsg(zygote_sock, &msg, MSG_NOSIGNAL); while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        if (errno != EMSGSIZE && errno != ENOBUFS) zygote_lost();
+        return -1;
+    }
+    // @Note: Exits of earlier processes may arrive before the reply, which are recorded meanwhile
+    ZygoteMsg reply;
+    while (zygote_receive(&reply, true)) {
+        if (reply.kind != ZYGOTE_SPAWNED) continue;
+        if (reply.value) return reply.value;
+        *pid = reply.pid;
+        ail_da_push(&zygote_children, ((ZygoteChild){ .pid = reply.pid }));
+        return 0;
+    }
+    return -1;
+}
+
+// Returns like waitpid with WNOHANG, but also for processes that were started by the zygote
+// @Note: Exits of processes that were orphaned by a lost zygote can't be known anymore, so they fail with ECHILD once they're gone
+internal pid_t zygote_waitpid(pid_t pid, int *wstatus)
+{
+    zygote_handle();
+    for (u32 i = 0; i < zygote_children.len; i++) {
+        ZygoteChild *child = &zygote_children.data[i];
+        if (child->pid != pid) continue;
+        if (!child->exited && (zygote_enabled || kill(pid, 0) == 0)) return 0;
+        b32 exited = child->exited;
+        *wstatus = child->wstatus;
+        zygote_children.data[i] = zygote_children.data[--zygote_children.len];
+        if (exited) return pid;
+        errno = ECHILD;
+        return -1;
+    }
+    return waitpid(pid, wstatus, WNOHANG);
+}
+
+// Returns the fd that reports the process's exit, if it was started by the zygote, or -1 otherwise
+internal int zygote_exit_fd(pid_t pid)
+{
+    if (!zygote_enabled) return -1;
+    for (u32 i = 0; i < zygote_children.len; i++) {
+        if (zygote_children.data[i].pid == pid) return zygote_sock;
+    }
+    return -1;
+}
+
+#endif